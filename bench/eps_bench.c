@@ -0,0 +1,426 @@
+/**
+ * @file eps_bench.c
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Microbenchmarks of the EPS command path, run against the P31u
+ * simulator (src/eps_sim.c).
+ *
+ * Every benchmark calls one function of eps_extern.h a fixed number of times,
+ * first from a single thread and then split across N threads, and reports the
+ * throughput and the latency distribution of the individual calls. Results
+ * can be saved as a baseline and later runs compared against it; a benchmark
+ * whose throughput drops or whose p99 latency grows by more than the
+ * tolerance is reported as a regression and makes the program exit with 1.
+ *
+ * Usage: eps_bench.out [-n calls] [-t threads] [-d device delay us] [-f bus Hz]
+ *                      [-k filter] [-w baseline] [-c baseline] [-r tolerance %]
+ *
+ * Reboot and hard reset are not benchmarked, they reset the simulated device.
+ *
+ * @version 0.1
+ * @date 2021-04-15
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include "eps_extern.h"
+#include "eps_iface.h"
+#include "eps_sim.h"
+#include "main.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Provided by main.c in the flight and tester binaries.
+int sys_boot_count = 0;
+volatile sig_atomic_t done = 0;
+__thread int sys_status;
+
+#define EPS_BENCH_MAX_RESULTS 64
+#define EPS_BENCH_NAME_LEN 32
+
+/**
+ * @brief One benchmark: fn is called repeatedly by every thread, i is the
+ * running call index of the thread.
+ *
+ */
+typedef struct
+{
+    const char *name;
+    int (*fn)(int i);
+    void (*setup)(); // run once before each measurement, may be NULL
+} eps_bench;
+
+/**
+ * @brief Result of one benchmark at one thread count.
+ *
+ */
+typedef struct
+{
+    char name[EPS_BENCH_NAME_LEN];
+    int threads;
+    double ops_s;
+    double p50_us;
+    double p99_us;
+    double max_us;
+    unsigned long errors;
+} eps_bench_result;
+
+/**
+ * @brief Per-thread state of a measurement.
+ *
+ */
+typedef struct
+{
+    const eps_bench *b;
+    int calls;
+    uint64_t *lat_ns;
+    unsigned long errors;
+    pthread_barrier_t *start;
+} eps_bench_thread;
+
+static inline uint64_t eps_bench_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int bench_ping(int i)
+{
+    return eps_ping();
+}
+
+static int bench_get_hk(int i)
+{
+    hkparam_t hk;
+    return eps_get_hk(&hk);
+}
+
+static int bench_get_hk_out(int i)
+{
+    eps_hk_out_t hk_out;
+    return eps_get_hk_out(&hk_out);
+}
+
+static int bench_get_hk_raw(int i)
+{
+    eps_hk_raw_t raw;
+    return eps_get_hk_raw(&raw);
+}
+
+static int bench_get_hk_out_raw(int i)
+{
+    eps_hk_raw_t raw;
+    return eps_get_hk_out_raw(&raw);
+}
+
+static int bench_hk_snapshot(int i)
+{
+    hkparam_t hk;
+    eps_hk_out_t hk_out;
+    return eps_hk_snapshot(&hk, &hk_out, NULL, 0);
+}
+
+static void bench_hk_snapshot_setup()
+{
+    hkparam_t hk;
+    eps_hk_out_t hk_out;
+    eps_hk_snapshot(&hk, &hk_out, NULL, 1); // make sure the cache holds a sample
+}
+
+static int bench_tgl_lup(int i)
+{
+    return eps_tgl_lup(PWR_3V3);
+}
+
+static int bench_lup_set(int i)
+{
+    return eps_lup_set(PWR_3V3, i & 1);
+}
+
+static int bench_lup_set_mask(int i)
+{
+    return (i & 1) ? eps_lup_set_mask(0x20, 0x00) : eps_lup_set_mask(0x00, 0x20);
+}
+
+static int bench_get_conf(int i)
+{
+    eps_config_t conf;
+    return eps_get_conf(&conf);
+}
+
+static int bench_get_conf_bus(int i)
+{
+    eps_config_t conf;
+    eps_conf_invalidate();
+    return eps_get_conf(&conf);
+}
+
+static eps_config_t bench_conf[1];
+
+static void bench_set_conf_setup()
+{
+    eps_conf_invalidate();
+    eps_get_conf(bench_conf);
+}
+
+static int bench_set_conf(int i)
+{
+    eps_config_t conf = *bench_conf;
+    return eps_set_conf(&conf);
+}
+
+static int bench_set_conf_bus(int i)
+{
+    eps_config_t conf = *bench_conf;
+    conf.battheater_high = bench_conf->battheater_high + (i & 1); // differs from the shadow every call
+    return eps_set_conf(&conf);
+}
+
+static int bench_submit_poll(int i)
+{
+    eps_cmd_t cmd = {.op = EPS_OP_PING};
+    int ticket = eps_cmd_submit(&cmd), ret = 0, status;
+    if (ticket < 0)
+        return ticket;
+    while ((status = eps_cmd_poll(ticket, &ret)) == 0)
+        sched_yield();
+    return status < 0 ? status : ret;
+}
+
+static const eps_bench eps_benches[] = {
+    {"ping", bench_ping, NULL},
+    {"get_hk", bench_get_hk, NULL},
+    {"get_hk_out", bench_get_hk_out, NULL},
+    {"get_hk_raw", bench_get_hk_raw, NULL},
+    {"get_hk_out_raw", bench_get_hk_out_raw, NULL},
+    {"hk_snapshot", bench_hk_snapshot, bench_hk_snapshot_setup},
+    {"tgl_lup", bench_tgl_lup, NULL},
+    {"lup_set", bench_lup_set, NULL},
+    {"lup_set_mask", bench_lup_set_mask, NULL},
+    {"get_conf", bench_get_conf, bench_set_conf_setup},
+    {"get_conf_bus", bench_get_conf_bus, NULL},
+    {"set_conf", bench_set_conf, bench_set_conf_setup},
+    {"set_conf_bus", bench_set_conf_bus, bench_set_conf_setup},
+    {"submit_poll", bench_submit_poll, NULL},
+};
+
+static void *eps_bench_worker(void *arg)
+{
+    eps_bench_thread *t = (eps_bench_thread *)arg;
+    pthread_barrier_wait(t->start);
+    for (int i = 0; i < t->calls; i++)
+    {
+        uint64_t t0 = eps_bench_now();
+        int ret = t->b->fn(i);
+        t->lat_ns[i] = eps_bench_now() - t0;
+        t->errors += ret < 0;
+    }
+    return NULL;
+}
+
+static int eps_bench_cmp(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Runs one benchmark with the calls split across nthreads threads.
+static int eps_bench_run(const eps_bench *b, int calls, int nthreads, eps_bench_result *res)
+{
+    int per_thread = (calls + nthreads - 1) / nthreads;
+    uint64_t *lat_ns = calloc((size_t)per_thread * nthreads, sizeof(uint64_t));
+    eps_bench_thread *t = calloc(nthreads, sizeof(eps_bench_thread));
+    pthread_t *tid = calloc(nthreads, sizeof(pthread_t));
+    if (lat_ns == NULL || t == NULL || tid == NULL)
+    {
+        free(lat_ns);
+        free(t);
+        free(tid);
+        return -1;
+    }
+    if (b->setup != NULL)
+        b->setup();
+
+    pthread_barrier_t start;
+    pthread_barrier_init(&start, NULL, nthreads + 1);
+    for (int i = 0; i < nthreads; i++)
+    {
+        t[i] = (eps_bench_thread){.b = b, .calls = per_thread, .lat_ns = lat_ns + (size_t)i * per_thread, .start = &start};
+        pthread_create(&tid[i], NULL, eps_bench_worker, &t[i]);
+    }
+    uint64_t t0 = eps_bench_now();
+    pthread_barrier_wait(&start);
+    for (int i = 0; i < nthreads; i++)
+        pthread_join(tid[i], NULL);
+    uint64_t elapsed = eps_bench_now() - t0;
+    pthread_barrier_destroy(&start);
+
+    size_t n = (size_t)per_thread * nthreads;
+    qsort(lat_ns, n, sizeof(uint64_t), eps_bench_cmp);
+    memset(res, 0x0, sizeof(eps_bench_result));
+    snprintf(res->name, sizeof(res->name), "%s", b->name);
+    res->threads = nthreads;
+    res->ops_s = n * 1e9 / (elapsed ? elapsed : 1);
+    res->p50_us = lat_ns[n / 2] * 1e-3;
+    res->p99_us = lat_ns[(n * 99) / 100] * 1e-3;
+    res->max_us = lat_ns[n - 1] * 1e-3;
+    for (int i = 0; i < nthreads; i++)
+        res->errors += t[i].errors;
+
+    free(lat_ns);
+    free(t);
+    free(tid);
+    return 1;
+}
+
+// Baseline file: one "name threads ops_s p50_us p99_us" line per result.
+static int eps_bench_write(const char *fname, const eps_bench_result *res, int nres)
+{
+    FILE *fp = fopen(fname, "w");
+    if (fp == NULL)
+    {
+        perror("eps_bench");
+        return -1;
+    }
+    fprintf(fp, "# name threads ops_s p50_us p99_us\n");
+    for (int i = 0; i < nres; i++)
+        fprintf(fp, "%s %d %.1f %.1f %.1f\n", res[i].name, res[i].threads, res[i].ops_s, res[i].p50_us, res[i].p99_us);
+    fclose(fp);
+    return 1;
+}
+
+// Compares results with a baseline file. Returns the number of regressions, or -1.
+static int eps_bench_compare(const char *fname, const eps_bench_result *res, int nres, double tol)
+{
+    FILE *fp = fopen(fname, "r");
+    if (fp == NULL)
+    {
+        perror("eps_bench");
+        return -1;
+    }
+    char line[256], name[EPS_BENCH_NAME_LEN];
+    int threads, regressions = 0;
+    double ops_s, p50_us, p99_us;
+    printf("\n%-14s %7s %12s %12s %8s %10s %10s %8s\n", "benchmark", "threads", "base[op/s]", "ops/s", "change", "base p99", "p99[us]", "change");
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+        if (line[0] == '#' || sscanf(line, "%31s %d %lf %lf %lf", name, &threads, &ops_s, &p50_us, &p99_us) != 5)
+            continue;
+        for (int i = 0; i < nres; i++)
+        {
+            if (strcmp(res[i].name, name) || res[i].threads != threads)
+                continue;
+            double d_ops = ops_s > 0 ? (res[i].ops_s / ops_s - 1) * 100 : 0;
+            double d_p99 = p99_us > 0 ? (res[i].p99_us / p99_us - 1) * 100 : 0;
+            int bad = d_ops < -tol || d_p99 > tol;
+            regressions += bad;
+            printf("%-14s %7d %12.1f %12.1f %+7.1f%% %10.1f %10.1f %+7.1f%%%s\n", name, threads, ops_s, res[i].ops_s, d_ops,
+                   p99_us, res[i].p99_us, d_p99, bad ? "  REGRESSION" : "");
+        }
+    }
+    fclose(fp);
+    return regressions;
+}
+
+int main(int argc, char *argv[])
+{
+    int calls = 200, nthreads = 4, opt;
+    long delay_us = -1, bus_hz = -1;
+    double tol = 10;
+    const char *filter = NULL, *write_fname = NULL, *cmp_fname = NULL;
+    while ((opt = getopt(argc, argv, "n:t:d:f:k:w:c:r:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            calls = atoi(optarg);
+            break;
+        case 't':
+            nthreads = atoi(optarg);
+            break;
+        case 'd':
+            delay_us = atol(optarg);
+            break;
+        case 'f':
+            bus_hz = atol(optarg);
+            break;
+        case 'k':
+            filter = optarg;
+            break;
+        case 'w':
+            write_fname = optarg;
+            break;
+        case 'c':
+            cmp_fname = optarg;
+            break;
+        case 'r':
+            tol = atof(optarg);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-n calls] [-t threads] [-d device delay us] [-f bus Hz] "
+                            "[-k filter] [-w baseline] [-c baseline] [-r tolerance %%]\n",
+                    argv[0]);
+            return opt == 'h' ? 0 : 2;
+        }
+    }
+    if (calls < 1 || nthreads < 1)
+    {
+        fprintf(stderr, "eps_bench: calls and threads must be positive\n");
+        return 2;
+    }
+    if (delay_us >= 0)
+        eps_sim_set_latency(delay_us);
+    if (bus_hz >= 0)
+        eps_sim_set_bus_hz(bus_hz);
+
+    if (eps_init() < 0)
+    {
+        fprintf(stderr, "eps_bench: eps_init failed\n");
+        return 1;
+    }
+    pthread_t worker;
+    int worker_id = 0;
+    pthread_create(&worker, NULL, eps_cmd_thread, &worker_id);
+
+    eps_bench_result res[EPS_BENCH_MAX_RESULTS];
+    int nres = 0;
+    printf("%-14s %7s %8s %12s %10s %10s %10s %7s\n", "benchmark", "threads", "calls", "ops/s", "p50[us]", "p99[us]", "max[us]", "errors");
+    for (int i = 0; i < (int)(sizeof(eps_benches) / sizeof(eps_benches[0])); i++)
+    {
+        if (filter != NULL && strstr(eps_benches[i].name, filter) == NULL)
+            continue;
+        int counts[2] = {1, nthreads};
+        for (int j = 0; j < 2 - (nthreads == 1) && nres < EPS_BENCH_MAX_RESULTS; j++)
+        {
+            eps_bench_result *r = &res[nres];
+            if (eps_bench_run(&eps_benches[i], calls, counts[j], r) < 0)
+                continue;
+            nres++;
+            printf("%-14s %7d %8d %12.1f %10.1f %10.1f %10.1f %7lu\n", r->name, r->threads, calls, r->ops_s,
+                   r->p50_us, r->p99_us, r->max_us, r->errors);
+        }
+    }
+
+    done = 1;
+    pthread_cond_broadcast(eps_cmd_cond);
+    pthread_join(worker, NULL);
+    eps_destroy();
+
+    if (write_fname != NULL && eps_bench_write(write_fname, res, nres) < 0)
+        return 1;
+    if (cmp_fname != NULL)
+    {
+        int regressions = eps_bench_compare(cmp_fname, res, nres, tol);
+        if (regressions < 0)
+            return 1;
+        printf("%d regression(s) beyond %.0f%%\n", regressions, tol);
+        return regressions > 0;
+    }
+    return 0;
+}
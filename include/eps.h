@@ -14,10 +14,306 @@
 
 #include "eps_extern.h"
 #include "eps_iface.h"
+#include "eps_log.h"
+#include <pthread.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
-#define EPS_CMD_TIMEOUT 5
-#define EPS_LOOP_TIMER 1 // seconds
+#define EPS_CMD_TIMEOUT 5 // seconds a command may wait in the queue
+#define EPS_CMDQ_DEPTH 32 // maximum number of outstanding commands
+#define EPS_CMDQ_CRIT_RESERVE 4 // queue entries only critical commands may take
+#define EPS_RETRY_BACKOFF_US 1000 // wait before the first retry of a failed command, doubled for each further one
+#define EPS_RETRY_BACKOFF_MAX_US 16000 // longest wait between retries
+#define EPS_BUS_RESET_AFTER 4 // consecutive failed commands on a bus before its handles are reopened
+#define EPS_LOOP_TIMER 1 // seconds, longest command worker wait before it rechecks done
+#define EPS_WDT_PERIOD_MS 1000 // ground watchdog kick period
+#define EPS_WDT_TIMEOUT_S 172800 // ground watchdog timeout of the P31u, 48 h
+#define EPS_WDT_RETRIES 3 // further attempts at a failed kick within its period
+#define EPS_WDT_RT_PRIO_ENV "EPS_WDT_RT_PRIO" // environment variable holding the SCHED_FIFO priority of the kicker, 0 or unset for none
+#define EPS_WDT_CPU_ENV "EPS_WDT_CPU" // environment variable holding the CPU the kicker is pinned to, unset for any
+#define EPS_HK_PERIOD_MIN_MS 100 // hkparam_t poll period while values change
+#define EPS_HK_PERIOD_MAX_MS 5000 // hkparam_t poll period while values are steady
+#define EPS_HK_OUT_PERIOD_MIN_MS 100 // eps_hk_out_t poll period while values change
+#define EPS_HK_OUT_PERIOD_MAX_MS 5000 // eps_hk_out_t poll period while values are steady
+#define EPS_ADAPT_BV_SLOPE 20 // mV/s of battery voltage change that counts as activity
+#define EPS_ADAPT_BV_NOISE 20 // mV of battery voltage change below which it is noise
+#define EPS_ADAPT_CUR_STEP 50 // mA of current change between samples that counts as activity
+#define EPS_POLL_SLACK_MS 20  // tasks due this soon are folded into the current bus batch
+#define EPS_LUP_MASK_MAX_AGE_MS (2 * EPS_HK_OUT_PERIOD_MAX_MS) // cached output state older than this is read again before a mask switch
+#define EPS_SUB_MAX 16 // maximum number of housekeeping subscribers
+#define EPS_I2C_BUS 1 // I2C bus of the default device
+#define EPS_I2C_ADDR 0x1b // I2C address of the default device
+#define EPS_DEV_MAX 8 // devices in the device table
+#define EPS_BUS_MAX 8 // distinct I2C buses, each gets its own worker threads
+#define EPS_DEV_NAME_LEN 16 // device name length, including the terminator
+#define EPS_DEV_DEFAULT_NAME "eps" // name of the default device
+#define EPS_DEVICES_ENV "EPS_DEVICES" // environment variable holding the device table, "name@bus:addr[,...]"
+#define EPS_XFER_DELAY 1000 // microseconds between a raw command and its reply
+#define EPS_LOG_FNAME "eps_hk_%d.bin" // housekeeping log of the first device, keyed by sys_boot_count
+#define EPS_LOG_FNAME_DEV "eps_hk_%d_%s.bin" // housekeeping log of further devices, keyed by sys_boot_count and name
+#define EPS_LOG_RECORDS 65536 // housekeeping log capacity in records
+#define EPS_LOG_SYNC_EVERY 64 // records between asynchronous write-backs
+#define EPS_SRV_CLIENTS 32 // command server connections
+#define EPS_SRV_INFLIGHT 64 // command server requests queued at once, over all clients
+#define EPS_SRV_BACKLOG 8 // pending connections on the command server socket
+#define EPS_SRV_RECV_BURST 16 // requests read from one client per wakeup
+#define EPS_AGG_WINDOW_S 5580 // housekeeping statistics window, one orbit
+#define EPS_AGG_BUCKET_S 60 // resolution of the statistics window
+#define EPS_AGG_BUCKETS (EPS_AGG_WINDOW_S / EPS_AGG_BUCKET_S) // completed buckets in the window
+#define EPS_AGG_EWMA_TAU_S 60 // time constant of the moving averages
+#define EPS_AGG_GAP_S 15 // longest interval between samples that is integrated
+
+/**
+ * @brief An open housekeeping log.
+ *
+ */
+typedef struct
+{
+    int fd;
+    uint8_t *map;
+    size_t len;
+    eps_log_hdr_t *hdr;
+    uint32_t capacity;
+    int boot_count;
+} eps_log_t;
+
+struct eps_shm;
+
+/**
+ * @brief A shared-memory housekeeping segment being published.
+ *
+ */
+typedef struct
+{
+    pthread_mutex_t m;  // serializes writers, readers go by the sequence lock
+    struct eps_shm *shm;
+    char name[32];
+} eps_shm_pub_t;
+
+/**
+ * @brief A bucket of the statistics window and its extreme value.
+ *
+ */
+typedef struct
+{
+    uint32_t bucket;
+    int32_t val;
+} eps_agg_ent_t;
+
+/**
+ * @brief Streaming statistics of one housekeeping channel. Samples go into
+ * the current bucket; completed buckets keep their sums in a ring and their
+ * extremes in monotonic deques, oldest first, so that the window minimum and
+ * maximum are at the front.
+ *
+ */
+typedef struct
+{
+    uint64_t samples;
+    uint64_t t_last; // time of the last sample, 0 before the first
+    int32_t last;
+    double ewma;
+    int32_t cur_min, cur_max;
+    int64_t cur_sum;
+    uint32_t cur_n;
+    int64_t win_sum; // completed buckets in the window
+    uint32_t win_n;
+    int64_t sum[EPS_AGG_BUCKETS]; // completed buckets, indexed by bucket % EPS_AGG_BUCKETS
+    uint32_t n[EPS_AGG_BUCKETS];
+    eps_agg_ent_t minq[EPS_AGG_BUCKETS], maxq[EPS_AGG_BUCKETS];
+    int min_head, min_len, max_head, max_len;
+} eps_agg_chan_t;
+
+/**
+ * @brief Running integral (energy or charge) over the statistics window.
+ *
+ */
+typedef struct
+{
+    double total;
+    double cur;
+    double win; // completed buckets in the window
+    double ring[EPS_AGG_BUCKETS];
+} eps_agg_integ_t;
+
+/**
+ * @brief Streaming housekeeping statistics of one device.
+ *
+ */
+typedef struct
+{
+    pthread_mutex_t m;
+    uint32_t bucket; // current bucket, CLOCK_MONOTONIC / EPS_AGG_BUCKET_S
+    uint64_t t_start; // first sample, 0 before it
+    eps_agg_chan_t ch[EPS_AGG_CH_MAX];
+    eps_agg_integ_t e_in, e_out; // J
+    eps_agg_integ_t q_rail[6];   // C
+} eps_agg_t;
+
+/**
+ * @brief Prepares the statistics of a device.
+ *
+ * @param agg Statistics to reset.
+ */
+void eps_agg_init(eps_agg_t *agg);
+
+/**
+ * @brief Adds a housekeeping sample to the statistics. Called with the
+ * device's hk_cache_m held.
+ *
+ * @param agg Statistics of the device.
+ * @param hk Housekeeping, may be NULL.
+ * @param hk_out Output housekeeping, may be NULL.
+ * @param t_mono_ns CLOCK_MONOTONIC time of the sample.
+ */
+void eps_agg_update(eps_agg_t *agg, const hkparam_t *hk, const eps_hk_out_t *hk_out, uint64_t t_mono_ns);
+
+/**
+ * @brief Reads the statistics of one channel over the window ending now.
+ *
+ * @return int 1 on success, 0 if the channel has no sample yet.
+ */
+int eps_agg_read(eps_agg_t *agg, eps_agg_ch ch, eps_agg_stat_t *st);
+
+/**
+ * @brief Reads the energy and charge integrals over the window ending now.
+ *
+ */
+void eps_agg_read_energy(eps_agg_t *agg, eps_agg_energy_t *en);
+
+/**
+ * @brief Position of a device in the device table.
+ *
+ * @param dev Device handle.
+ * @return int Index, -1 for NULL.
+ */
+int eps_dev_index(const eps_dev_t *dev);
+
+/**
+ * @brief I2C bus and address of a device.
+ *
+ * @param dev Device handle.
+ * @param bus_id Receives the bus number.
+ * @param addr Receives the address.
+ * @return int 1 on success, -ENODEV for NULL.
+ */
+int eps_dev_addr(const eps_dev_t *dev, int *bus_id, int *addr);
+
+/**
+ * @brief Checks a configuration before it is written.
+ *
+ * @param conf Configuration to check.
+ * @return int 1 if the P31u accepts it, 0 if it would be misinterpreted.
+ */
+int eps_conf_check(const eps_config_t *conf);
+
+/**
+ * @brief Copies the configuration shadow of a device without touching the bus.
+ *
+ * @param dev Device, not NULL.
+ * @param conf Receives the configuration if it is known.
+ * @return int 1 if the shadow matches the device, 0 if unknown.
+ */
+int eps_conf_shadow_get(eps_dev_t *dev, eps_config_t *conf);
+
+/**
+ * @brief Records one completed EPS command in the calling thread's statistics.
+ *
+ * @param op Operation executed.
+ * @param ret Return value of the command, negative counts as an error.
+ * @param ns Latency seen by the caller in nanoseconds.
+ */
+void eps_stats_record(eps_op op, int ret, uint64_t ns);
+
+/**
+ * @brief Records one EPS call answered without the bus, such as a
+ * configuration read served from the shadow or a redundant write skipped.
+ * It counts as a call and, in eps_stats_t.local, as one served locally.
+ *
+ * @param op Operation asked for.
+ * @param ret Return value given to the caller.
+ * @param ns Latency seen by the caller in nanoseconds.
+ */
+void eps_stats_record_local(eps_op op, int ret, uint64_t ns);
+
+/**
+ * @brief Opens (creating and preallocating if needed) the housekeeping log.
+ *
+ * @param log Log to open.
+ * @param fname Log file name.
+ * @param capacity Number of records in the ring.
+ * @param boot_count Boot count stored with every record.
+ * @return int 1 on success, -1 on failure.
+ */
+int eps_log_open(eps_log_t *log, const char *fname, uint32_t capacity, int boot_count);
+
+/**
+ * @brief Appends one sample to the housekeeping log, overwriting the oldest
+ * record once the ring is full. Not thread safe; called with the device's
+ * hk_cache_m held.
+ *
+ * @param log Open log, nothing is recorded if it is not open.
+ * @param hk Housekeeping, may be NULL.
+ * @param hk_out Output housekeeping, may be NULL.
+ * @param t_mono_ns CLOCK_MONOTONIC time of the sample.
+ */
+void eps_log_append(eps_log_t *log, const hkparam_t *hk, const eps_hk_out_t *hk_out, uint64_t t_mono_ns);
+
+/**
+ * @brief Flushes and closes the housekeeping log.
+ *
+ * @param log Log to close, may be closed already.
+ */
+void eps_log_close(eps_log_t *log);
+
+/**
+ * @brief Creates the shared-memory segment of a device, or takes over one
+ * left behind by a publisher that is no longer running.
+ *
+ * @param pub Publisher to open.
+ * @param dev_name Device name, appended to EPS_SHM_PREFIX.
+ * @param boot_count Boot count stored in the segment header.
+ * @return int 1 on success, -EADDRINUSE if a live process publishes into the
+ * segment, -1 on other failures.
+ */
+int eps_shm_pub_open(eps_shm_pub_t *pub, const char *dev_name, int boot_count);
+
+/**
+ * @brief Publishes a housekeeping sample.
+ *
+ * @param pub Publisher, nothing is published if it is not open.
+ * @param hk Housekeeping, may be NULL.
+ * @param hk_out Output housekeeping, may be NULL.
+ * @param t_mono_ns CLOCK_MONOTONIC time of the sample.
+ */
+void eps_shm_pub_hk(eps_shm_pub_t *pub, const hkparam_t *hk, const eps_hk_out_t *hk_out, uint64_t t_mono_ns);
+
+/**
+ * @brief Publishes the configuration, or withdraws it when it is no longer
+ * known.
+ *
+ * @param pub Publisher, nothing is published if it is not open.
+ * @param conf Configuration, NULL to mark it invalid.
+ * @param t_mono_ns CLOCK_MONOTONIC time of the change.
+ */
+void eps_shm_pub_conf(eps_shm_pub_t *pub, const eps_config_t *conf, uint64_t t_mono_ns);
+
+/**
+ * @brief Unmaps and unlinks the segment.
+ *
+ * @param pub Publisher to close, may be closed already.
+ */
+void eps_shm_pub_close(eps_shm_pub_t *pub);
+
+/**
+ * @brief Compares a newly published sample with the previous one and wakes
+ * the subscribers whose thresholds it crosses.
+ *
+ * @param dev Index of the device the sample is from.
+ * @param hk New hkparam_t, NULL if not part of this sample.
+ * @param hk_out New eps_hk_out_t, NULL if not part of this sample.
+ */
+void eps_sub_notify(int dev, const hkparam_t *hk, const eps_hk_out_t *hk_out);
 
 #endif // EPS_H
\ No newline at end of file
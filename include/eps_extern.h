@@ -14,12 +14,208 @@
 
 #include <pthread.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include "eps_p31u/p31u.h"
 
-#ifndef EPS_H
-extern __thread pthread_cond_t eps_cmd_wait[1];
-extern __thread pthread_mutex_t eps_cmd_wait_m[1];
-#endif
+/**
+ * @brief Operations understood by the EPS command queue.
+ *
+ */
+typedef enum
+{
+    EPS_OP_PING,
+    EPS_OP_REBOOT,
+    EPS_OP_GET_HK,
+    EPS_OP_GET_HK_OUT,
+    EPS_OP_TGL_LUP,
+    EPS_OP_LUP_SET,
+    EPS_OP_GET_CONF,
+    EPS_OP_SET_CONF,
+    EPS_OP_HARDRESET,
+    EPS_OP_RESET_WDT,
+    EPS_OP_LUP_MASK,
+    EPS_OP_GET_HK_RAW,
+    EPS_OP_POLL,
+    EPS_OP_MAX
+} eps_op;
+
+/**
+ * @brief Housekeeping field sets. Each maps onto one P31u housekeeping
+ * sub-command, so that a reader pays only for the fields it asks for.
+ *
+ */
+#define EPS_HK_LEGACY 0x01 // hkparam_t, 45 bytes on the bus
+#define EPS_HK_OUT 0x02    // eps_hk_out_t, 66 bytes
+#define EPS_HK_VI 0x04     // eps_vi_t, 22 bytes
+#define EPS_HK_WDT 0x08    // eps_wdt_t, 28 bytes
+#define EPS_HK_BASIC 0x10  // eps_basic_t, 23 bytes
+#define EPS_HK_ALL 0x1f
+
+/**
+ * @brief Voltages and input currents (EPS_HK_VI).
+ *
+ */
+typedef struct __attribute__((packed))
+{
+    uint16_t vboost[3]; // mV
+    uint16_t vbatt;     // mV
+    uint16_t curin[3];  // mA
+    uint16_t cursun;    // mA, total from the boost converters
+    uint16_t cursys;    // mA, drawn from the battery
+    uint16_t reserved;
+} eps_vi_t;
+
+/**
+ * @brief Watchdog timers and counters (EPS_HK_WDT).
+ *
+ */
+typedef struct __attribute__((packed))
+{
+    uint32_t i2c_time_left; // s
+    uint32_t gnd_time_left; // s
+    uint8_t csp_pings_left[2];
+    uint32_t i2c_count;
+    uint32_t gnd_count;
+    uint32_t csp_count[2];
+} eps_wdt_t;
+
+/**
+ * @brief Boot counter, temperatures and modes (EPS_HK_BASIC).
+ *
+ */
+typedef struct __attribute__((packed))
+{
+    uint32_t bootcount;
+    int16_t temp[6]; // C; converters 1 -- 3, board, battery pack 1 -- 2
+    uint8_t bootcause;
+    uint8_t battmode;
+    uint8_t ppt_mode;
+    uint16_t reserved;
+} eps_basic_t;
+
+/**
+ * @brief Composite housekeeping view. Every field set carries the
+ * CLOCK_MONOTONIC time in ns it was read at, 0 if it is not present.
+ *
+ */
+typedef struct
+{
+    uint64_t t_hk, t_out, t_vi, t_wdt, t_basic;
+    hkparam_t hk;
+    eps_hk_out_t hk_out;
+    eps_vi_t vi;
+    eps_wdt_t wdt;
+    eps_basic_t basic;
+} eps_hk_view_t;
+
+/**
+ * @brief A command for the EPS worker thread.
+ *
+ * arg[0] carries the latchup index and arg[1] the power state where the
+ * operation needs them, the on and off masks for EPS_OP_LUP_MASK, or the
+ * EPS_HK_* field sets for EPS_OP_POLL. data points to the
+ * hkparam_t, eps_hk_out_t, eps_hk_view_t or eps_config_t the operation reads
+ * or fills, and must stay valid until the
+ * command has completed.
+ *
+ */
+typedef struct
+{
+    eps_op op;
+    int arg[2];
+    void *data;
+} eps_cmd_t;
+
+/**
+ * @brief Handle on one EPS of the device table.
+ *
+ * The table is read by eps_init() from the EPS_DEVICES environment variable,
+ * "name@bus:addr[,name@bus:addr...]" (e.g. "eps0@1:0x1b,eps1@2:0x1b"), and
+ * holds a single device named "eps" on bus 1, address 0x1b when it is not
+ * set. Every function below without a device argument acts on the first
+ * device; its eps_dev_* counterpart acts on the given one.
+ *
+ */
+typedef struct eps_dev eps_dev_t;
+
+/**
+ * @brief Priority classes of the EPS command queue, most urgent first.
+ *
+ * EPS_PRIO_CRITICAL holds commands that shed power: latchups switched off
+ * (EPS_OP_LUP_SET with power 0, EPS_OP_LUP_MASK with an empty on mask) and
+ * hard resets. EPS_PRIO_CONTROL holds the other commands that change state,
+ * and watchdog kicks. EPS_PRIO_BULK holds reads and pings.
+ *
+ */
+typedef enum
+{
+    EPS_PRIO_CRITICAL,
+    EPS_PRIO_CONTROL,
+    EPS_PRIO_BULK,
+    EPS_PRIO_MAX
+} eps_prio;
+
+/**
+ * @brief Queues a command for the EPS worker thread and waits for it.
+ *
+ * Commands for devices on one bus are executed one at a time, most urgent
+ * class (see eps_prio) first and in submission order within a class; devices
+ * on different buses are served by separate workers. A command of a lower
+ * class that is being retried steps aside between attempts when a more
+ * urgent one is queued, so a critical command waits for at most one bus
+ * transaction.
+ * Every operation has a deadline of at most EPS_CMD_TIMEOUT seconds from
+ * submission: a command still queued at its deadline fails without reaching
+ * the bus, and a failed one is retried only while its deadline allows. A
+ * command that is already on the bus is always waited for.
+ *
+ * @param cmd Command to execute.
+ * @return int Value for i2c read / write, -EAGAIN if the queue is full,
+ * -ETIMEDOUT if the command was dropped or missed its deadline, -ECANCELED
+ * if the worker has exited.
+ */
+int eps_cmd_exec(const eps_cmd_t *cmd);
+
+/**
+ * @brief Queues a command for the EPS worker thread without waiting.
+ *
+ * @param cmd Command to execute.
+ * @return int Non-negative ticket for eps_cmd_poll() / eps_cmd_cancel(),
+ * -EAGAIN if the queue is full, -ECANCELED if the worker has exited.
+ */
+int eps_cmd_submit(const eps_cmd_t *cmd);
+
+/**
+ * @brief Checks whether a submitted command has completed. A completed ticket
+ * is released and can not be polled again.
+ *
+ * @param ticket Ticket returned by eps_cmd_submit().
+ * @param ret Pointer to store the value for i2c read / write, may be NULL.
+ * @return int 1 if completed, 0 if still pending, -EINVAL for an unknown ticket.
+ */
+int eps_cmd_poll(int ticket, int *ret);
+
+/**
+ * @brief Gives up on a submitted command. A command already on the bus still
+ * runs to completion, so its data must stay valid until then.
+ *
+ * @param ticket Ticket returned by eps_cmd_submit().
+ * @return int 0 on success, -EINVAL for an unknown ticket.
+ */
+int eps_cmd_cancel(int ticket);
+
+/**
+ * @brief Queues a command like eps_dev_cmd_submit() and adds 1 to the
+ * eventfd efd once it has completed, so that an event loop can wait for
+ * completions instead of polling every ticket.
+ *
+ * @param dev Device to send the command to.
+ * @param cmd Command to execute.
+ * @param efd eventfd to post, -1 for none. Must stay open until the command
+ * has completed.
+ * @return int As eps_cmd_submit(), -ENODEV for a NULL device.
+ */
+int eps_dev_cmd_submit_fd(eps_dev_t *dev, const eps_cmd_t *cmd, int efd);
 
 /**
   * @brief Pings the EPS.
@@ -52,6 +248,153 @@ int eps_get_hk(hkparam_t *hk);
   */
 int eps_get_hk_out(eps_hk_out_t *hk_out);
 
+/**
+ * @brief Offset of the housekeeping payload in eps_hk_raw_t.data.
+ *
+ */
+#define EPS_HK_RAW_OFS 8
+
+/**
+ * @brief Buffer the raw P31u housekeeping reply is read into. The reply header
+ * is placed just before EPS_HK_RAW_OFS so that the payload starts 8-byte
+ * aligned and can be used in place through eps_hk_raw_hk() or
+ * eps_hk_raw_out().
+ *
+ */
+typedef struct
+{
+    _Alignas(8) uint8_t data[EPS_HK_RAW_OFS + sizeof(eps_hk_out_t)];
+} eps_hk_raw_t;
+
+/**
+ * @brief Gets basic housekeeping data without copying or per-field decoding.
+ *
+ * The reply is read straight into raw and converted to host byte order in
+ * place, a word at a time. Read the result through eps_hk_raw_hk().
+ *
+ * @param raw Buffer for the reply.
+ * @return int Value for i2c read / write, -EIO if the EPS reported an error.
+ */
+int eps_get_hk_raw(eps_hk_raw_t *raw);
+
+/**
+ * @brief Gets output housekeeping data without copying or per-field decoding.
+ * Read the result through eps_hk_raw_out().
+ *
+ * @param raw Buffer for the reply.
+ * @return int Value for i2c read / write, -EIO if the EPS reported an error.
+ */
+int eps_get_hk_out_raw(eps_hk_raw_t *raw);
+
+/**
+ * @brief Housekeeping filled in by eps_get_hk_raw().
+ *
+ */
+static inline const hkparam_t *eps_hk_raw_hk(const eps_hk_raw_t *raw)
+{
+    return (const hkparam_t *)(raw->data + EPS_HK_RAW_OFS);
+}
+
+/**
+ * @brief Output housekeeping filled in by eps_get_hk_out_raw().
+ *
+ */
+static inline const eps_hk_out_t *eps_hk_raw_out(const eps_hk_raw_t *raw)
+{
+    return (const eps_hk_out_t *)(raw->data + EPS_HK_RAW_OFS);
+}
+
+/**
+ * @brief Gets the latest housekeeping sample published by the poller.
+ *
+ * The sample is copied out of a sequence-locked cache without touching the
+ * bus, unless no sample exists yet or it is older than max_age_ms, in which
+ * case it is refreshed first.
+ *
+ * @param hk Pointer to hkparam_t object for output, may be NULL.
+ * @param hk_out Pointer to eps_hk_out_t object for output, may be NULL.
+ * @param tstamp Pointer to CLOCK_MONOTONIC time of the sample in ns, may be NULL.
+ * @param max_age_ms Maximum acceptable age of the sample in ms, 0 for any age.
+ * @return int 1 on success, value for i2c read / write if a refresh failed.
+ */
+int eps_hk_snapshot(hkparam_t *hk, eps_hk_out_t *hk_out, uint64_t *tstamp, unsigned int max_age_ms);
+
+/**
+ * @brief Gets housekeeping field sets from the composite cache.
+ *
+ * The requested sets are copied out of the cache the poller publishes to.
+ * Sets never read or older than max_age_ms are read first, only those, with
+ * their sub-commands batched into one bus transaction where the adapter
+ * allows it. Sets not requested are left untouched in view.
+ *
+ * @param fields EPS_HK_* sets of interest.
+ * @param view Receives the sets and their timestamps.
+ * @param max_age_ms Maximum acceptable age of each set in ms, 0 for any age.
+ * @return int 1 on success, -EINVAL for an empty or unknown set or a NULL
+ * view, value for i2c read / write if a read failed.
+ */
+int eps_hk_get_fields(uint32_t fields, eps_hk_view_t *view, unsigned int max_age_ms);
+
+/**
+ * @brief Housekeeping events a subscriber can wait for.
+ *
+ */
+#define EPS_EV_BV 0x01      // battery voltage moved more than bv_delta since the last EPS_EV_BV
+#define EPS_EV_SC 0x02      // system current moved more than sc_delta since the last EPS_EV_SC
+#define EPS_EV_LATCHUP 0x04 // a latchup counter changed
+#define EPS_EV_TEMP 0x08    // a temperature crossed temp_low or temp_high
+#define EPS_EV_CHANNEL 0x10 // channel status or an output changed
+
+/**
+ * @brief Thresholds of a housekeeping subscription.
+ *
+ */
+typedef struct
+{
+    uint32_t events;   // EPS_EV_* of interest
+    uint16_t bv_delta; // mV
+    uint16_t sc_delta; // mA
+    int16_t temp_low;  // C
+    int16_t temp_high; // C
+} eps_hk_sub_cfg_t;
+
+/**
+ * @brief Subscribes to housekeeping changes.
+ *
+ * When a published sample crosses one of the thresholds, the event is added
+ * to the subscription's pending mask and cond is broadcast with m held. The
+ * subscriber waits on cond under m and collects events with
+ * eps_hk_sub_take(); the condition should also be listed in wakeups[] so that
+ * SIGINT releases it. A publication already under way may still broadcast
+ * cond once after eps_hk_unsubscribe() returns, so cond and m must stay
+ * valid a while longer (they normally live as long as the thread). Do not
+ * hold m while calling a housekeeping getter that may poll the bus
+ * (eps_hk_snapshot(), eps_hk_get_fields() and their eps_dev_ variants): the
+ * publication of the polled sample takes m to broadcast cond.
+ *
+ * @param cfg Events and thresholds.
+ * @param cond Condition to broadcast.
+ * @param m Mutex associated with cond.
+ * @return int Subscription ID on success, -EINVAL or -ENOSPC on failure.
+ */
+int eps_hk_subscribe(const eps_hk_sub_cfg_t *cfg, pthread_cond_t *cond, pthread_mutex_t *m);
+
+/**
+ * @brief Takes and clears the pending events of a subscription.
+ *
+ * @param id Subscription ID.
+ * @return uint32_t EPS_EV_* mask, 0 if nothing happened.
+ */
+uint32_t eps_hk_sub_take(int id);
+
+/**
+ * @brief Cancels a subscription.
+ *
+ * @param id Subscription ID.
+ * @return int 1 on success, -EINVAL for an unknown ID.
+ */
+int eps_hk_unsubscribe(int id);
+
 /**
   * @brief Toggle EPS latch up.
   *
@@ -69,22 +412,293 @@ int eps_tgl_lup(eps_lup_idx lup);
   */
 int eps_lup_set(eps_lup_idx lup, int pw);
 
+/**
+ * @brief Switches several EPS outputs at once with a single set-output
+ * transaction.
+ *
+ * Bit i of each mask selects output i (eps_lup_idx for the six rails, 6 and 7
+ * for the quadbat switch and heater). Outputs in neither mask keep their
+ * state in the cached eps_hk_out_t; the device is only read first when the
+ * cache is older than EPS_LUP_MASK_MAX_AGE_MS or than the last output switch.
+ * When the masks together name all eight outputs, e.g. an all-off cut, the
+ * set-output command is sent alone, without any read.
+ *
+ * @param on_mask Outputs to switch on.
+ * @param off_mask Outputs to switch off.
+ * @return int Output mask the device reports afterwards (eps_hk_out_t.output
+ * as bits), or the mask sent when the masks name all outputs, on success;
+ * -EINVAL if the masks overlap, value for i2c read / write on failure.
+ */
+int eps_lup_set_mask(uint8_t on_mask, uint8_t off_mask);
+
 /**
  * @brief Gets the EPS configuration.
  * 
+ * Served from a shadow copy without a bus transaction once the configuration
+ * has been read or written successfully.
+ *
  * @param conf Pointer to eps_config_t object for output.
- * @return int 
+ * @return int 1 on a shadow hit, value for i2c read / write otherwise.
  */
 int eps_get_conf(eps_config_t *conf);
 
 /**
  * @brief Sets the EPS configuration.
  * 
+ * The write is skipped when the configuration equals the shadow copy.
+ *
  * @param conf Pointer to eps_config_t object for input.
- * @return int 
+ * @return int 1 if nothing had to be written, -EINVAL for an invalid
+ * configuration, value for i2c read / write otherwise.
  */
 int eps_set_conf(eps_config_t *conf);
 
+/**
+ * @brief Discards the shadow copy of the EPS configuration, so that the next
+ * eps_get_conf() reads the device. Reboots and hard resets issued through
+ * this module do this automatically.
+ *
+ */
+void eps_conf_invalidate();
+
+/**
+ * @brief Call, error and latency statistics of one EPS command, as seen by
+ * its callers (queueing included).
+ *
+ */
+typedef struct
+{
+    uint64_t calls;
+    uint64_t errors;
+    uint64_t local; // calls answered without the bus, included in calls
+    uint64_t mean_ns;
+    uint64_t p50_ns;
+    uint64_t p99_ns;
+    uint64_t p999_ns;
+    uint64_t max_ns;
+} eps_stats_t;
+
+/**
+ * @brief Gets the statistics of one EPS command, merged over all threads.
+ *
+ * @param op Operation of interest.
+ * @param st Pointer to eps_stats_t object for output.
+ * @return int 1 on success, -1 on failure.
+ */
+int eps_stats_get(eps_op op, eps_stats_t *st);
+
+/**
+ * @brief Prints the statistics of every EPS command that has been issued.
+ *
+ * @param fname File to append the table to, NULL for stdout.
+ * @return int 1 on success, -1 if the file could not be opened.
+ */
+int eps_stats_dump(const char *fname);
+
+/**
+ * @brief Gets a printable name of an EPS operation.
+ *
+ * @param op Operation.
+ * @return const char* Name of the operation.
+ */
+const char *eps_op_name(eps_op op);
+
+/**
+ * @brief Outcomes of the commands executed for one device by the command
+ * worker.
+ *
+ * Commands that fail on the bus are retried with exponential backoff, as
+ * often as their operation allows and as long as their deadline permits.
+ * Toggles, reboots and hard resets are never retried, since a lost reply may
+ * hide a completed command. After EPS_BUS_RESET_AFTER consecutive failed
+ * commands, the worker reopens the bus handles of every device on the bus.
+ *
+ */
+typedef struct
+{
+    uint64_t ok;         // succeeded on the first attempt
+    uint64_t ok_retried; // succeeded after one or more retries
+    uint64_t failed;     // failed on every attempt the policy allowed
+    uint64_t rejected;   // invalid command, not retried
+    uint64_t expired;    // deadline passed before the command reached the bus
+    uint64_t retries;    // attempts beyond the first
+    uint64_t bus_resets; // bus handles reopened
+} eps_retry_stats_t;
+
+/**
+ * @brief Gets the command outcome counters.
+ *
+ * @param st Pointer to eps_retry_stats_t object for output.
+ * @return int 1 on success, -EINVAL for a NULL st.
+ */
+int eps_retry_stats_get(eps_retry_stats_t *st);
+
+/**
+ * @brief Dispatch latency of one priority class of a bus queue: the time
+ * from submission until the worker puts the command on the bus.
+ *
+ */
+typedef struct
+{
+    uint64_t dispatched; // commands put on the bus
+    uint64_t preempted;  // retries deferred for a more urgent command
+    uint64_t mean_ns;
+    uint64_t max_ns;     // worst case since eps_init()
+} eps_dispatch_stats_t;
+
+/**
+ * @brief Gets the dispatch latency of one priority class on the bus of the
+ * first device.
+ *
+ * @param prio Class of interest.
+ * @param st Pointer to eps_dispatch_stats_t object for output.
+ * @return int 1 on success, -EINVAL for an invalid class or a NULL st.
+ */
+int eps_dispatch_stats_get(eps_prio prio, eps_dispatch_stats_t *st);
+
+/**
+ * @brief Gets the priority class a command is queued in.
+ *
+ * @param cmd Command.
+ * @return eps_prio Class of the command.
+ */
+eps_prio eps_cmd_prio(const eps_cmd_t *cmd);
+
+/**
+ * @brief Gets a printable name of a priority class.
+ *
+ * @param prio Class.
+ * @return const char* Name of the class.
+ */
+const char *eps_prio_name(eps_prio prio);
+
+#define EPS_WDT_HIST_BINS 32 // log2 bins of the watchdog histograms
+
+/**
+ * @brief Timing of the ground watchdog kicks of one device.
+ *
+ * Kicks are sent by eps_wdt_thread() every EPS_WDT_PERIOD_MS on absolute
+ * deadlines. The interval between two successful kicks is compared with the
+ * period (jitter) and with EPS_WDT_TIMEOUT_S (margin left when the kick
+ * landed). Bin 0 of jitter_hist counts jitter below 1 us and bin i > 0
+ * jitter in [2^(i-1), 2^i) us; margin_hist does the same in ms. The last bin
+ * of each also takes everything larger.
+ *
+ */
+typedef struct
+{
+    uint64_t kicks;         // successful kicks
+    uint64_t failures;      // kicks that failed every attempt
+    uint64_t missed;        // periods skipped because the kicker ran late
+    uint64_t wake_max_ns;   // latest wakeup after a deadline
+    uint64_t jitter_max_ns; // largest deviation of an interval from the period
+    uint64_t margin_min_ns; // smallest margin to the timeout, 0 before the second kick
+    uint64_t jitter_hist[EPS_WDT_HIST_BINS];
+    uint64_t margin_hist[EPS_WDT_HIST_BINS];
+    int rt;                 // kicker runs SCHED_FIFO with its memory locked
+} eps_wdt_stats_t;
+
+/**
+ * @brief Gets the watchdog kick timing of the first device.
+ *
+ * @param st Pointer to eps_wdt_stats_t object for output.
+ * @return int 1 on success, -EINVAL for a NULL st.
+ */
+int eps_wdt_stats_get(eps_wdt_stats_t *st);
+
+/**
+ * @brief Housekeeping channels with streaming statistics. P_IN is the mean
+ * of pv[] times pc and P_OUT is bv times sc, both in mW; the others are in
+ * the units of their hkparam_t or eps_hk_out_t field.
+ *
+ */
+typedef enum
+{
+    EPS_AGG_PV0,
+    EPS_AGG_PV1,
+    EPS_AGG_PV2,
+    EPS_AGG_PC,
+    EPS_AGG_BV,
+    EPS_AGG_SC,
+    EPS_AGG_TEMP0,
+    EPS_AGG_TEMP1,
+    EPS_AGG_TEMP2,
+    EPS_AGG_TEMP3,
+    EPS_AGG_BATT_TEMP0,
+    EPS_AGG_BATT_TEMP1,
+    EPS_AGG_CUROUT0,
+    EPS_AGG_CUROUT1,
+    EPS_AGG_CUROUT2,
+    EPS_AGG_CUROUT3,
+    EPS_AGG_CUROUT4,
+    EPS_AGG_CUROUT5,
+    EPS_AGG_P_IN,
+    EPS_AGG_P_OUT,
+    EPS_AGG_CH_MAX
+} eps_agg_ch;
+
+/**
+ * @brief Statistics of one housekeeping channel.
+ *
+ * Every polled sample updates them in constant time. min, max and mean cover
+ * the last EPS_AGG_WINDOW_S seconds (one orbit), to a resolution of
+ * EPS_AGG_BUCKET_S seconds; ewma is a moving average with a time constant of
+ * EPS_AGG_EWMA_TAU_S seconds.
+ *
+ */
+typedef struct
+{
+    uint64_t samples; // since eps_init()
+    uint64_t t_last;  // CLOCK_MONOTONIC ns of the last sample
+    int32_t last;
+    int32_t min;
+    int32_t max;
+    double mean;
+    double ewma;
+} eps_agg_stat_t;
+
+/**
+ * @brief Energy and charge integrated from the housekeeping samples.
+ * Intervals between samples longer than EPS_AGG_GAP_S seconds are left out.
+ *
+ */
+typedef struct
+{
+    uint64_t window_ns;        // time covered by the window values, up to EPS_AGG_WINDOW_S
+    double e_in_j;             // solar energy in over the window, J
+    double e_out_j;            // battery energy out over the window, J
+    double q_rail_c[6];        // charge drawn from each output over the window, C
+    double e_in_total_j;       // solar energy in since eps_init(), J
+    double e_out_total_j;      // battery energy out since eps_init(), J
+    double q_rail_total_c[6];  // charge drawn from each output since eps_init(), C
+} eps_agg_energy_t;
+
+/**
+ * @brief Gets the streaming statistics of one housekeeping channel.
+ *
+ * @param ch Channel of interest.
+ * @param st Pointer to eps_agg_stat_t object for output.
+ * @return int 1 on success, 0 if no sample has been polled yet, -EINVAL for
+ * an invalid channel or a NULL st.
+ */
+int eps_agg_get(eps_agg_ch ch, eps_agg_stat_t *st);
+
+/**
+ * @brief Gets the integrated energy in and out and the charge of each output.
+ *
+ * @param en Pointer to eps_agg_energy_t object for output.
+ * @return int 1 on success, -EINVAL for a NULL en.
+ */
+int eps_agg_energy_get(eps_agg_energy_t *en);
+
+/**
+ * @brief Gets a printable name of a statistics channel.
+ *
+ * @param ch Channel.
+ * @return const char* Name of the channel.
+ */
+const char *eps_agg_ch_name(eps_agg_ch ch);
+
 /**
   * @brief Power cycles all power lines including battery rails.
   *
@@ -92,4 +706,63 @@ int eps_set_conf(eps_config_t *conf);
   */
 int eps_hardreset();
 
+/**
+ * @brief Gets the number of devices in the device table.
+ *
+ * @return int Number of devices, 0 before eps_init().
+ */
+int eps_dev_count();
+
+/**
+ * @brief Gets a device by its position in the device table.
+ *
+ * @param idx Index, 0 for the default device.
+ * @return eps_dev_t* Device handle, NULL if idx is out of range.
+ */
+eps_dev_t *eps_dev_at(int idx);
+
+/**
+ * @brief Gets a device by name.
+ *
+ * @param name Name given in the device table.
+ * @return eps_dev_t* Device handle, NULL if there is no such device.
+ */
+eps_dev_t *eps_dev_find(const char *name);
+
+/**
+ * @brief Gets the name of a device.
+ *
+ * @param dev Device handle.
+ * @return const char* Name, NULL for a NULL handle.
+ */
+const char *eps_dev_name(const eps_dev_t *dev);
+
+/*
+ * Per-device variants of the functions above. They behave like their
+ * counterparts and additionally return -ENODEV for a NULL device.
+ */
+int eps_dev_cmd_exec(eps_dev_t *dev, const eps_cmd_t *cmd);
+int eps_dev_cmd_submit(eps_dev_t *dev, const eps_cmd_t *cmd);
+int eps_dev_ping(eps_dev_t *dev);
+int eps_dev_reboot(eps_dev_t *dev);
+int eps_dev_get_hk(eps_dev_t *dev, hkparam_t *hk);
+int eps_dev_get_hk_out(eps_dev_t *dev, eps_hk_out_t *hk_out);
+int eps_dev_get_hk_raw(eps_dev_t *dev, eps_hk_raw_t *raw);
+int eps_dev_get_hk_out_raw(eps_dev_t *dev, eps_hk_raw_t *raw);
+int eps_dev_hk_snapshot(eps_dev_t *dev, hkparam_t *hk, eps_hk_out_t *hk_out, uint64_t *tstamp, unsigned int max_age_ms);
+int eps_dev_hk_get_fields(eps_dev_t *dev, uint32_t fields, eps_hk_view_t *view, unsigned int max_age_ms);
+int eps_dev_hk_subscribe(eps_dev_t *dev, const eps_hk_sub_cfg_t *cfg, pthread_cond_t *cond, pthread_mutex_t *m);
+int eps_dev_tgl_lup(eps_dev_t *dev, eps_lup_idx lup);
+int eps_dev_lup_set(eps_dev_t *dev, eps_lup_idx lup, int pw);
+int eps_dev_lup_set_mask(eps_dev_t *dev, uint8_t on_mask, uint8_t off_mask);
+int eps_dev_get_conf(eps_dev_t *dev, eps_config_t *conf);
+int eps_dev_set_conf(eps_dev_t *dev, eps_config_t *conf);
+void eps_dev_conf_invalidate(eps_dev_t *dev);
+int eps_dev_hardreset(eps_dev_t *dev);
+int eps_dev_retry_stats_get(eps_dev_t *dev, eps_retry_stats_t *st);
+int eps_dev_dispatch_stats_get(eps_dev_t *dev, eps_prio prio, eps_dispatch_stats_t *st);
+int eps_dev_wdt_stats_get(eps_dev_t *dev, eps_wdt_stats_t *st);
+int eps_dev_agg_get(eps_dev_t *dev, eps_agg_ch ch, eps_agg_stat_t *st);
+int eps_dev_agg_energy_get(eps_dev_t *dev, eps_agg_energy_t *en);
+
 #endif // EPS_EXTERN_H
\ No newline at end of file
@@ -0,0 +1,97 @@
+/**
+ * @file eps_i2c.h
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Batches of P31u command/reply exchanges sent in one I2C transaction.
+ *
+ * A batch holds the bus lock throughout and runs as a chain of
+ * ioctl(I2C_RDWR) calls: the reply of one exchange and the command of the
+ * next are joined by a repeated start, and the calls are EPS_XFER_DELAY
+ * apart, so the P31u gets the same time between a command and its reply as
+ * with i2cbus_xfer(). A batch of n exchanges thus takes n + 1 syscalls
+ * instead of 2n, and no other transaction can get between its exchanges.
+ * Where the i2cbus backend can not do this (the simulator, replay, adapters
+ * without I2C_FUNC_I2C), or while a trace is being captured, the exchanges
+ * run one after another through i2cbus_xfer().
+ *
+ * A batch that fails is redone one exchange at a time, since the adapter does
+ * not report which message was NACKed; an exchange whose reply carries an
+ * error or the wrong command byte is redone once on its own. Batches must
+ * therefore only hold exchanges that can safely be repeated, such as
+ * housekeeping reads and watchdog kicks.
+ *
+ * @version 0.1
+ * @date 2021-04-15
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#ifndef EPS_I2C_H
+#define EPS_I2C_H
+
+#include "i2cbus/i2cbus.h"
+#include <stdint.h>
+
+#define EPS_I2C_BATCH_MAX 8 // exchanges in one batch
+
+/**
+ * @brief One command/reply exchange of a batch.
+ *
+ */
+typedef struct
+{
+    const uint8_t *wbuf; // command byte and arguments
+    uint16_t wlen;
+    uint8_t *rbuf; // reply, NULL if none is read
+    uint16_t rlen;
+    int ret; // set by eps_i2c_batch(): bytes read (written if no reply), or -1
+} eps_i2c_op_t;
+
+/**
+ * @brief Whether the linked i2cbus backend drives a Linux i2c-dev adapter
+ * whose handles take ioctl(I2C_RDWR). The i2cbus handle belongs to the driver
+ * submodule and has no field for it, so each backend states it once:
+ * eps_i2c.c defines it weakly as 1 for the driver, the simulator and replay
+ * backends define it as 0.
+ *
+ */
+extern int eps_i2c_backend_rdwr;
+
+/**
+ * @brief Takes the lock of a bus shared by the threads of this process.
+ *
+ * The command worker holds it around each command and the watchdog kicker
+ * around each kick. Unlike the lock of an i2cbus handle it has priority
+ * inheritance, so a real-time kicker waiting for it raises the worker
+ * holding it to its own priority.
+ *
+ * @param bus_id I2C bus number.
+ * @return int 1 on success, -ENOSPC if more than EPS_BUS_MAX buses are used.
+ */
+int eps_i2c_bus_lock(int bus_id);
+
+/**
+ * @brief Releases the lock taken by eps_i2c_bus_lock().
+ *
+ */
+void eps_i2c_bus_unlock(int bus_id);
+
+/**
+ * @brief Executes a batch of exchanges with one device.
+ *
+ * @param bus Open bus handle of the device.
+ * @param ops Exchanges, in order.
+ * @param n Number of exchanges, at most EPS_I2C_BATCH_MAX.
+ * @return int 1 if every exchange completed with a valid reply, -1 with errno
+ * set if any failed (EIO for a reply the EPS flagged); ops[i].ret tells which.
+ */
+int eps_i2c_batch(i2cbus *bus, eps_i2c_op_t *ops, int n);
+
+/**
+ * @brief Executes a batch as separate i2cbus_xfer() calls.
+ *
+ * @return int As for eps_i2c_batch().
+ */
+int eps_i2c_batch_seq(i2cbus *bus, eps_i2c_op_t *ops, int n);
+
+#endif // EPS_I2C_H
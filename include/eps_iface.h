@@ -24,12 +24,36 @@
 int eps_init();
 
 /**
- * @brief EPS thread.
+ * @brief Registers the housekeeping and watchdog timers of every bus with
+ * the reactor.
+ *
+ * @return int 1 on success, -1 on error.
+ */
+int eps_register();
+
+/**
+ * @brief EPS command worker thread. Owns the bus and executes commands queued
+ * by eps_cmd_exec() and eps_cmd_submit().
+ *
+ * @param tid Pointer to an integer containing the thread ID.
+ * @return Void pointer.
+ */
+void *eps_cmd_thread(void *tid);
+
+/**
+ * @brief EPS ground watchdog kicker thread, real-time if EPS_WDT_RT_PRIO is
+ * set. Kicks every device each EPS_WDT_PERIOD_MS until shutdown.
  *
  * @param tid Pointer to an integer containing the thread ID.
  * @return Void pointer.
  */
-void *eps_thread(void *tid);
+void *eps_wdt_thread(void *tid);
+
+/**
+ * @brief Condition the command worker waits on, for wakeups[].
+ *
+ */
+extern pthread_cond_t eps_cmd_cond[1];
 
 /**
  * @brief Frees and destroys.
@@ -0,0 +1,69 @@
+/**
+ * @file eps_log.h
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Layout of the binary housekeeping log written by the EPS module.
+ *
+ * The log is a preallocated file of EPS_LOG_HDR_SZ bytes of header followed
+ * by a ring of fixed-size records. Record n (1-based) lives in slot
+ * (n - 1) % capacity. A record is valid when its seq field is non-zero; seq is
+ * cleared before a slot is rewritten and set after the payload is complete,
+ * so a torn record is never mistaken for a valid one. All fields are in host
+ * byte order of the writer (little-endian on all supported targets).
+ *
+ * @version 0.1
+ * @date 2021-04-15
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#ifndef EPS_LOG_H
+#define EPS_LOG_H
+
+#include <stdint.h>
+#include "eps_p31u/p31u.h"
+
+#define EPS_LOG_MAGIC 0x4c535045 // "EPSL"
+#define EPS_LOG_VERSION 1
+#define EPS_LOG_HDR_SZ 4096 // header occupies one page, records are page aligned
+#define EPS_LOG_REC_SZ 160
+
+#define EPS_LOG_HAS_HK 0x1     // hk holds a valid sample
+#define EPS_LOG_HAS_HK_OUT 0x2 // hk_out holds a valid sample
+
+/**
+ * @brief Log file header.
+ *
+ */
+typedef struct
+{
+    uint32_t magic;      // EPS_LOG_MAGIC
+    uint16_t version;    // EPS_LOG_VERSION
+    uint16_t rec_sz;     // EPS_LOG_REC_SZ
+    uint32_t capacity;   // number of record slots
+    int32_t boot_count;  // sys_boot_count of the run that created the file
+    uint64_t created_ns; // CLOCK_REALTIME at creation
+    uint64_t seq;        // sequence number of the last complete record
+} eps_log_hdr_t;
+
+/**
+ * @brief One housekeeping record. hkparam_t and eps_hk_out_t are packed, so
+ * the record has no implicit padding.
+ *
+ */
+typedef struct
+{
+    uint64_t seq;         // 1-based sequence number, 0 while invalid
+    uint64_t t_mono_ns;   // CLOCK_MONOTONIC time of the sample
+    uint64_t t_real_ns;   // CLOCK_REALTIME time of the sample
+    int32_t boot_count;   // sys_boot_count
+    uint32_t flags;       // EPS_LOG_HAS_*
+    hkparam_t hk;         // housekeeping
+    eps_hk_out_t hk_out;  // output housekeeping
+    uint8_t reserved[EPS_LOG_REC_SZ - 32 - sizeof(hkparam_t) - sizeof(eps_hk_out_t)];
+} eps_log_rec_t;
+
+_Static_assert(sizeof(eps_log_hdr_t) <= EPS_LOG_HDR_SZ, "eps_log_hdr_t does not fit the header page");
+_Static_assert(sizeof(eps_log_rec_t) == EPS_LOG_REC_SZ, "eps_log_rec_t has the wrong size");
+
+#endif // EPS_LOG_H
@@ -0,0 +1,85 @@
+/**
+ * @file eps_proto.h
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief GomSpace NanoPower P31u I2C wire protocol: command codes, magic
+ * values and reply payload sizes.
+ *
+ * Every P31u exchange is a write of [command, arguments...] followed by a
+ * read of [command, error, payload...]. All multi-byte payload fields are
+ * big-endian on the wire.
+ *
+ * @version 0.1
+ * @date 2021-04-15
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#ifndef EPS_PROTO_H
+#define EPS_PROTO_H
+
+/**
+ * @brief P31u command codes (first byte of every write).
+ *
+ */
+#define P31U_CMD_PING 1
+#define P31U_CMD_REBOOT 4
+#define P31U_CMD_GET_HK 8
+#define P31U_CMD_SET_OUTPUT 9
+#define P31U_CMD_SET_SINGLE_OUTPUT 10
+#define P31U_CMD_SET_PV_VOLT 11
+#define P31U_CMD_SET_PV_AUTO 12
+#define P31U_CMD_SET_HEATER 13
+#define P31U_CMD_RESET_COUNTERS 15
+#define P31U_CMD_RESET_WDT 16
+#define P31U_CMD_CONFIG_CMD 17
+#define P31U_CMD_CONFIG_GET 18
+#define P31U_CMD_CONFIG_SET 19
+#define P31U_CMD_HARD_RESET 20
+
+/**
+ * @brief Argument to P31U_CMD_GET_HK selecting the housekeeping structure.
+ * hkparam_t is requested with the bare command; given as an argument,
+ * P31U_HK_LEGACY selects the full eps_hk_t instead.
+ *
+ */
+#define P31U_HK_LEGACY 0 // hkparam_t
+#define P31U_HK_VI 1     // voltages and input currents
+#define P31U_HK_OUT 2    // eps_hk_out_t
+#define P31U_HK_WDT 3    // watchdog timers and counters
+#define P31U_HK_BASIC 4  // boot counter, temperatures, modes
+
+/**
+ * @brief Magic arguments required by guarded commands.
+ *
+ */
+#define P31U_REBOOT_MAGIC 0x80078007
+#define P31U_RESET_WDT_MAGIC 0x78
+#define P31U_RESET_COUNTERS_MAGIC 0x42
+
+/**
+ * @brief Size of the [command, error] header preceding every reply payload.
+ *
+ */
+#define P31U_REPLY_HDR_SZ 2
+
+/**
+ * @brief Reply payload sizes in bytes (excluding the reply header).
+ *
+ */
+#define P31U_PING_SZ 1
+#define P31U_HK_LEGACY_SZ 43
+#define P31U_HK_VI_SZ 20
+#define P31U_HK_OUT_SZ 64
+#define P31U_HK_WDT_SZ 26
+#define P31U_HK_BASIC_SZ 21
+#define P31U_CONFIG_SZ 58
+
+/**
+ * @brief Number of switchable outputs (six latchup protected rails, quadbat
+ * switch and quadbat heater).
+ *
+ */
+#define P31U_NUM_OUTPUTS 8
+
+#endif // EPS_PROTO_H
@@ -0,0 +1,130 @@
+/**
+ * @file eps_shm.h
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Read-only client for the EPS housekeeping published in POSIX shared
+ * memory.
+ *
+ * The EPS module publishes the latest hkparam_t, eps_hk_out_t and
+ * eps_config_t of every device into a shared-memory segment named
+ * EPS_SHM_PREFIX followed by the device name ("/eps_hk_eps" for the default
+ * device). The segment is updated under a sequence lock: seq is odd while an
+ * update is in progress, and a reader that sees the same even seq before and
+ * after copying has a consistent sample. Readers never block the publisher
+ * and never touch the I2C bus.
+ *
+ *      const eps_shm_t *shm = eps_shm_open(EPS_SHM_PREFIX "eps");
+ *      eps_shm_t sample;
+ *      if (shm != NULL && eps_shm_read(shm, &sample) > 0 && (sample.flags & EPS_SHM_HAS_HK))
+ *          printf("%u mV\n", sample.hk.bv);
+ *
+ * Link clients with -lrt on C libraries older than glibc 2.34.
+ *
+ * @version 0.1
+ * @date 2021-04-15
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#ifndef EPS_SHM_H
+#define EPS_SHM_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "eps_p31u/p31u.h"
+
+#define EPS_SHM_PREFIX "/eps_hk_" // segment name is the prefix followed by the device name
+#define EPS_SHM_MAGIC 0x4d485345  // "ESHM"
+#define EPS_SHM_VERSION 1
+#define EPS_SHM_READ_TRIES 1000 // attempts before eps_shm_read() gives up on a busy segment
+
+#define EPS_SHM_HAS_HK 0x1     // hk holds a valid sample
+#define EPS_SHM_HAS_HK_OUT 0x2 // hk_out holds a valid sample
+#define EPS_SHM_HAS_CONF 0x4   // conf matches the device
+
+/**
+ * @brief Layout of a housekeeping segment.
+ *
+ */
+typedef struct eps_shm
+{
+    uint32_t magic;      // EPS_SHM_MAGIC, written last at creation
+    uint16_t version;    // EPS_SHM_VERSION
+    uint16_t size;       // sizeof(eps_shm_t)
+    int32_t pid;         // process publishing into the segment
+    int32_t boot_count;  // sys_boot_count of the publisher
+    uint32_t seq;        // sequence lock, odd while an update is in progress
+    uint32_t flags;      // EPS_SHM_HAS_*
+    uint64_t t_hk_ns;    // CLOCK_MONOTONIC time of hk
+    uint64_t t_out_ns;   // CLOCK_MONOTONIC time of hk_out
+    uint64_t t_conf_ns;  // CLOCK_MONOTONIC time conf was last read or written
+    hkparam_t hk;        // housekeeping
+    eps_hk_out_t hk_out; // output housekeeping
+    eps_config_t conf;   // configuration
+} eps_shm_t;
+
+/**
+ * @brief Maps a housekeeping segment read-only.
+ *
+ * @param name Segment name, EPS_SHM_PREFIX followed by the device name.
+ * @return const eps_shm_t* Mapped segment, NULL if it does not exist or has
+ * an unknown layout.
+ */
+static inline const eps_shm_t *eps_shm_open(const char *name)
+{
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0)
+        return NULL;
+    void *map = mmap(NULL, sizeof(eps_shm_t), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+    const eps_shm_t *shm = (const eps_shm_t *)map;
+    if (__atomic_load_n(&shm->magic, __ATOMIC_ACQUIRE) != EPS_SHM_MAGIC || shm->version != EPS_SHM_VERSION ||
+        shm->size != sizeof(eps_shm_t))
+    {
+        munmap(map, sizeof(eps_shm_t));
+        return NULL;
+    }
+    return shm;
+}
+
+/**
+ * @brief Copies a consistent sample out of a mapped segment.
+ *
+ * @param shm Segment returned by eps_shm_open().
+ * @param out Receives the sample; check out->flags for the valid parts.
+ * @return int 1 on success, -EAGAIN if no consistent copy could be taken in
+ * EPS_SHM_READ_TRIES attempts (e.g. the publisher died during an update).
+ */
+static inline int eps_shm_read(const eps_shm_t *shm, eps_shm_t *out)
+{
+    for (int i = 0; i < EPS_SHM_READ_TRIES; i++)
+    {
+        uint32_t s1 = __atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE);
+        if (s1 & 1)
+            continue;
+        memcpy(out, (const void *)shm, sizeof(eps_shm_t));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&shm->seq, __ATOMIC_RELAXED) == s1)
+            return 1;
+    }
+    return -EAGAIN;
+}
+
+/**
+ * @brief Unmaps a segment.
+ *
+ * @param shm Segment returned by eps_shm_open().
+ */
+static inline void eps_shm_close(const eps_shm_t *shm)
+{
+    if (shm != NULL)
+        munmap((void *)shm, sizeof(eps_shm_t));
+}
+
+#endif // EPS_SHM_H
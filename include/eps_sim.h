@@ -0,0 +1,60 @@
+/**
+ * @file eps_sim.h
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Controls for the simulated I2C bus used by build/eps_tester_sim.out.
+ *
+ * The simulator is a drop-in replacement for drivers/i2cbus/i2cbus.o. Every
+ * device opened on it behaves like a GomSpace P31u. Its behavior is set from
+ * the environment when the first device is opened, and can be changed at run
+ * time with the functions below:
+ *
+ * EPS_SIM_LATENCY_US: Fixed latency added to every bus transaction (default 0).
+ *
+ * EPS_SIM_BUS_HZ: Bus clock used to charge 9 bit times per byte transferred
+ * (default 100000, 0 disables).
+ *
+ * EPS_SIM_ERROR_PPM: Probability, in parts per million, that a transaction is
+ * NACKed (default 0).
+ *
+ * EPS_SIM_SEED: Seed for error injection and sensor noise (default 1).
+ *
+ * @version 0.1
+ * @date 2021-04-15
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#ifndef EPS_SIM_H
+#define EPS_SIM_H
+
+/**
+ * @brief Sets the fixed latency added to every simulated bus transaction.
+ *
+ * @param usec Latency in microseconds.
+ */
+void eps_sim_set_latency(unsigned long usec);
+
+/**
+ * @brief Sets the simulated bus clock.
+ *
+ * @param hz Bus clock in Hz, 0 to make transfers take no bus time.
+ */
+void eps_sim_set_bus_hz(unsigned long hz);
+
+/**
+ * @brief Sets the probability of a transaction being NACKed.
+ *
+ * @param ppm Error probability in parts per million.
+ */
+void eps_sim_set_error_rate(unsigned long ppm);
+
+/**
+ * @brief Triggers a latchup on one output of every simulated device: the
+ * output is switched off and its latchup counter incremented.
+ *
+ * @param ch Output channel (0 -- 5).
+ */
+void eps_sim_latchup(int ch);
+
+#endif // EPS_SIM_H
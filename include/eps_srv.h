@@ -0,0 +1,138 @@
+/**
+ * @file eps_srv.h
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Wire protocol of the EPS command server, for processes that control
+ * the EPS without linking against the module.
+ *
+ * The server listens on a SOCK_SEQPACKET Unix socket, EPS_SRV_PATH unless
+ * the EPS_SRV_SOCK environment variable names another path. Each message is
+ * one eps_srv_req_t, truncated after arg for every operation but
+ * EPS_SRV_SET_CONF. Each request gets exactly one eps_srv_resp_t, truncated
+ * after the payload of its operation (eps_srv_resp_len()). A client may send
+ * any number of requests before reading responses; responses to commands for
+ * devices on different buses can arrive out of order, so match them by id.
+ *
+ * All fields are in host byte order.
+ *
+ * @version 0.1
+ * @date 2021-04-15
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#ifndef EPS_SRV_H
+#define EPS_SRV_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "eps_p31u/p31u.h"
+
+#define EPS_SRV_PATH "/tmp/eps_cmd.sock" // default socket path
+#define EPS_SRV_SOCK_ENV "EPS_SRV_SOCK" // environment variable overriding EPS_SRV_PATH
+
+/**
+ * @brief Operations of the command server.
+ *
+ */
+typedef enum
+{
+    EPS_SRV_PING,       // no arguments
+    EPS_SRV_GET_HK,     // returns hkparam_t
+    EPS_SRV_GET_HK_OUT, // returns eps_hk_out_t
+    EPS_SRV_LUP_SET,    // arg[0] latchup, arg[1] power state
+    EPS_SRV_TGL_LUP,    // arg[0] latchup
+    EPS_SRV_GET_CONF,   // returns eps_config_t
+    EPS_SRV_SET_CONF,   // conf is the new configuration
+    EPS_SRV_REBOOT,     // no arguments
+    EPS_SRV_OP_MAX
+} eps_srv_op;
+
+/**
+ * @brief A request.
+ *
+ */
+typedef struct
+{
+    uint32_t id;       // echoed in the response
+    uint8_t op;        // eps_srv_op
+    uint8_t dev;       // device index, see eps_dev_at()
+    uint8_t arg[2];    // operation arguments
+    eps_config_t conf; // EPS_SRV_SET_CONF only
+} eps_srv_req_t;
+
+#define EPS_SRV_REQ_HDR_SZ offsetof(eps_srv_req_t, conf) // length of requests without a configuration
+
+/**
+ * @brief A response.
+ *
+ */
+typedef struct
+{
+    uint32_t id;  // id of the request
+    int32_t ret;  // return value of the command, negative errno on failure
+    uint8_t op;   // operation of the request
+    uint8_t dev;  // device of the request
+    uint8_t pad[2];
+    union
+    {
+        hkparam_t hk;
+        eps_hk_out_t hk_out;
+        eps_config_t conf;
+    } data; // result of the get operations, only present when ret >= 0
+} eps_srv_resp_t;
+
+#define EPS_SRV_RESP_HDR_SZ offsetof(eps_srv_resp_t, data) // length of responses without data
+
+/**
+ * @brief Length of a response on the wire.
+ *
+ * @param op Operation of the request.
+ * @param ret Return value of the command.
+ * @return size_t Bytes sent for the response.
+ */
+static inline size_t eps_srv_resp_len(int op, int ret)
+{
+    if (ret < 0)
+        return EPS_SRV_RESP_HDR_SZ;
+    switch (op)
+    {
+    case EPS_SRV_GET_HK:
+        return EPS_SRV_RESP_HDR_SZ + sizeof(hkparam_t);
+    case EPS_SRV_GET_HK_OUT:
+        return EPS_SRV_RESP_HDR_SZ + sizeof(eps_hk_out_t);
+    case EPS_SRV_GET_CONF:
+        return EPS_SRV_RESP_HDR_SZ + sizeof(eps_config_t);
+    default:
+        return EPS_SRV_RESP_HDR_SZ;
+    }
+}
+
+/**
+ * @brief Connects to the command server.
+ *
+ * @param path Socket path, NULL for EPS_SRV_PATH.
+ * @return int Connected socket, -1 on failure with errno set.
+ */
+static inline int eps_srv_connect(const char *path)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0x0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path != NULL ? path : EPS_SRV_PATH, sizeof(addr.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+#endif // EPS_SRV_H
@@ -0,0 +1,40 @@
+/**
+ * @file eps_srv_iface.h
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Module interface of the EPS command server.
+ * @version 0.1
+ * @date 2021-04-15
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#ifndef EPS_SRV_IFACE_H
+#define EPS_SRV_IFACE_H
+
+/**
+ * @brief Creates the command server socket. Must run after eps_init().
+ * A socket file nobody listens on is replaced; one that accepts connections
+ * belongs to a running instance and is left alone.
+ *
+ * @return int 1 on success, -EADDRINUSE if the socket path is in use, -1 on
+ * other errors.
+ */
+int eps_srv_init();
+
+/**
+ * @brief Registers the server socket and the command completions with the
+ * reactor.
+ *
+ * @return int 1 on success, -1 on error.
+ */
+int eps_srv_register();
+
+/**
+ * @brief Disconnects the clients, closes the server socket and removes it
+ * from the file system. Must run after the command workers have exited.
+ *
+ */
+void eps_srv_destroy();
+
+#endif // EPS_SRV_IFACE_H
@@ -1 +1,13 @@
-void *eps_test(void *);
\ No newline at end of file
+#include <stdio.h>
+
+void *eps_test(void *);
+
+/**
+ * @brief Runs a command script without prompts, printing one JSON line per
+ * command. The script format is described in src/eps_test_batch.c.
+ *
+ * @param fp Script to read.
+ * @return int 1 if every command succeeded, 0 if some failed, -1 if the script
+ * could not be parsed.
+ */
+int eps_test_batch(FILE *fp);
@@ -0,0 +1,102 @@
+/**
+ * @file eps_trace.h
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Binary trace of the I2C transactions of the EPS module, and the
+ * controls of its capture and replay.
+ *
+ * Capture: every program linking src/eps_trace.o wraps the i2cbus functions
+ * (-Wl,--wrap, see the Makefile). When EPS_TRACE names a file, every
+ * open, close, read, write and transfer is appended to it as one record;
+ * otherwise the wrappers only forward the call.
+ *
+ * Replay: src/eps_replay.c replaces drivers/i2cbus/i2cbus.o
+ * (build/eps_tester_replay.out) and answers every transaction from the trace
+ * named by EPS_REPLAY:
+ *
+ * EPS_REPLAY_SPEED: 0 answers at once (default); otherwise every transaction
+ * takes its recorded latency divided by the speed, 1 being real time.
+ *
+ * EPS_REPLAY_LOOP: 1 restarts a device's records once they are used up,
+ * instead of failing further transactions with ENODATA (default 0).
+ *
+ * Each transaction takes the first unused record of its device (bus and
+ * address) with the same operation, bytes written and read length among the
+ * next EPS_REPLAY_LOOKAHEAD records, so that the poller and the command path
+ * may interleave differently than when recorded. A transaction without a match
+ * fails with EIO; records passed over for long are counted as skipped. The
+ * counts are printed on exit.
+ *
+ * A trace is an eps_trace_hdr_t followed by records, each an eps_trace_rec_t
+ * followed by wlen bytes written and rlen bytes read, padded to a multiple of
+ * 8 bytes.
+ *
+ * @version 0.1
+ * @date 2021-04-15
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#ifndef EPS_TRACE_H
+#define EPS_TRACE_H
+
+#include <stdint.h>
+
+#define EPS_TRACE_MAGIC 0x52545045 // "EPTR"
+#define EPS_TRACE_VERSION 1
+#define EPS_TRACE_MAX_DATA 256 // bytes of a transfer recorded in each direction
+#define EPS_REPLAY_LOOKAHEAD 64 // records searched for a match
+
+/**
+ * @brief Trace file header.
+ *
+ */
+typedef struct
+{
+    uint32_t magic;     // EPS_TRACE_MAGIC
+    uint16_t version;   // EPS_TRACE_VERSION
+    uint16_t rec_size;  // sizeof(eps_trace_rec_t)
+    uint64_t t_real_ns; // CLOCK_REALTIME at the start of the capture
+    uint64_t t_mono_ns; // CLOCK_MONOTONIC at the start of the capture
+} eps_trace_hdr_t;
+
+/**
+ * @brief Traced operations.
+ *
+ */
+typedef enum
+{
+    EPS_TRACE_OPEN,
+    EPS_TRACE_CLOSE,
+    EPS_TRACE_WRITE,
+    EPS_TRACE_READ,
+    EPS_TRACE_XFER,
+} eps_trace_op;
+
+/**
+ * @brief One traced transaction.
+ *
+ */
+typedef struct
+{
+    uint64_t t_ns;     // start, ns since t_mono_ns of the header
+    uint32_t lat_ns;   // time spent in the call
+    int32_t ret;       // return value
+    uint32_t delay_us; // write-to-read delay of a transfer
+    uint16_t err;      // errno if ret < 0
+    uint16_t wlen;     // bytes written that follow
+    uint16_t rlen;     // bytes read that follow, 0 if the call failed
+    uint8_t op;        // eps_trace_op
+    uint8_t bus;       // I2C bus
+    uint8_t addr;      // device address
+    uint8_t cmd;       // first byte written, 0 if none
+    uint8_t pad[2];
+} eps_trace_rec_t;
+
+/**
+ * @brief Bytes taken by a record and its payload in the trace.
+ *
+ */
+#define EPS_TRACE_REC_SIZE(rec) ((sizeof(eps_trace_rec_t) + (rec)->wlen + (rec)->rlen + 7) & ~(size_t)7)
+
+#endif // EPS_TRACE_H
@@ -63,6 +63,17 @@ extern int sys_boot_count;
  */
 #define BOOTCOUNT_FNAME "bootcount_fname.txt"
 
+/**
+ * @brief Number of threads running module inits concurrently.
+ * 
+ */
+#define INIT_THREADS 4
+/**
+ * @brief Interval in ms at which running inits are checked against their timeouts.
+ * 
+ */
+#define INIT_CHECK_MS 100
+
 /**
  * @brief Function that returns the current bootcount of the system.
  * Returns current boot count, and increases by 1 and stores it in nvmem.
@@ -15,48 +15,77 @@
 #include <pthread.h>
 #include "eps_iface.h"
 #include "eps_test_iface.h"
+#include "eps_srv_iface.h"
 typedef int (*init_func)(void);     // typedef to create array of init functions
 typedef void (*destroy_func)(void); // typedef to create array of destroy functions
 
 /**
- * @brief Registers init functions of a given module
+ * @brief Identifies a module in modules[]
  */
-init_func module_init[] = {
-    eps_init,
-};
+typedef enum
+{
+    MODULE_EPS,
+    MODULE_EPS_SRV,
+    NUM_MODULES
+} module_id;
+/**
+ * @brief Dependency bit of a module, for module_entry.deps
+ */
+#define MODULE_DEP(id) (1u << (id))
+
 /**
- * @brief Number of modules with an associated init function
+ * @brief Describes how a module is brought up and torn down.
+ * Inits run concurrently on the init threads, each once the modules it
+ * depends on have started. A module is started on the main thread as soon
+ * as its own init succeeds: its reactor callbacks are registered and its
+ * threads in module_exec[] are created.
  */
-const int num_init = sizeof(module_init) / sizeof(init_func);
+typedef struct
+{
+    const char *name;
+    init_func init;       // run on an init thread
+    init_func reg;        // registers reactor callbacks, NULL if none
+    destroy_func destroy; // run in reverse order of modules[] at shutdown
+    unsigned deps;        // MODULE_DEP() of the modules that must start first
+    unsigned timeout_ms;  // an init taking longer is fatal
+} module_entry;
 
 /**
- * @brief Registers init functions of a given module
+ * @brief Registers init, reactor and destroy functions of every module
  */
-destroy_func module_destroy[] = {
-    eps_destroy,
+module_entry modules[NUM_MODULES] = {
+    [MODULE_EPS] = {"eps", eps_init, eps_register, eps_destroy, 0, 10000},
+    // serves requests by submitting commands to the EPS devices
+    [MODULE_EPS_SRV] = {"eps_srv", eps_srv_init, eps_srv_register, eps_srv_destroy, MODULE_DEP(MODULE_EPS), 1000},
 };
+
 /**
- * @brief Number of modules with an associated destroy function
+ * @brief Thread of a module, for work that blocks
  */
-const int num_destroy = sizeof(module_destroy) / sizeof(destroy_func);
+typedef struct
+{
+    void *(*fn)(void *);
+    module_id module; // the thread starts with this module
+} module_thread;
 
 /**
- * @brief Registers exec functions of a given module
+ * @brief Registers exec functions of a given module, for work that blocks
  */
-void *module_exec[] = {
-    eps_thread,
-    eps_test,
+module_thread module_exec[] = {
+    {eps_cmd_thread, MODULE_EPS},
+    {eps_wdt_thread, MODULE_EPS},
+    {eps_test, MODULE_EPS},
 };
 /**
  * @brief Number of enabled modules
  */
-const int num_systems = sizeof(module_exec) / sizeof(void *);
+const int num_systems = sizeof(module_exec) / sizeof(module_thread);
 
 /**
  * @brief List of condition locks for modules to be woken up by signal handler
  */
 pthread_cond_t *wakeups[] = {
-
+    eps_cmd_cond,
 };
 const int num_wakeups = sizeof(wakeups) / sizeof(pthread_cond_t *);
 #endif
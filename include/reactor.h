@@ -0,0 +1,108 @@
+/**
+ * @file reactor.h
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Event loop run by main(). Modules register file descriptors and
+ * timers with callbacks in the reg function of their modules[] entry instead
+ * of owning a thread for periodic work.
+ *
+ * Callbacks run one at a time on the main thread and must not block for
+ * long. None of these functions is thread safe: call them from a reg
+ * function or from a callback, except reactor_stop().
+ *
+ * @version 0.1
+ * @date 2021-04-15
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <stdint.h>
+#include <sys/epoll.h>
+
+#define REACTOR_MAX_FDS 64 // file descriptors and timers registered at once
+
+/**
+ * @brief Callback of a registered file descriptor or timer.
+ *
+ * @param fd File descriptor that is ready; for a timer its timerfd, already
+ * read.
+ * @param events EPOLL* events reported.
+ * @param arg Argument given at registration.
+ */
+typedef void (*reactor_cb)(int fd, uint32_t events, void *arg);
+
+/**
+ * @brief Creates the event loop.
+ *
+ * @return int 1 on success, -1 on failure.
+ */
+int reactor_init(void);
+
+/**
+ * @brief Watches a file descriptor.
+ *
+ * @param fd File descriptor, owned by the caller.
+ * @param events EPOLL* events of interest; level triggered.
+ * @param cb Called when an event occurs.
+ * @param arg Passed to cb.
+ * @return int 1 on success, -1 on failure.
+ */
+int reactor_add(int fd, uint32_t events, reactor_cb cb, void *arg);
+
+/**
+ * @brief Changes the events a file descriptor is watched for. With events 0
+ * only EPOLLHUP and EPOLLERR are reported.
+ *
+ * @return int 1 on success, -1 on failure.
+ */
+int reactor_mod(int fd, uint32_t events);
+
+/**
+ * @brief Stops watching a file descriptor. The caller closes it.
+ *
+ * @return int 1 on success, -1 if fd is not registered.
+ */
+int reactor_del(int fd);
+
+/**
+ * @brief Creates a disarmed CLOCK_MONOTONIC timer.
+ *
+ * @param cb Called on expiry.
+ * @param arg Passed to cb.
+ * @return int Timer handle for reactor_timer_at(), -1 on failure.
+ */
+int reactor_timer(reactor_cb cb, void *arg);
+
+/**
+ * @brief Arms a timer to expire once at an absolute time.
+ *
+ * @param timer Handle returned by reactor_timer().
+ * @param t_mono_ns CLOCK_MONOTONIC expiry time in ns; times in the past
+ * expire at once.
+ * @return int 1 on success, -1 on failure.
+ */
+int reactor_timer_at(int timer, uint64_t t_mono_ns);
+
+/**
+ * @brief Dispatches events until reactor_stop() is called.
+ *
+ */
+void reactor_run(void);
+
+/**
+ * @brief Makes reactor_run() return. Callable from any thread.
+ *
+ */
+void reactor_stop(void);
+
+/**
+ * @brief Closes the timers and the event loop. Other registered file
+ * descriptors stay open.
+ *
+ */
+void reactor_destroy(void);
+
+#endif // REACTOR_H
@@ -13,141 +13,1934 @@
 #include "eps_p31u/p31u.h"
 #undef EPS_P31U_PRIVATE
 #include "eps.h"
+#include "eps_i2c.h"
+#include "eps_proto.h"
+#include "eps_shm.h"
+#include "reactor.h"
 #include <main.h>
+#include <endian.h>
+#include <errno.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdlib.h>
 #include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <time.h>
 #include <unistd.h>
 
 /* Variable allocation for EPS */
 
+static inline uint64_t eps_now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * @brief State of a command queue slot.
+ *
+ */
+typedef enum
+{
+    EPS_SLOT_FREE,      // available for a new command
+    EPS_SLOT_QUEUED,    // waiting for the worker
+    EPS_SLOT_RUNNING,   // on the bus
+    EPS_SLOT_DONE,      // result available
+    EPS_SLOT_CANCELLED, // dropped before execution, released by the worker
+    EPS_SLOT_ABANDONED  // running without an owner, released by the worker
+} eps_slot_state;
+
+/**
+ * @brief A queued command and its completion.
+ *
+ */
+typedef struct
+{
+    eps_cmd_t cmd;
+    eps_dev_t *dev; // device the command is for
+    eps_slot_state state;
+    int ret;
+    unsigned gen;          // bumped on every use, makes tickets unique
+    uint64_t t_submit;     // queued at, ns
+    uint64_t t_done;       // completed at, ns
+    eps_prio prio;
+    int attempts;          // made before the command was deferred for a more urgent one
+    pthread_cond_t *waker; // blocked caller to signal on completion, NULL if async
+    int notify_fd;         // eventfd to post on completion, -1 if none
+} eps_cmd_slot;
+
+/**
+ * @brief Slot indices of one priority class, in submission order.
+ *
+ */
+typedef struct
+{
+    int idx[EPS_CMDQ_DEPTH];
+    int head;
+    int count;
+    uint64_t dispatched;
+    uint64_t preempted;
+    uint64_t wait_sum_ns; // submission to dispatch
+    uint64_t wait_max_ns;
+} eps_cmd_fifo;
+
+/**
+ * @brief Bounded multi-producer, single-consumer command queue of one I2C
+ * bus, served by one worker thread. Every member but cond is protected by m.
+ * The worker always takes the head of the most urgent non-empty class.
+ *
+ */
+typedef struct
+{
+    pthread_mutex_t m;
+    pthread_cond_t *cond; // worker waits here; eps_cmd_cond for the first bus
+    pthread_cond_t own_cond;
+    int bus_id;
+    eps_cmd_slot slot[EPS_CMDQ_DEPTH];
+    eps_cmd_fifo fifo[EPS_PRIO_MAX];
+    int count; // over all classes
+    int closed;      // worker has exited, submissions fail
+    int fail_streak; // consecutive failed commands, for bus reset escalation
+} eps_cmdq_t;
+
+/**
+ * @brief One EPS of the device table.
+ *
+ */
+struct eps_dev
+{
+    int idx;
+    char name[EPS_DEV_NAME_LEN];
+    int bus_id;
+    int addr;
+    p31u p31u[1];     // driver handle
+    i2cbus bus[1];    // raw handle, for P31u commands the driver does not wrap; only used by the command worker
+    eps_cmdq_t *q;    // queue of the bus the device is on
+    eps_log_t log[1]; // housekeeping log
+    eps_shm_pub_t shm[1]; // shared-memory publication of the latest housekeeping and configuration
+    eps_retry_stats_t retry[1]; // command outcome counters, protected by q->m
+    eps_agg_t agg[1]; // streaming housekeeping statistics
+    uint64_t t_out_switched; // end of the last command that may have switched outputs; only used by the command worker
+
+    /**
+     * @brief Shadow of the EPS configuration, kept coherent by the command
+     * worker: filled by every successful read or write of the configuration
+     * and invalidated by reboots, hard resets and failed writes.
+     *
+     */
+    struct
+    {
+        pthread_mutex_t m;
+        int valid;
+        eps_config_t conf;
+    } conf_shadow[1];
+
+    /**
+     * @brief Latest housekeeping, published by the poller and by field set
+     * reads under a sequence lock. The sequence is odd while an update is in
+     * progress. Each field set is polled independently and carries its own
+     * timestamp, 0 until the first sample of that set has been stored.
+     *
+     */
+    struct
+    {
+        atomic_uint seq;
+        eps_hk_view_t v;
+    } hk_cache[1];
+    pthread_mutex_t hk_cache_m[1]; // serializes writers of hk_cache
+};
+
+static eps_dev_t eps_devs[EPS_DEV_MAX];
+static int eps_ndevs = 0;
+static eps_cmdq_t eps_cmdqs[EPS_BUS_MAX];
+static int eps_nqueues = 0;
+
+pthread_cond_t eps_cmd_cond[1] = {PTHREAD_COND_INITIALIZER};
+
+/**
+ * @brief Per-thread completion condition for blocking commands.
+ *
+ */
+static __thread pthread_cond_t eps_cmd_wait[1];
+static __thread int eps_cmd_wait_init = 0;
+
+int eps_dev_count()
+{
+    return eps_ndevs;
+}
+
+eps_dev_t *eps_dev_at(int idx)
+{
+    return idx >= 0 && idx < eps_ndevs ? &eps_devs[idx] : NULL;
+}
+
+eps_dev_t *eps_dev_find(const char *name)
+{
+    for (int i = 0; name != NULL && i < eps_ndevs; i++)
+        if (!strcmp(eps_devs[i].name, name))
+            return &eps_devs[i];
+    return NULL;
+}
+
+const char *eps_dev_name(const eps_dev_t *dev)
+{
+    return dev != NULL ? dev->name : NULL;
+}
+
+int eps_dev_index(const eps_dev_t *dev)
+{
+    return dev != NULL ? dev->idx : -1;
+}
+
+int eps_dev_addr(const eps_dev_t *dev, int *bus_id, int *addr)
+{
+    if (dev == NULL)
+        return -ENODEV;
+    *bus_id = dev->bus_id;
+    *addr = dev->addr;
+    return 1;
+}
+
+eps_prio eps_cmd_prio(const eps_cmd_t *cmd)
+{
+    switch (cmd->op)
+    {
+    case EPS_OP_HARDRESET:
+        return EPS_PRIO_CRITICAL;
+    case EPS_OP_LUP_SET:
+        return cmd->arg[1] == 0 ? EPS_PRIO_CRITICAL : EPS_PRIO_CONTROL;
+    case EPS_OP_LUP_MASK:
+        return cmd->arg[0] == 0 && cmd->arg[1] != 0 ? EPS_PRIO_CRITICAL : EPS_PRIO_CONTROL;
+    case EPS_OP_REBOOT:
+    case EPS_OP_TGL_LUP:
+    case EPS_OP_SET_CONF:
+    case EPS_OP_RESET_WDT:
+        return EPS_PRIO_CONTROL;
+    default:
+        return EPS_PRIO_BULK;
+    }
+}
+
+static inline void eps_cmd_fifo_push(eps_cmd_fifo *f, int idx)
+{
+    f->idx[(f->head + f->count++) % EPS_CMDQ_DEPTH] = idx;
+}
+
+static inline void eps_cmd_fifo_push_front(eps_cmd_fifo *f, int idx)
+{
+    f->head = (f->head + EPS_CMDQ_DEPTH - 1) % EPS_CMDQ_DEPTH;
+    f->idx[f->head] = idx;
+    f->count++;
+}
+
+// Takes the oldest command of the most urgent non-empty class, -1 if the
+// queue is empty. Called with q->m held.
+static int eps_cmdq_pop(eps_cmdq_t *q)
+{
+    for (int p = 0; p < EPS_PRIO_MAX; p++)
+    {
+        eps_cmd_fifo *f = &q->fifo[p];
+        if (f->count == 0)
+            continue;
+        int idx = f->idx[f->head];
+        f->head = (f->head + 1) % EPS_CMDQ_DEPTH;
+        f->count--;
+        q->count--;
+        return idx;
+    }
+    return -1;
+}
+
+// Whether a command more urgent than prio is waiting. Called with q->m held.
+static inline int eps_cmdq_urgent(eps_cmdq_t *q, eps_prio prio)
+{
+    for (int p = 0; p < (int)prio; p++)
+        if (q->fifo[p].count > 0)
+            return 1;
+    return 0;
+}
+
+// Reserves a slot and appends it to the queue. Called with q->m held.
+static int eps_cmdq_push(eps_cmdq_t *q, eps_dev_t *dev, const eps_cmd_t *cmd, pthread_cond_t *waker, int notify_fd)
+{
+    if (q->closed)
+        return -ECANCELED;
+    eps_prio prio = eps_cmd_prio(cmd);
+    // the last entries are kept for power shedding, which must not be refused
+    if (q->count >= EPS_CMDQ_DEPTH - (prio == EPS_PRIO_CRITICAL ? 0 : EPS_CMDQ_CRIT_RESERVE))
+        return -EAGAIN;
+    int idx = -1;
+    for (int i = 0; i < EPS_CMDQ_DEPTH; i++)
+    {
+        if (q->slot[i].state == EPS_SLOT_FREE)
+        {
+            idx = i;
+            break;
+        }
+    }
+    if (idx < 0) // all slots held by unpolled asynchronous commands
+        return -EAGAIN;
+    eps_cmd_slot *slot = &q->slot[idx];
+    slot->cmd = *cmd;
+    slot->dev = dev;
+    slot->state = EPS_SLOT_QUEUED;
+    slot->ret = 0;
+    slot->gen = (slot->gen + 1) & 0xfffff;
+    slot->waker = waker;
+    slot->notify_fd = notify_fd;
+    slot->t_submit = eps_now_ns();
+    slot->prio = prio;
+    slot->attempts = 0;
+    eps_cmd_fifo_push(&q->fifo[prio], idx);
+    q->count++;
+    pthread_cond_signal(q->cond);
+    return idx;
+}
+
+// Marks a slot done and wakes its owner. Called with q->m held.
+static void eps_cmd_slot_complete(eps_cmd_slot *slot, int ret)
+{
+    slot->ret = ret;
+    slot->t_done = eps_now_ns();
+    slot->state = EPS_SLOT_DONE;
+    if (slot->waker != NULL)
+        pthread_cond_signal(slot->waker);
+    if (slot->notify_fd >= 0)
+    {
+        uint64_t one = 1;
+        write(slot->notify_fd, &one, sizeof(one));
+    }
+}
+
+// Tickets encode the slot generation, the slot and the queue.
+static inline int eps_cmd_ticket(eps_cmdq_t *q, int idx)
+{
+    return (q->slot[idx].gen * EPS_CMDQ_DEPTH + idx) * EPS_BUS_MAX + (int)(q - eps_cmdqs);
+}
+
+static inline eps_cmdq_t *eps_cmd_queue_of(int ticket)
+{
+    if (ticket < 0 || ticket % EPS_BUS_MAX >= eps_nqueues)
+        return NULL;
+    return &eps_cmdqs[ticket % EPS_BUS_MAX];
+}
+
+// Returns the slot index of a ticket, or -1 if the ticket is stale. Called with q->m held.
+static int eps_cmd_slot_of(eps_cmdq_t *q, int ticket)
+{
+    ticket /= EPS_BUS_MAX;
+    int idx = ticket % EPS_CMDQ_DEPTH;
+    eps_cmd_slot *slot = &q->slot[idx];
+    if (slot->gen != (unsigned)(ticket / EPS_CMDQ_DEPTH) || slot->state == EPS_SLOT_FREE ||
+        slot->state == EPS_SLOT_CANCELLED || slot->state == EPS_SLOT_ABANDONED || slot->waker != NULL)
+        return -1;
+    return idx;
+}
+
+/**
+ * @brief Sends a raw P31u command and reads back its reply.
+ *
+ * @param dev Device to talk to.
+ * @param wbuf Command byte followed by its arguments.
+ * @param wlen Length of wbuf.
+ * @param payload Buffer for the reply payload, NULL if plen is 0.
+ * @param plen Expected payload length, excluding the reply header.
+ * @return int 1 on success, value for i2c read / write on bus error, -EIO if
+ * the EPS reported an error.
+ */
+static int eps_raw_cmd(eps_dev_t *dev, uint8_t *wbuf, ssize_t wlen, void *payload, ssize_t plen)
+{
+    uint8_t rbuf[P31U_REPLY_HDR_SZ + P31U_HK_OUT_SZ];
+    if (plen > P31U_HK_OUT_SZ)
+        return -EINVAL;
+    int ret = i2cbus_xfer(dev->bus, wbuf, wlen, rbuf, P31U_REPLY_HDR_SZ + plen, EPS_XFER_DELAY);
+    if (ret < 0)
+        return ret;
+    if (rbuf[0] != wbuf[0] || rbuf[1] != 0)
+        return -EIO;
+    if (plen > 0)
+        memcpy(payload, rbuf + P31U_REPLY_HDR_SZ, plen);
+    return 1;
+}
+
+/**
+ * @brief Converts a run of big-endian 16-bit fields to host order in place,
+ * eight bytes at a time. n must be even; p needs no alignment.
+ *
+ */
+static inline void eps_be16_run(uint8_t *p, size_t n)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        uint64_t w;
+        memcpy(&w, p + i, 8);
+        w = ((w & 0x00ff00ff00ff00ffULL) << 8) | ((w >> 8) & 0x00ff00ff00ff00ffULL);
+        memcpy(p + i, &w, 8);
+    }
+    for (; i < n; i += 2)
+    {
+        uint8_t t = p[i];
+        p[i] = p[i + 1];
+        p[i + 1] = t;
+    }
+#endif
+}
+
+/**
+ * @brief Converts a big-endian 32-bit field to host order in place.
+ *
+ */
+static inline void eps_be32_at(uint8_t *p)
+{
+    uint32_t w;
+    memcpy(&w, p, 4);
+    w = be32toh(w);
+    memcpy(p, &w, 4);
+}
+
+/**
+ * @brief Converts the multi-byte fields of a housekeeping payload of the
+ * given P31U_HK_* type to host order in place.
+ *
+ */
+static inline void eps_hk_payload_to_host(uint8_t *p, uint8_t type)
+{
+    switch (type)
+    {
+    case P31U_HK_OUT:
+        eps_be16_run(p, offsetof(eps_hk_out_t, output));
+        eps_be16_run(p + offsetof(eps_hk_out_t, output_on_delta), sizeof(eps_hk_out_t) - offsetof(eps_hk_out_t, output_on_delta));
+        break;
+    case P31U_HK_VI:
+        eps_be16_run(p, sizeof(eps_vi_t));
+        break;
+    case P31U_HK_WDT:
+        eps_be32_at(p + offsetof(eps_wdt_t, i2c_time_left));
+        eps_be32_at(p + offsetof(eps_wdt_t, gnd_time_left));
+        for (size_t ofs = offsetof(eps_wdt_t, i2c_count); ofs < sizeof(eps_wdt_t); ofs += 4)
+            eps_be32_at(p + ofs);
+        break;
+    case P31U_HK_BASIC:
+        eps_be32_at(p + offsetof(eps_basic_t, bootcount));
+        eps_be16_run(p + offsetof(eps_basic_t, temp), sizeof(((eps_basic_t *)0)->temp));
+        eps_be16_run(p + offsetof(eps_basic_t, reserved), 2);
+        break;
+    default:
+        eps_be16_run(p, offsetof(hkparam_t, reset));
+        eps_be16_run(p + offsetof(hkparam_t, bootcount), offsetof(hkparam_t, ppt_mode) - offsetof(hkparam_t, bootcount));
+        break;
+    }
+}
+
+/**
+ * @brief Housekeeping field sets: the P31u sub-command of each and where it
+ * goes in eps_hk_view_t, in the order a poll pass reads them.
+ *
+ */
+static const struct
+{
+    uint32_t set;   // EPS_HK_*
+    uint8_t type;   // P31U_HK_*
+    uint8_t size;   // payload bytes, equal to the struct size
+    uint16_t ofs;   // data in eps_hk_view_t
+    uint16_t t_ofs; // timestamp in eps_hk_view_t
+} eps_hk_sets[] = {
+    {EPS_HK_LEGACY, P31U_HK_LEGACY, P31U_HK_LEGACY_SZ, offsetof(eps_hk_view_t, hk), offsetof(eps_hk_view_t, t_hk)},
+    {EPS_HK_OUT, P31U_HK_OUT, P31U_HK_OUT_SZ, offsetof(eps_hk_view_t, hk_out), offsetof(eps_hk_view_t, t_out)},
+    {EPS_HK_VI, P31U_HK_VI, P31U_HK_VI_SZ, offsetof(eps_hk_view_t, vi), offsetof(eps_hk_view_t, t_vi)},
+    {EPS_HK_WDT, P31U_HK_WDT, P31U_HK_WDT_SZ, offsetof(eps_hk_view_t, wdt), offsetof(eps_hk_view_t, t_wdt)},
+    {EPS_HK_BASIC, P31U_HK_BASIC, P31U_HK_BASIC_SZ, offsetof(eps_hk_view_t, basic), offsetof(eps_hk_view_t, t_basic)},
+};
+
+#define EPS_HK_NSETS (sizeof(eps_hk_sets) / sizeof(eps_hk_sets[0]))
+
+_Static_assert(sizeof(hkparam_t) == P31U_HK_LEGACY_SZ && sizeof(eps_hk_out_t) == P31U_HK_OUT_SZ && sizeof(eps_vi_t) == P31U_HK_VI_SZ &&
+                   sizeof(eps_wdt_t) == P31U_HK_WDT_SZ && sizeof(eps_basic_t) == P31U_HK_BASIC_SZ,
+               "housekeeping structures must match the P31u payloads");
+
+static inline uint64_t *eps_hk_view_ts(eps_hk_view_t *v, int i)
+{
+    return (uint64_t *)((uint8_t *)v + eps_hk_sets[i].t_ofs);
+}
+
+/**
+ * @brief Reads a housekeeping reply straight into a caller buffer and
+ * converts the 16-bit fields of the payload in place.
+ *
+ * @return int 1 on success, value for i2c read / write on bus error, -EIO if
+ * the EPS reported an error.
+ */
+static int eps_hk_raw_run(eps_dev_t *dev, eps_hk_raw_t *raw, uint8_t type)
+{
+    uint8_t wbuf[2] = {P31U_CMD_GET_HK, type};
+    uint8_t *rbuf = raw->data + EPS_HK_RAW_OFS - P31U_REPLY_HDR_SZ;
+    uint8_t *p = raw->data + EPS_HK_RAW_OFS;
+    ssize_t plen = type == P31U_HK_OUT ? P31U_HK_OUT_SZ : P31U_HK_LEGACY_SZ;
+    // the legacy request is the bare command, as the driver sends it
+    int ret = i2cbus_xfer(dev->bus, wbuf, type == P31U_HK_LEGACY ? 1 : 2, rbuf, P31U_REPLY_HDR_SZ + plen, EPS_XFER_DELAY);
+    if (ret < 0)
+        return ret;
+    if (rbuf[0] != wbuf[0] || rbuf[1] != 0)
+        return -EIO;
+    eps_hk_payload_to_host(p, type);
+    return 1;
+}
+
+/**
+ * @brief Runs a housekeeping pass as one batch: the requested field sets in
+ * eps_hk_sets[] order.
+ *
+ * @param parts EPS_HK_* sets to read.
+ * @param res Receives the sets read; timestamps are left to the caller.
+ * @return int 1 on success, value for i2c read / write on bus error, -EIO if
+ * the EPS reported an error.
+ */
+static int eps_poll_run(eps_dev_t *dev, int parts, eps_hk_view_t *res)
+{
+    uint8_t cmds[EPS_HK_NSETS][2];
+    uint8_t replies[EPS_HK_NSETS][P31U_REPLY_HDR_SZ + P31U_HK_OUT_SZ];
+    eps_i2c_op_t ops[EPS_HK_NSETS];
+    int set_of[EPS_HK_NSETS];
+    int n = 0;
+    if (res == NULL || (parts & ~EPS_HK_ALL) || parts == 0)
+        return -EINVAL;
+    for (int i = 0; i < (int)EPS_HK_NSETS; i++)
+    {
+        if (!(parts & eps_hk_sets[i].set))
+            continue;
+        cmds[i][0] = P31U_CMD_GET_HK;
+        cmds[i][1] = eps_hk_sets[i].type;
+        set_of[n] = i;
+        // the legacy request is the bare command, as the driver sends it
+        ops[n++] = (eps_i2c_op_t){.wbuf = cmds[i], .wlen = eps_hk_sets[i].type == P31U_HK_LEGACY ? 1 : 2, .rbuf = replies[i], .rlen = P31U_REPLY_HDR_SZ + eps_hk_sets[i].size};
+    }
+    // the batch checks the reply headers
+    int ret = eps_i2c_batch(dev->bus, ops, n);
+    if (ret < 0)
+        return errno == EIO ? -EIO : ret;
+    for (int k = 0; k < n; k++)
+    {
+        uint8_t *p = ops[k].rbuf + P31U_REPLY_HDR_SZ;
+        eps_hk_payload_to_host(p, eps_hk_sets[set_of[k]].type);
+        memcpy((uint8_t *)res + eps_hk_sets[set_of[k]].ofs, p, eps_hk_sets[set_of[k]].size);
+    }
+    return 1;
+}
+
+static uint64_t eps_hk_cache_read(eps_dev_t *dev, uint32_t sets, eps_hk_view_t *view);
+static void eps_hk_cache_write(eps_dev_t *dev, uint32_t sets, const eps_hk_view_t *view, uint64_t tstamp);
+
+// Bit i set if output i is on.
+static inline uint8_t eps_output_mask(const eps_hk_out_t *hk_out)
+{
+    uint8_t mask = 0;
+    for (int i = 0; i < P31U_NUM_OUTPUTS; i++)
+        mask |= (hk_out->output[i] ? 1 : 0) << i;
+    return mask;
+}
+
+/**
+ * @brief Switches a set of outputs with one P31u set-output command.
+ *
+ * Outputs in neither mask keep their state in the cached eps_hk_out_t, so
+ * the switch is a single bus transaction. Only when the cache holds no
+ * sample younger than EPS_LUP_MASK_MAX_AGE_MS, or none taken since the last
+ * command that switched outputs, is the output state read from the device
+ * first. An output the EPS has switched off itself since the sample is
+ * switched on again; the readback shows it. The output state is read back
+ * after the command and stored in the cache.
+ *
+ * Masks that name every output, such as a cut of all rails, need no state:
+ * the command is sent alone, without the read or the readback.
+ *
+ * @return int Output mask the device reports after the command, the mask
+ * sent if there is no readback or it fails; negative on error.
+ */
+static int eps_lup_mask_run(eps_dev_t *dev, uint8_t on_mask, uint8_t off_mask)
+{
+    const uint8_t all = (1 << P31U_NUM_OUTPUTS) - 1;
+    int whole = ((on_mask | off_mask) & all) == all;
+    uint8_t mask = on_mask;
+    eps_hk_view_t v;
+    int ret;
+    if (!whole)
+    {
+        uint64_t t = eps_hk_cache_read(dev, EPS_HK_OUT, &v);
+        if (t == 0 || t < dev->t_out_switched || eps_now_ns() - t > EPS_LUP_MASK_MAX_AGE_MS * 1000000ULL)
+        {
+            if ((ret = eps_p31u_get_hk_out(dev->p31u, &v.hk_out)) < 0)
+                return ret;
+        }
+        mask = (eps_output_mask(&v.hk_out) & ~off_mask) | on_mask;
+    }
+    uint8_t wbuf[2] = {P31U_CMD_SET_OUTPUT, mask};
+    ret = eps_raw_cmd(dev, wbuf, sizeof(wbuf), NULL, 0);
+    uint64_t now = eps_now_ns();
+    dev->t_out_switched = now;
+    if (ret < 0)
+        return ret;
+    if (whole || eps_p31u_get_hk_out(dev->p31u, &v.hk_out) < 0)
+        return mask;
+    pthread_mutex_lock(dev->hk_cache_m);
+    eps_hk_cache_write(dev, EPS_HK_OUT, &v, now);
+    pthread_mutex_unlock(dev->hk_cache_m);
+    return eps_output_mask(&v.hk_out);
+}
+
+static void eps_conf_shadow_store(eps_dev_t *dev, const eps_config_t *conf)
+{
+    pthread_mutex_lock(&dev->conf_shadow->m);
+    if (conf != NULL)
+        memcpy(&dev->conf_shadow->conf, conf, sizeof(eps_config_t));
+    dev->conf_shadow->valid = conf != NULL;
+    eps_shm_pub_conf(dev->shm, conf, eps_now_ns());
+    pthread_mutex_unlock(&dev->conf_shadow->m);
+}
+
+void eps_dev_conf_invalidate(eps_dev_t *dev)
+{
+    if (dev != NULL)
+        eps_conf_shadow_store(dev, NULL);
+}
+
+void eps_conf_invalidate()
+{
+    eps_dev_conf_invalidate(eps_dev_at(0));
+}
+
+// Executes one command on the bus. Only ever called from the worker of dev's bus.
+static int eps_cmd_run(eps_dev_t *dev, eps_cmd_t *cmd)
+{
+    int ret;
+    switch (cmd->op)
+    {
+    case EPS_OP_PING:
+        return eps_p31u_ping(dev->p31u);
+    case EPS_OP_REBOOT:
+        eps_conf_shadow_store(dev, NULL);
+        ret = eps_p31u_reboot(dev->p31u);
+        dev->t_out_switched = eps_now_ns();
+        return ret;
+    case EPS_OP_GET_HK:
+        return eps_p31u_get_hk(dev->p31u, (hkparam_t *)cmd->data);
+    case EPS_OP_GET_HK_OUT:
+        return eps_p31u_get_hk_out(dev->p31u, (eps_hk_out_t *)cmd->data);
+    case EPS_OP_TGL_LUP:
+        ret = eps_p31u_tgl_lup(dev->p31u, (eps_lup_idx)cmd->arg[0]);
+        // cached output state sampled before now must not be used by a mask switch
+        dev->t_out_switched = eps_now_ns();
+        return ret;
+    case EPS_OP_LUP_SET:
+        ret = eps_p31u_lup_set(dev->p31u, (eps_lup_idx)cmd->arg[0], cmd->arg[1]);
+        dev->t_out_switched = eps_now_ns();
+        return ret;
+    case EPS_OP_GET_CONF:
+        ret = eps_p31u_get_conf(dev->p31u, (eps_config_t *)cmd->data);
+        eps_conf_shadow_store(dev, ret < 0 ? NULL : cmd->data);
+        return ret;
+    case EPS_OP_SET_CONF:
+        ret = eps_p31u_set_conf(dev->p31u, (eps_config_t *)cmd->data);
+        // after a failed write the device may hold either configuration
+        eps_conf_shadow_store(dev, ret < 0 ? NULL : cmd->data);
+        return ret;
+    case EPS_OP_HARDRESET:
+        eps_conf_shadow_store(dev, NULL);
+        ret = eps_p31u_hardreset(dev->p31u);
+        dev->t_out_switched = eps_now_ns();
+        return ret;
+    case EPS_OP_RESET_WDT:
+        return eps_reset_wdt(dev->p31u);
+    case EPS_OP_GET_HK_RAW:
+        return eps_hk_raw_run(dev, (eps_hk_raw_t *)cmd->data, cmd->arg[0]);
+    case EPS_OP_LUP_MASK:
+        return eps_lup_mask_run(dev, cmd->arg[0], cmd->arg[1]);
+    case EPS_OP_POLL:
+        return eps_poll_run(dev, cmd->arg[0], (eps_hk_view_t *)cmd->data);
+    default:
+        return -EINVAL;
+    }
+}
+
+/**
+ * @brief Retry policy of an operation.
+ *
+ */
+typedef struct
+{
+    int retries;          // attempts after the first
+    unsigned deadline_ms; // from submission, at most EPS_CMD_TIMEOUT seconds
+} eps_op_policy;
+
+// Housekeeping is useless once the next poll is due, so it gives up early;
+// commands that change state wait longer. Toggles, reboots and hard resets
+// are not idempotent: a lost reply may hide a completed command.
+static const eps_op_policy eps_op_policies[EPS_OP_MAX] = {
+    [EPS_OP_PING] = {3, 1000},
+    [EPS_OP_REBOOT] = {0, EPS_CMD_TIMEOUT * 1000},
+    [EPS_OP_GET_HK] = {3, 1000},
+    [EPS_OP_GET_HK_OUT] = {3, 1000},
+    [EPS_OP_TGL_LUP] = {0, 2000},
+    [EPS_OP_LUP_SET] = {4, 2000},
+    [EPS_OP_GET_CONF] = {3, 2000},
+    [EPS_OP_SET_CONF] = {4, 2000},
+    [EPS_OP_HARDRESET] = {0, EPS_CMD_TIMEOUT * 1000},
+    [EPS_OP_RESET_WDT] = {4, EPS_WDT_PERIOD_MS},
+    [EPS_OP_LUP_MASK] = {4, 2000},
+    [EPS_OP_GET_HK_RAW] = {3, 1000},
+    [EPS_OP_POLL] = {3, 1000},
+};
+
+static inline eps_op_policy eps_op_policy_of(eps_op op)
+{
+    if ((unsigned)op >= EPS_OP_MAX)
+        return (eps_op_policy){0, EPS_CMD_TIMEOUT * 1000};
+    return eps_op_policies[op];
+}
+
 /**
-  * @brief The EPS object pointer.
-  *
-  */
-static p31u eps[1];
+ * @brief Executes a command, retrying bus failures with exponential backoff
+ * while the policy and the deadline allow.
+ *
+ * Before each retry the queue is checked for a command of a more urgent
+ * class; if there is one, the retries are deferred to let it go first.
+ *
+ * @param attempts Number of attempts made so far, updated.
+ * @param deferred Set to 1 if the command stepped aside with retries left.
+ * @return int Result of the last attempt.
+ */
+static int eps_cmd_run_retry(eps_cmdq_t *q, eps_dev_t *dev, eps_cmd_t *cmd, eps_prio prio, uint64_t deadline, int *attempts, int *deferred)
+{
+    int retries = eps_op_policy_of(cmd->op).retries;
+    unsigned backoff_us = EPS_RETRY_BACKOFF_US;
+    for (int n = 1; n < *attempts; n++)
+        backoff_us = backoff_us * 2 > EPS_RETRY_BACKOFF_MAX_US ? EPS_RETRY_BACKOFF_MAX_US : backoff_us * 2;
+    *deferred = 0;
+    for (int n = *attempts;; n++)
+    {
+        // shared with the watchdog kicker, which may be real-time; not held across the backoff
+        int ret = eps_i2c_bus_lock(dev->bus_id);
+        if (ret > 0)
+        {
+            ret = eps_cmd_run(dev, cmd);
+            eps_i2c_bus_unlock(dev->bus_id);
+        }
+        *attempts = n + 1;
+        if (ret >= 0 || ret == -EINVAL || n >= retries)
+            return ret;
+        pthread_mutex_lock(&q->m);
+        *deferred = eps_cmdq_urgent(q, prio);
+        pthread_mutex_unlock(&q->m);
+        if (*deferred)
+            return ret;
+        uint64_t wake = eps_now_ns() + backoff_us * 1000ULL;
+        if (wake >= deadline)
+            return ret;
+        struct timespec ts = {.tv_sec = wake / 1000000000ULL, .tv_nsec = wake % 1000000000ULL};
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+            ;
+        backoff_us = backoff_us * 2 > EPS_RETRY_BACKOFF_MAX_US ? EPS_RETRY_BACKOFF_MAX_US : backoff_us * 2;
+    }
+}
+
+/**
+ * @brief Counts the outcome of a command.
+ *
+ * @return int 1 if the bus has failed often enough in a row to be reset.
+ * Called with q->m held.
+ */
+static int eps_cmd_account(eps_cmdq_t *q, eps_dev_t *dev, int ret, int attempts)
+{
+    dev->retry->retries += attempts - 1;
+    if (ret >= 0)
+    {
+        if (attempts > 1)
+            dev->retry->ok_retried++;
+        else
+            dev->retry->ok++;
+        q->fail_streak = 0;
+        return 0;
+    }
+    if (ret == -EINVAL)
+    {
+        dev->retry->rejected++;
+        return 0;
+    }
+    dev->retry->failed++;
+    if (++q->fail_streak < EPS_BUS_RESET_AFTER)
+        return 0;
+    q->fail_streak = 0;
+    return 1;
+}
+
+// Reopens the handles of every device on a bus. Only ever called from the worker of the bus.
+static void eps_bus_reset(eps_cmdq_t *q)
+{
+    for (int i = 0; i < eps_ndevs; i++)
+    {
+        eps_dev_t *dev = &eps_devs[i];
+        if (dev->q != q)
+            continue;
+        // one handle at a time, so the device is never left without an open handle
+        eps_p31u_destroy(dev->p31u);
+        int ret = eps_p31u_init(dev->p31u, dev->bus_id, dev->addr);
+        i2cbus_close(dev->bus);
+        if (ret <= 0 || i2cbus_open(dev->bus, dev->bus_id, dev->addr) < 0)
+            fprintf(stderr, "eps: reopening %s (bus %d, 0x%02x) failed\n", dev->name, dev->bus_id, dev->addr);
+        pthread_mutex_lock(&q->m);
+        dev->retry->bus_resets++;
+        pthread_mutex_unlock(&q->m);
+    }
+}
+
+int eps_dev_retry_stats_get(eps_dev_t *dev, eps_retry_stats_t *st)
+{
+    if (st == NULL)
+    {
+        return -EINVAL;
+    }
+    if (dev == NULL)
+    {
+        return -ENODEV;
+    }
+    pthread_mutex_lock(&dev->q->m);
+    *st = *dev->retry;
+    pthread_mutex_unlock(&dev->q->m);
+    return 1;
+}
+
+int eps_retry_stats_get(eps_retry_stats_t *st)
+{
+    return eps_dev_retry_stats_get(eps_dev_at(0), st);
+}
+
+int eps_dev_dispatch_stats_get(eps_dev_t *dev, eps_prio prio, eps_dispatch_stats_t *st)
+{
+    if (st == NULL || prio < 0 || prio >= EPS_PRIO_MAX)
+    {
+        return -EINVAL;
+    }
+    if (dev == NULL)
+    {
+        return -ENODEV;
+    }
+    pthread_mutex_lock(&dev->q->m);
+    const eps_cmd_fifo *f = &dev->q->fifo[prio];
+    st->dispatched = f->dispatched;
+    st->preempted = f->preempted;
+    st->mean_ns = f->dispatched ? f->wait_sum_ns / f->dispatched : 0;
+    st->max_ns = f->wait_max_ns;
+    pthread_mutex_unlock(&dev->q->m);
+    return 1;
+}
+
+int eps_dispatch_stats_get(eps_prio prio, eps_dispatch_stats_t *st)
+{
+    return eps_dev_dispatch_stats_get(eps_dev_at(0), prio, st);
+}
+
+int eps_dev_agg_get(eps_dev_t *dev, eps_agg_ch ch, eps_agg_stat_t *st)
+{
+    if (st == NULL || ch < 0 || ch >= EPS_AGG_CH_MAX)
+    {
+        return -EINVAL;
+    }
+    if (dev == NULL)
+    {
+        return -ENODEV;
+    }
+    return eps_agg_read(dev->agg, ch, st);
+}
+
+int eps_agg_get(eps_agg_ch ch, eps_agg_stat_t *st)
+{
+    return eps_dev_agg_get(eps_dev_at(0), ch, st);
+}
+
+int eps_dev_agg_energy_get(eps_dev_t *dev, eps_agg_energy_t *en)
+{
+    if (en == NULL)
+    {
+        return -EINVAL;
+    }
+    if (dev == NULL)
+    {
+        return -ENODEV;
+    }
+    eps_agg_read_energy(dev->agg, en);
+    return 1;
+}
+
+int eps_agg_energy_get(eps_agg_energy_t *en)
+{
+    return eps_dev_agg_energy_get(eps_dev_at(0), en);
+}
+
+int eps_dev_cmd_exec(eps_dev_t *dev, const eps_cmd_t *cmd)
+{
+    if (dev == NULL)
+    {
+        eps_stats_record(cmd->op, -ENODEV, 0);
+        return -ENODEV;
+    }
+    if (!eps_cmd_wait_init)
+    {
+        pthread_condattr_t attr;
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(eps_cmd_wait, &attr);
+        pthread_condattr_destroy(&attr);
+        eps_cmd_wait_init = 1;
+    }
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += EPS_CMD_TIMEOUT;
+
+    eps_cmdq_t *q = dev->q;
+    uint64_t t0 = eps_now_ns();
+    pthread_mutex_lock(&q->m);
+    int idx = eps_cmdq_push(q, dev, cmd, eps_cmd_wait, -1);
+    if (idx < 0)
+    {
+        pthread_mutex_unlock(&q->m);
+        eps_stats_record(cmd->op, idx, eps_now_ns() - t0);
+        return idx;
+    }
+    eps_cmd_slot *slot = &q->slot[idx];
+    int ret;
+    while (slot->state == EPS_SLOT_QUEUED || slot->state == EPS_SLOT_RUNNING)
+    {
+        if (slot->state == EPS_SLOT_RUNNING)
+            // a transaction on the bus can not be recalled, wait for it
+            pthread_cond_wait(eps_cmd_wait, &q->m);
+        else if (pthread_cond_timedwait(eps_cmd_wait, &q->m, &deadline) == ETIMEDOUT &&
+                 slot->state == EPS_SLOT_QUEUED)
+            slot->state = EPS_SLOT_CANCELLED;
+    }
+    if (slot->state == EPS_SLOT_CANCELLED) // released by the worker
+        ret = -ETIMEDOUT;
+    else
+    {
+        ret = slot->ret;
+        slot->state = EPS_SLOT_FREE;
+    }
+    pthread_mutex_unlock(&q->m);
+    eps_stats_record(cmd->op, ret, eps_now_ns() - t0);
+    return ret;
+}
+
+int eps_cmd_exec(const eps_cmd_t *cmd)
+{
+    return eps_dev_cmd_exec(eps_dev_at(0), cmd);
+}
+
+int eps_dev_cmd_submit(eps_dev_t *dev, const eps_cmd_t *cmd)
+{
+    return eps_dev_cmd_submit_fd(dev, cmd, -1);
+}
 
-int eps_ping()
+int eps_dev_cmd_submit_fd(eps_dev_t *dev, const eps_cmd_t *cmd, int efd)
 {
-    if (eps == NULL)
+    if (dev == NULL)
     {
-        return -1;
+        eps_stats_record(cmd->op, -ENODEV, 0);
+        return -ENODEV;
     }
+    eps_cmdq_t *q = dev->q;
+    pthread_mutex_lock(&q->m);
+    int idx = eps_cmdq_push(q, dev, cmd, NULL, efd);
+    int ticket = idx < 0 ? idx : eps_cmd_ticket(q, idx);
+    pthread_mutex_unlock(&q->m);
+    // accepted commands are recorded when their result is collected
+    if (ticket < 0)
+        eps_stats_record(cmd->op, ticket, 0);
+    return ticket;
+}
 
-    return eps_p31u_ping(eps);
+int eps_cmd_submit(const eps_cmd_t *cmd)
+{
+    return eps_dev_cmd_submit(eps_dev_at(0), cmd);
 }
 
-int eps_reboot()
+int eps_cmd_poll(int ticket, int *ret)
 {
-    if (eps == NULL)
+    eps_cmdq_t *q = eps_cmd_queue_of(ticket);
+    if (q == NULL)
+        return -EINVAL;
+    int status = 0;
+    pthread_mutex_lock(&q->m);
+    int idx = eps_cmd_slot_of(q, ticket);
+    if (idx < 0)
+        status = -EINVAL;
+    else if (q->slot[idx].state == EPS_SLOT_DONE)
     {
-        return -1;
+        eps_cmd_slot *slot = &q->slot[idx];
+        if (ret != NULL)
+            *ret = slot->ret;
+        eps_stats_record(slot->cmd.op, slot->ret, slot->t_done - slot->t_submit);
+        slot->state = EPS_SLOT_FREE;
+        status = 1;
     }
+    pthread_mutex_unlock(&q->m);
+    return status;
+}
 
-    return eps_p31u_reboot(eps);
+int eps_cmd_cancel(int ticket)
+{
+    eps_cmdq_t *q = eps_cmd_queue_of(ticket);
+    if (q == NULL)
+        return -EINVAL;
+    int ret = 0;
+    pthread_mutex_lock(&q->m);
+    int idx = eps_cmd_slot_of(q, ticket);
+    if (idx < 0)
+        ret = -EINVAL;
+    else if (q->slot[idx].state == EPS_SLOT_QUEUED)
+        q->slot[idx].state = EPS_SLOT_CANCELLED;
+    else if (q->slot[idx].state == EPS_SLOT_RUNNING)
+        q->slot[idx].state = EPS_SLOT_ABANDONED;
+    else
+        q->slot[idx].state = EPS_SLOT_FREE;
+    pthread_mutex_unlock(&q->m);
+    return ret;
 }
 
-int eps_get_hk(hkparam_t *hk)
+// Executes the commands of one bus until shutdown.
+static void eps_cmdq_serve(eps_cmdq_t *q)
 {
-    if (eps == NULL)
+    pthread_mutex_lock(&q->m);
+    while (!done)
     {
-        return -1;
+        if (q->count == 0)
+        {
+            // SIGINT wakes us through wakeups[], the timeout covers other exits
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_sec += EPS_LOOP_TIMER;
+            pthread_cond_timedwait(q->cond, &q->m, &ts);
+            continue;
+        }
+        int idx = eps_cmdq_pop(q);
+        eps_cmd_slot *slot = &q->slot[idx];
+        eps_cmd_fifo *f = &q->fifo[slot->prio];
+        if (slot->state == EPS_SLOT_CANCELLED)
+        {
+            slot->state = EPS_SLOT_FREE;
+            continue;
+        }
+        uint64_t now = eps_now_ns();
+        uint64_t deadline = slot->t_submit + eps_op_policy_of(slot->cmd.op).deadline_ms * 1000000ULL;
+        if (now >= deadline) // stale, do not spend the bus on it
+        {
+            slot->dev->retry->expired++;
+            eps_cmd_slot_complete(slot, -ETIMEDOUT);
+            continue;
+        }
+        if (slot->attempts == 0)
+        {
+            f->dispatched++;
+            f->wait_sum_ns += now - slot->t_submit;
+            if (now - slot->t_submit > f->wait_max_ns)
+                f->wait_max_ns = now - slot->t_submit;
+        }
+        slot->state = EPS_SLOT_RUNNING;
+        eps_cmd_t cmd = slot->cmd;
+        eps_dev_t *dev = slot->dev;
+        int attempts = slot->attempts, deferred = 0;
+        pthread_mutex_unlock(&q->m);
+        int ret = eps_cmd_run_retry(q, dev, &cmd, slot->prio, deadline, &attempts, &deferred);
+        pthread_mutex_lock(&q->m);
+        if (deferred && slot->state == EPS_SLOT_RUNNING)
+        {
+            // back to the front of its class, it retries once the urgent ones are done
+            f->preempted++;
+            slot->attempts = attempts;
+            slot->state = EPS_SLOT_QUEUED;
+            eps_cmd_fifo_push_front(f, idx);
+            q->count++;
+            continue;
+        }
+        int reset = eps_cmd_account(q, dev, ret, attempts);
+        if (slot->state == EPS_SLOT_ABANDONED)
+            slot->state = EPS_SLOT_FREE;
+        else
+            eps_cmd_slot_complete(slot, ret);
+        if (reset)
+        {
+            pthread_mutex_unlock(&q->m);
+            eps_bus_reset(q);
+            pthread_mutex_lock(&q->m);
+        }
+    }
+    // Fail everything still queued and refuse new commands.
+    q->closed = 1;
+    while (q->count > 0)
+    {
+        eps_cmd_slot *slot = &q->slot[eps_cmdq_pop(q)];
+        if (slot->state == EPS_SLOT_CANCELLED)
+        {
+            slot->state = EPS_SLOT_FREE;
+            continue;
+        }
+        eps_cmd_slot_complete(slot, -ECANCELED);
+    }
+    pthread_mutex_unlock(&q->m);
+}
+
+static void *eps_cmdq_worker(void *q)
+{
+    eps_cmdq_serve((eps_cmdq_t *)q);
+    return NULL;
+}
+
+void *eps_cmd_thread(void *tid)
+{
+    // One worker per bus, so that devices on different buses run in parallel;
+    // this thread serves the first bus itself.
+    pthread_t workers[EPS_BUS_MAX];
+    int started[EPS_BUS_MAX] = {0};
+    for (int i = 1; i < eps_nqueues; i++)
+        started[i] = pthread_create(&workers[i], NULL, eps_cmdq_worker, &eps_cmdqs[i]) == 0;
+    if (eps_nqueues > 0)
+        eps_cmdq_serve(&eps_cmdqs[0]);
+    for (int i = 1; i < eps_nqueues; i++)
+    {
+        if (!started[i])
+            continue;
+        pthread_mutex_lock(&eps_cmdqs[i].m);
+        pthread_cond_broadcast(eps_cmdqs[i].cond);
+        pthread_mutex_unlock(&eps_cmdqs[i].m);
+        pthread_join(workers[i], NULL);
+    }
+    pthread_exit(NULL);
+}
+
+// Copies the cached field sets out; returns the timestamp of the oldest
+// requested set, 0 if one of them has never been stored.
+static uint64_t eps_hk_cache_read(eps_dev_t *dev, uint32_t sets, eps_hk_view_t *view)
+{
+    const eps_hk_view_t *v = &dev->hk_cache->v;
+    unsigned s1, s2;
+    uint64_t ts;
+    do
+    {
+        while ((s1 = atomic_load_explicit(&dev->hk_cache->seq, memory_order_acquire)) & 1)
+            ;
+        ts = UINT64_MAX;
+        for (int i = 0; i < (int)EPS_HK_NSETS; i++)
+        {
+            if (!(sets & eps_hk_sets[i].set))
+                continue;
+            memcpy((uint8_t *)view + eps_hk_sets[i].ofs, (const uint8_t *)v + eps_hk_sets[i].ofs, eps_hk_sets[i].size);
+            uint64_t t = *eps_hk_view_ts((eps_hk_view_t *)v, i);
+            *eps_hk_view_ts(view, i) = t;
+            if (t < ts)
+                ts = t;
+        }
+        atomic_thread_fence(memory_order_acquire);
+        s2 = atomic_load_explicit(&dev->hk_cache->seq, memory_order_relaxed);
+    } while (s1 != s2);
+    return ts;
+}
+
+// Stores the given field sets of a sample. Called with dev->hk_cache_m held.
+static void eps_hk_cache_write(eps_dev_t *dev, uint32_t sets, const eps_hk_view_t *view, uint64_t tstamp)
+{
+    eps_hk_view_t *v = &dev->hk_cache->v;
+    unsigned s = atomic_load_explicit(&dev->hk_cache->seq, memory_order_relaxed);
+    atomic_store_explicit(&dev->hk_cache->seq, s + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    for (int i = 0; i < (int)EPS_HK_NSETS; i++)
+    {
+        if (!(sets & eps_hk_sets[i].set))
+            continue;
+        memcpy((uint8_t *)v + eps_hk_sets[i].ofs, (const uint8_t *)view + eps_hk_sets[i].ofs, eps_hk_sets[i].size);
+        *eps_hk_view_ts(v, i) = tstamp;
+    }
+    atomic_store_explicit(&dev->hk_cache->seq, s + 2, memory_order_release);
+}
+
+/**
+ * @brief Publishes the field sets of a housekeeping pass sampled at now.
+ *
+ * hkparam_t and eps_hk_out_t also go to the log, shared memory, statistics
+ * and subscribers; the other sets only to the cache. The timestamps of the
+ * published sets in v are set to now.
+ *
+ */
+static void eps_hk_publish(eps_dev_t *dev, int polled, eps_hk_view_t *v, uint64_t now)
+{
+    const hkparam_t *hkp = (polled & EPS_HK_LEGACY) ? &v->hk : NULL;
+    const eps_hk_out_t *outp = (polled & EPS_HK_OUT) ? &v->hk_out : NULL;
+    if (!(polled & EPS_HK_ALL))
+        return;
+    pthread_mutex_lock(dev->hk_cache_m);
+    eps_hk_cache_write(dev, polled & EPS_HK_ALL, v, now);
+    for (int i = 0; i < (int)EPS_HK_NSETS; i++)
+        if (polled & eps_hk_sets[i].set)
+            *eps_hk_view_ts(v, i) = now;
+    if (hkp != NULL || outp != NULL)
+    {
+        eps_log_append(dev->log, hkp, outp, now);
+        eps_shm_pub_hk(dev->shm, hkp, outp, now);
+        eps_agg_update(dev->agg, hkp, outp, now);
+    }
+    pthread_mutex_unlock(dev->hk_cache_m);
+    // outside the cache lock: waking subscribers takes their mutexes
+    if (hkp != NULL || outp != NULL)
+        eps_sub_notify(dev->idx, hkp, outp);
+}
+
+/**
+ * @brief Polls the requested housekeeping field sets from the bus in one
+ * pass and publishes them, skipping sets already younger than max_age_ns.
+ * Blocks until the command worker has run the pass; the cache is not
+ * locked meanwhile, so concurrent callers may both poll.
+ *
+ * @param dev Device to poll.
+ * @param parts EPS_HK_* sets.
+ * @param max_age_ns Age below which a cached set is not polled again.
+ * @param res Receives the sets polled, may be NULL.
+ * @return int Mask of parts done on success, negative on bus error.
+ */
+static int eps_hk_refresh(eps_dev_t *dev, int parts, uint64_t max_age_ns, eps_hk_view_t *res)
+{
+    eps_hk_view_t scratch;
+    eps_hk_view_t *v = res != NULL ? res : &scratch;
+    // another caller may have refreshed since ours decided to
+    eps_hk_cache_read(dev, parts, v);
+    uint64_t now = eps_now_ns();
+    for (int i = 0; i < (int)EPS_HK_NSETS; i++)
+    {
+        uint64_t t = *eps_hk_view_ts(v, i);
+        if ((parts & eps_hk_sets[i].set) && t != 0 && now - t < max_age_ns)
+            parts &= ~eps_hk_sets[i].set;
+    }
+    if (parts == 0)
+        return 0;
+    eps_cmd_t cmd = {.op = EPS_OP_POLL, .arg = {parts}, .data = v};
+    int ret = eps_dev_cmd_exec(dev, &cmd);
+    if (ret < 0)
+        return ret;
+    eps_hk_publish(dev, parts, v, now);
+    return parts;
+}
+
+int eps_dev_hk_get_fields(eps_dev_t *dev, uint32_t fields, eps_hk_view_t *view, unsigned int max_age_ms)
+{
+    if (dev == NULL)
+    {
+        return -ENODEV;
+    }
+    if (view == NULL || fields == 0 || (fields & ~EPS_HK_ALL))
+    {
+        return -EINVAL;
+    }
+    eps_hk_cache_read(dev, fields, view);
+    uint64_t now = eps_now_ns();
+    uint64_t max_age_ns = max_age_ms * 1000000ULL;
+    uint32_t stale = 0;
+    for (int i = 0; i < (int)EPS_HK_NSETS; i++)
+    {
+        uint64_t t = *eps_hk_view_ts(view, i);
+        if ((fields & eps_hk_sets[i].set) && (t == 0 || (max_age_ms > 0 && now - t > max_age_ns)))
+            stale |= eps_hk_sets[i].set;
+    }
+    if (stale)
+    {
+        int ret = eps_hk_refresh(dev, stale, max_age_ns, NULL);
+        if (ret < 0)
+            return ret;
+        eps_hk_cache_read(dev, stale, view);
+    }
+    return 1;
+}
+
+int eps_hk_get_fields(uint32_t fields, eps_hk_view_t *view, unsigned int max_age_ms)
+{
+    return eps_dev_hk_get_fields(eps_dev_at(0), fields, view, max_age_ms);
+}
+
+int eps_dev_hk_snapshot(eps_dev_t *dev, hkparam_t *hk, eps_hk_out_t *hk_out, uint64_t *tstamp, unsigned int max_age_ms)
+{
+    eps_hk_view_t view;
+    uint32_t fields = (hk != NULL ? EPS_HK_LEGACY : 0) | (hk_out != NULL ? EPS_HK_OUT : 0);
+    int ret = fields ? eps_dev_hk_get_fields(dev, fields, &view, max_age_ms) : (dev != NULL ? 1 : -ENODEV);
+    if (ret < 0)
+        return ret;
+    uint64_t ts = UINT64_MAX;
+    if (hk != NULL)
+    {
+        memcpy(hk, &view.hk, sizeof(hkparam_t));
+        ts = view.t_hk;
     }
+    if (hk_out != NULL)
+    {
+        memcpy(hk_out, &view.hk_out, sizeof(eps_hk_out_t));
+        if (view.t_out < ts)
+            ts = view.t_out;
+    }
+    if (tstamp != NULL)
+        *tstamp = ts;
+    return 1;
+}
+
+int eps_hk_snapshot(hkparam_t *hk, eps_hk_out_t *hk_out, uint64_t *tstamp, unsigned int max_age_ms)
+{
+    return eps_dev_hk_snapshot(eps_dev_at(0), hk, hk_out, tstamp, max_age_ms);
+}
+
+int eps_dev_ping(eps_dev_t *dev)
+{
+    eps_cmd_t cmd = {.op = EPS_OP_PING};
+    return eps_dev_cmd_exec(dev, &cmd);
+}
+
+int eps_ping()
+{
+    return eps_dev_ping(eps_dev_at(0));
+}
+
+int eps_dev_reboot(eps_dev_t *dev)
+{
+    eps_cmd_t cmd = {.op = EPS_OP_REBOOT};
+    return eps_dev_cmd_exec(dev, &cmd);
+}
+
+int eps_reboot()
+{
+    return eps_dev_reboot(eps_dev_at(0));
+}
+
+int eps_dev_get_hk(eps_dev_t *dev, hkparam_t *hk)
+{
+    eps_cmd_t cmd = {.op = EPS_OP_GET_HK, .data = hk};
+    return eps_dev_cmd_exec(dev, &cmd);
+}
+
+int eps_get_hk(hkparam_t *hk)
+{
+    return eps_dev_get_hk(eps_dev_at(0), hk);
+}
 
-    return eps_p31u_get_hk(eps, hk);
+int eps_dev_get_hk_out(eps_dev_t *dev, eps_hk_out_t *hk_out)
+{
+    eps_cmd_t cmd = {.op = EPS_OP_GET_HK_OUT, .data = hk_out};
+    return eps_dev_cmd_exec(dev, &cmd);
 }
 
 int eps_get_hk_out(eps_hk_out_t *hk_out)
 {
-    if (eps == NULL)
+    return eps_dev_get_hk_out(eps_dev_at(0), hk_out);
+}
+
+int eps_dev_get_hk_raw(eps_dev_t *dev, eps_hk_raw_t *raw)
+{
+    if (raw == NULL)
     {
-        return -1;
+        eps_stats_record(EPS_OP_GET_HK_RAW, -EINVAL, 0);
+        return -EINVAL;
     }
 
-    return eps_p31u_get_hk_out(eps, hk_out);
+    eps_cmd_t cmd = {.op = EPS_OP_GET_HK_RAW, .arg = {P31U_HK_LEGACY}, .data = raw};
+    return eps_dev_cmd_exec(dev, &cmd);
 }
 
-int eps_tgl_lup(eps_lup_idx lup)
+int eps_get_hk_raw(eps_hk_raw_t *raw)
+{
+    return eps_dev_get_hk_raw(eps_dev_at(0), raw);
+}
+
+int eps_dev_get_hk_out_raw(eps_dev_t *dev, eps_hk_raw_t *raw)
 {
-    if (eps == NULL)
+    if (raw == NULL)
     {
-        return -1;
+        eps_stats_record(EPS_OP_GET_HK_RAW, -EINVAL, 0);
+        return -EINVAL;
     }
 
-    return eps_p31u_tgl_lup(eps, lup);
+    eps_cmd_t cmd = {.op = EPS_OP_GET_HK_RAW, .arg = {P31U_HK_OUT}, .data = raw};
+    return eps_dev_cmd_exec(dev, &cmd);
+}
+
+int eps_get_hk_out_raw(eps_hk_raw_t *raw)
+{
+    return eps_dev_get_hk_out_raw(eps_dev_at(0), raw);
+}
+
+int eps_dev_tgl_lup(eps_dev_t *dev, eps_lup_idx lup)
+{
+    eps_cmd_t cmd = {.op = EPS_OP_TGL_LUP, .arg = {lup}};
+    return eps_dev_cmd_exec(dev, &cmd);
+}
+
+int eps_tgl_lup(eps_lup_idx lup)
+{
+    return eps_dev_tgl_lup(eps_dev_at(0), lup);
+}
+
+int eps_dev_lup_set(eps_dev_t *dev, eps_lup_idx lup, int pw)
+{
+    eps_cmd_t cmd = {.op = EPS_OP_LUP_SET, .arg = {lup, pw}};
+    return eps_dev_cmd_exec(dev, &cmd);
 }
 
 int eps_lup_set(eps_lup_idx lup, int pw)
 {
-    if (eps == NULL)
+    return eps_dev_lup_set(eps_dev_at(0), lup, pw);
+}
+
+int eps_dev_lup_set_mask(eps_dev_t *dev, uint8_t on_mask, uint8_t off_mask)
+{
+    if (on_mask & off_mask)
     {
-        return -1;
+        eps_stats_record(EPS_OP_LUP_MASK, -EINVAL, 0);
+        return -EINVAL;
     }
 
-    return eps_p31u_lup_set(eps, lup, (int)pw);
+    eps_cmd_t cmd = {.op = EPS_OP_LUP_MASK, .arg = {on_mask, off_mask}};
+    return eps_dev_cmd_exec(dev, &cmd);
+}
+
+int eps_lup_set_mask(uint8_t on_mask, uint8_t off_mask)
+{
+    return eps_dev_lup_set_mask(eps_dev_at(0), on_mask, off_mask);
+}
+
+int eps_dev_hardreset(eps_dev_t *dev)
+{
+    eps_cmd_t cmd = {.op = EPS_OP_HARDRESET};
+    return eps_dev_cmd_exec(dev, &cmd);
 }
 
 int eps_hardreset()
 {
-    if (eps == NULL)
+    return eps_dev_hardreset(eps_dev_at(0));
+}
+
+/**
+ * @brief Fills the device table from EPS_DEVICES_ENV ("name@bus:addr,..."),
+ * or with the single default device if it is not set.
+ *
+ * @return int Number of devices, -1 on a malformed table.
+ */
+static int eps_dev_table_load()
+{
+    const char *env = getenv(EPS_DEVICES_ENV);
+    if (env == NULL || env[0] == '\0')
     {
-        return -1;
+        eps_dev_t *dev = &eps_devs[0];
+        snprintf(dev->name, sizeof(dev->name), "%s", EPS_DEV_DEFAULT_NAME);
+        dev->bus_id = EPS_I2C_BUS;
+        dev->addr = EPS_I2C_ADDR;
+        return 1;
     }
+    char table[256], *save = NULL;
+    snprintf(table, sizeof(table), "%s", env);
+    int n = 0;
+    for (char *ent = strtok_r(table, ",", &save); ent != NULL; ent = strtok_r(NULL, ",", &save))
+    {
+        char name[EPS_DEV_NAME_LEN];
+        int bus_id, addr, len = 0;
+        if (n == EPS_DEV_MAX || sscanf(ent, " %15[^@ ]@%i:%i%n", name, &bus_id, &addr, &len) != 3 ||
+            ent[len] != '\0' || addr < 0 || addr > 0x7f)
+        {
+            fprintf(stderr, "eps_init: bad %s entry '%s'\n", EPS_DEVICES_ENV, ent);
+            return -1;
+        }
+        for (int i = 0; i < n; i++)
+        {
+            if (!strcmp(eps_devs[i].name, name) || (eps_devs[i].bus_id == bus_id && eps_devs[i].addr == addr))
+            {
+                fprintf(stderr, "eps_init: duplicate %s entry '%s'\n", EPS_DEVICES_ENV, ent);
+                return -1;
+            }
+        }
+        snprintf(eps_devs[n].name, sizeof(eps_devs[n].name), "%s", name);
+        eps_devs[n].bus_id = bus_id;
+        eps_devs[n].addr = addr;
+        n++;
+    }
+    return n;
+}
 
-    return eps_p31u_hardreset(eps);
+// Returns the queue of a bus, creating it on first use.
+static eps_cmdq_t *eps_cmdq_get(int bus_id)
+{
+    for (int i = 0; i < eps_nqueues; i++)
+        if (eps_cmdqs[i].bus_id == bus_id)
+            return &eps_cmdqs[i];
+    if (eps_nqueues == EPS_BUS_MAX)
+        return NULL;
+    eps_cmdq_t *q = &eps_cmdqs[eps_nqueues];
+    memset(q, 0x0, sizeof(eps_cmdq_t));
+    pthread_mutex_init(&q->m, NULL);
+    pthread_cond_init(&q->own_cond, NULL);
+    // the first bus uses the condition listed in wakeups[]
+    q->cond = eps_nqueues == 0 ? eps_cmd_cond : &q->own_cond;
+    q->bus_id = bus_id;
+    eps_nqueues++;
+    return q;
 }
 
-// Initializes the EPS and ping-tests it.
-int eps_init()
+// Initializes one EPS and ping-tests it.
+static int eps_dev_init(eps_dev_t *dev, int idx)
 {
-    // Check if malloc was successful.
-    if (eps == NULL)
+    dev->idx = idx;
+    dev->t_out_switched = 0;
+    if ((dev->q = eps_cmdq_get(dev->bus_id)) == NULL)
     {
+        fprintf(stderr, "eps_init: more than %d buses\n", EPS_BUS_MAX);
         return -1;
     }
+    pthread_mutex_init(&dev->conf_shadow->m, NULL);
+    pthread_mutex_init(dev->hk_cache_m, NULL);
+    eps_agg_init(dev->agg);
 
     // Initializes the EPS component while checking if successful.
-    if (eps_p31u_init(eps, 1, 0x1b) <= 0)
+    if (eps_p31u_init(dev->p31u, dev->bus_id, dev->addr) <= 0)
+    {
+        return -1;
+    }
+
+    // Raw handle for commands not wrapped by the driver.
+    if (i2cbus_open(dev->bus, dev->bus_id, dev->addr) < 0)
     {
+        eps_p31u_destroy(dev->p31u);
         return -1;
     }
 
     // If we can't successfully ping the EPS then something has gone wrong.
-    if (eps_p31u_ping(eps) < 0)
+    if (eps_p31u_ping(dev->p31u) < 0)
     {
+        i2cbus_close(dev->bus);
+        eps_p31u_destroy(dev->p31u);
         return -2;
     }
+
+    // Housekeeping log for this boot; the EPS is usable without it.
+    char fname[64];
+    if (idx == 0)
+        snprintf(fname, sizeof(fname), EPS_LOG_FNAME, sys_boot_count);
+    else
+        snprintf(fname, sizeof(fname), EPS_LOG_FNAME_DEV, sys_boot_count, dev->name);
+    if (eps_log_open(dev->log, fname, EPS_LOG_RECORDS, sys_boot_count) < 0)
+    {
+        fprintf(stderr, "eps_init: housekeeping log %s unavailable\n", fname);
+    }
+    // Shared-memory publication for other processes; likewise optional.
+    if (eps_shm_pub_open(dev->shm, dev->name, sys_boot_count) < 0)
+    {
+        fprintf(stderr, "eps_init: shared memory " EPS_SHM_PREFIX "%s unavailable\n", dev->name);
+    }
+    return 1;
+}
+
+// Initializes every EPS in the device table.
+int eps_init()
+{
+    eps_nqueues = 0;
+    int n = eps_dev_table_load();
+    if (n < 0)
+    {
+        return -1;
+    }
+    for (int i = 0; i < n; i++)
+    {
+        int ret = eps_dev_init(&eps_devs[i], i);
+        if (ret < 0)
+        {
+            fprintf(stderr, "eps_init: %s (bus %d, 0x%02x) failed\n", eps_devs[i].name, eps_devs[i].bus_id, eps_devs[i].addr);
+            eps_destroy();
+            // no worker serves the queues, tickets and submissions must not reach them
+            eps_nqueues = 0;
+            return ret;
+        }
+        eps_ndevs = i + 1;
+    }
     return 1;
 }
 
+int eps_conf_shadow_get(eps_dev_t *dev, eps_config_t *conf)
+{
+    pthread_mutex_lock(&dev->conf_shadow->m);
+    int valid = dev->conf_shadow->valid;
+    if (valid)
+        memcpy(conf, &dev->conf_shadow->conf, sizeof(eps_config_t));
+    pthread_mutex_unlock(&dev->conf_shadow->m);
+    return valid;
+}
+
+int eps_dev_get_conf(eps_dev_t *dev, eps_config_t *conf)
+{
+    uint64_t t0 = eps_now_ns();
+    if (conf == NULL)
+    {
+        eps_stats_record(EPS_OP_GET_CONF, -EINVAL, 0);
+        return -EINVAL;
+    }
+    if (dev == NULL)
+    {
+        eps_stats_record(EPS_OP_GET_CONF, -ENODEV, 0);
+        return -ENODEV;
+    }
+
+    // Served from the shadow when it is known to match the device.
+    if (eps_conf_shadow_get(dev, conf))
+    {
+        eps_stats_record_local(EPS_OP_GET_CONF, 1, eps_now_ns() - t0);
+        return 1;
+    }
+
+    eps_cmd_t cmd = {.op = EPS_OP_GET_CONF, .data = conf};
+    return eps_dev_cmd_exec(dev, &cmd);
+}
+
 int eps_get_conf(eps_config_t *conf)
 {
-    return eps_p31u_get_conf(eps, conf);
+    return eps_dev_get_conf(eps_dev_at(0), conf);
+}
+
+int eps_conf_check(const eps_config_t *conf)
+{
+    if (conf->ppt_mode < 1 || conf->ppt_mode > 2)
+        return 0;
+    if (conf->battheater_mode > 1 || conf->battheater_low > conf->battheater_high)
+        return 0;
+    for (int i = 0; i < 8; i++)
+        if (conf->output_normal_value[i] > 1 || conf->output_safe_value[i] > 1)
+            return 0;
+    return 1;
+}
+
+int eps_dev_set_conf(eps_dev_t *dev, eps_config_t *conf)
+{
+    uint64_t t0 = eps_now_ns();
+    if (conf == NULL || !eps_conf_check(conf))
+    {
+        eps_stats_record(EPS_OP_SET_CONF, -EINVAL, 0);
+        return -EINVAL;
+    }
+    if (dev == NULL)
+    {
+        eps_stats_record(EPS_OP_SET_CONF, -ENODEV, 0);
+        return -ENODEV;
+    }
+
+    // Nothing to write if the device already holds this configuration.
+    pthread_mutex_lock(&dev->conf_shadow->m);
+    int same = dev->conf_shadow->valid && !memcmp(conf, &dev->conf_shadow->conf, sizeof(eps_config_t));
+    pthread_mutex_unlock(&dev->conf_shadow->m);
+    if (same)
+    {
+        eps_stats_record_local(EPS_OP_SET_CONF, 1, eps_now_ns() - t0);
+        return 1;
+    }
+
+    eps_cmd_t cmd = {.op = EPS_OP_SET_CONF, .data = conf};
+    return eps_dev_cmd_exec(dev, &cmd);
 }
 
 int eps_set_conf(eps_config_t *conf)
 {
-    return eps_p31u_set_conf(eps, conf);
+    return eps_dev_set_conf(eps_dev_at(0), conf);
+}
+
+/**
+ * @brief A periodic job of the housekeeping poller.
+ *
+ */
+typedef struct
+{
+    uint64_t next;   // absolute deadline, CLOCK_MONOTONIC ns
+    uint64_t period; // current period, ns
+    uint64_t min;    // fastest period, ns
+    uint64_t max;    // slowest period, ns
+} eps_task;
+
+static inline void eps_task_init(eps_task *task, uint64_t now, unsigned min_ms, unsigned max_ms)
+{
+    task->min = min_ms * 1000000ULL;
+    task->max = max_ms * 1000000ULL;
+    task->period = task->min;
+    task->next = now;
 }
 
-void *eps_thread(void *tid)
+// Advances the deadline by one period. Deadlines stay on the original grid so
+// that jitter does not accumulate; missed periods are skipped, not bunched up.
+static inline void eps_task_advance(eps_task *task, uint64_t now)
 {
-    while (!done)
+    task->next += task->period;
+    if (task->next <= now)
+        task->next = now + task->period;
+}
+
+// Drops to the fastest period on activity, backs off by half a period per
+// quiet sample.
+static inline void eps_task_adapt(eps_task *task, int active)
+{
+    if (active)
+        task->period = task->min;
+    else if (task->period < task->max)
     {
-        // Reset the watch-dog timer.
-        eps_reset_wdt(eps);
-        // add other things here
+        task->period += task->period / 2;
+        if (task->period > task->max)
+            task->period = task->max;
+    }
+}
+
+static inline int eps_absdiff(int a, int b)
+{
+    return a > b ? a - b : b - a;
+}
+
+// Whether hk changed fast enough since the previous sample to poll faster.
+static int eps_hk_active(const hkparam_t *prev, const hkparam_t *cur, uint64_t dt_ns)
+{
+    // slope in mV/s, compared without dividing; steps within the ADC noise
+    // floor are ignored since they turn into steep slopes at short periods
+    int dbv = eps_absdiff(cur->bv, prev->bv);
+    if (dbv > EPS_ADAPT_BV_NOISE && dbv * 1000000000ULL > EPS_ADAPT_BV_SLOPE * dt_ns)
+        return 1;
+    if (eps_absdiff(cur->sc, prev->sc) > EPS_ADAPT_CUR_STEP)
+        return 1;
+    for (int i = 0; i < 6; i++)
+        if (cur->latchup[i] != prev->latchup[i])
+            return 1;
+    return 0;
+}
+
+// Whether hk_out changed enough since the previous sample to poll faster.
+static int eps_hk_out_active(const eps_hk_out_t *prev, const eps_hk_out_t *cur)
+{
+    for (int i = 0; i < 6; i++)
+        if (cur->latchup[i] != prev->latchup[i] || eps_absdiff(cur->curout[i], prev->curout[i]) > EPS_ADAPT_CUR_STEP)
+            return 1;
+    return memcmp(cur->output, prev->output, sizeof(cur->output)) != 0;
+}
 
+/**
+ * @brief Polling state of one device.
+ *
+ */
+typedef struct
+{
+    eps_dev_t *dev;
+    eps_task hk_task, out_task;
+    hkparam_t hk[2];
+    eps_hk_out_t hk_out[2];
+    uint64_t hk_ts, out_ts;
+    int hk_cur, out_cur;
+    int ticket;        // EPS_OP_POLL in flight, -1 if none
+    int parts;         // sets it reads
+    uint64_t t_sample; // when it was submitted, the timestamp of its sample
+    eps_hk_view_t v;   // filled by the command worker
+    int conf_ticket;   // initial configuration read in flight, -1 if none
+    eps_config_t conf;
+} eps_poll_state;
 
-        sleep(EPS_LOOP_TIMER);
+// Submits the housekeeping jobs of one device that are due as one bus batch,
+// unless one is still in flight. A job due within EPS_POLL_SLACK_MS rides
+// along so that it does not cost a batch of its own shortly after.
+static void eps_poll_dev(eps_poll_state *st, uint64_t now, int efd)
+{
+    if (st->ticket >= 0)
+        return;
+    uint64_t due = now + EPS_POLL_SLACK_MS * 1000000ULL;
+    int parts = 0;
+    if (now >= st->hk_task.next || (st->hk_task.next <= due && now >= st->out_task.next))
+        parts |= EPS_HK_LEGACY;
+    if (now >= st->out_task.next || (st->out_task.next <= due && parts))
+        parts |= EPS_HK_OUT;
+    if (parts == 0)
+        return;
+    // The watchdog is kicked by eps_wdt_thread().
+    eps_cmd_t cmd = {.op = EPS_OP_POLL, .arg = {parts}, .data = &st->v};
+    st->parts = parts;
+    st->t_sample = now;
+    st->ticket = eps_dev_cmd_submit_fd(st->dev, &cmd, efd);
+    if (st->ticket < 0) // queue full, skip this period
+    {
+        if (parts & EPS_HK_LEGACY)
+            eps_task_advance(&st->hk_task, now);
+        if (parts & EPS_HK_OUT)
+            eps_task_advance(&st->out_task, now);
     }
+}
 
-    pthread_exit(NULL);
+// Publishes the result of a pass of one device and schedules its next jobs,
+// polling faster while housekeeping changes.
+static void eps_poll_complete(eps_poll_state *st, int ret)
+{
+    uint64_t now = st->t_sample;
+    int parts = st->parts;
+    if (ret >= 0)
+        eps_hk_publish(st->dev, parts, &st->v, now);
+    if (parts & EPS_HK_LEGACY)
+    {
+        if (ret >= 0)
+        {
+            st->hk[!st->hk_cur] = st->v.hk;
+            st->hk_cur = !st->hk_cur;
+            eps_task_adapt(&st->hk_task, st->hk_ts == 0 || eps_hk_active(&st->hk[!st->hk_cur], &st->hk[st->hk_cur], now - st->hk_ts));
+            st->hk_ts = now;
+        }
+        eps_task_advance(&st->hk_task, now);
+    }
+    if (parts & EPS_HK_OUT)
+    {
+        if (ret >= 0)
+        {
+            st->hk_out[!st->out_cur] = st->v.hk_out;
+            st->out_cur = !st->out_cur;
+            eps_task_adapt(&st->out_task, st->out_ts == 0 || eps_hk_out_active(&st->hk_out[!st->out_cur], &st->hk_out[st->out_cur]));
+            st->out_ts = now;
+        }
+        eps_task_advance(&st->out_task, now);
+    }
+}
+
+/**
+ * @brief Housekeeping poller of one bus, driven by a reactor timer. Passes
+ * are submitted to the command worker of the bus and completed through an
+ * eventfd, so the reactor never waits for the bus and the buses are polled
+ * in parallel.
+ *
+ */
+typedef struct
+{
+    int timer; // reactor timer, armed for the next due task
+    int efd;   // completion eventfd of the submitted commands
+    int started;
+    int n;
+    eps_poll_state st[EPS_DEV_MAX];
+} eps_poller;
+
+static eps_poller eps_pollers[EPS_BUS_MAX];
+static int eps_npollers = 0;
+
+// Submits the due passes of the devices on one bus and arms the timer for the
+// next one. Devices with a pass in flight are rescheduled when it completes.
+static void eps_poll_run_due(eps_poller *p)
+{
+    uint64_t now = eps_now_ns();
+    uint64_t next = UINT64_MAX;
+    for (int i = 0; i < p->n; i++)
+    {
+        eps_poll_dev(&p->st[i], now, p->efd);
+        if (p->st[i].ticket >= 0)
+            continue;
+        if (p->st[i].hk_task.next < next)
+            next = p->st[i].hk_task.next;
+        if (p->st[i].out_task.next < next)
+            next = p->st[i].out_task.next;
+    }
+    if (next != UINT64_MAX)
+        reactor_timer_at(p->timer, next);
+}
+
+static void eps_poll_bus(int fd, uint32_t events, void *arg)
+{
+    eps_poller *p = (eps_poller *)arg;
+    if (done)
+        return;
+    if (!p->started)
+    {
+        // the configuration is published once known; read it up front so
+        // shared-memory readers do not wait for the first get/set
+        for (int i = 0; i < p->n; i++)
+        {
+            eps_cmd_t cmd = {.op = EPS_OP_GET_CONF, .data = &p->st[i].conf};
+            p->st[i].conf_ticket = eps_dev_cmd_submit_fd(p->st[i].dev, &cmd, p->efd);
+        }
+        p->started = 1;
+    }
+    eps_poll_run_due(p);
+}
+
+// Collects the commands of one bus that have completed.
+static void eps_poll_done(int fd, uint32_t events, void *arg)
+{
+    eps_poller *p = (eps_poller *)arg;
+    uint64_t n;
+    if (read(fd, &n, sizeof(n)) != sizeof(n))
+        return;
+    for (int i = 0; i < p->n; i++)
+    {
+        eps_poll_state *st = &p->st[i];
+        int ret;
+        // the worker has stored the configuration in the shadow
+        if (st->conf_ticket >= 0 && eps_cmd_poll(st->conf_ticket, &ret) != 0)
+            st->conf_ticket = -1;
+        if (st->ticket < 0)
+            continue;
+        int status = eps_cmd_poll(st->ticket, &ret);
+        if (status == 0)
+            continue;
+        st->ticket = -1;
+        eps_poll_complete(st, status < 0 ? status : ret);
+    }
+    if (!done)
+        eps_poll_run_due(p);
+}
+
+int eps_register()
+{
+    // One timer per bus; polling starts once the reactor runs.
+    uint64_t now = eps_now_ns();
+    for (int b = 0; b < eps_nqueues; b++)
+    {
+        eps_poller *p = &eps_pollers[b];
+        memset(p, 0x0, sizeof(eps_poller));
+        p->efd = -1;
+        eps_npollers = b + 1;
+        for (int i = 0; i < eps_ndevs; i++)
+        {
+            if (eps_devs[i].q != &eps_cmdqs[b])
+                continue;
+            eps_poll_state *st = &p->st[p->n++];
+            st->dev = &eps_devs[i];
+            st->ticket = st->conf_ticket = -1;
+            eps_task_init(&st->hk_task, now, EPS_HK_PERIOD_MIN_MS, EPS_HK_PERIOD_MAX_MS);
+            eps_task_init(&st->out_task, now, EPS_HK_OUT_PERIOD_MIN_MS, EPS_HK_OUT_PERIOD_MAX_MS);
+        }
+        if ((p->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0 || reactor_add(p->efd, EPOLLIN, eps_poll_done, p) < 0 ||
+            (p->timer = reactor_timer(eps_poll_bus, p)) < 0 || reactor_timer_at(p->timer, now) < 0)
+        {
+            fprintf(stderr, "eps_register: poller for bus %d failed\n", eps_cmdqs[b].bus_id);
+            return -1;
+        }
+    }
+    return 1;
 }
 
-// Frees eps memory and destroys the EPS object.
+// Frees eps memory and destroys the EPS objects.
 void eps_destroy()
 {
     // Destroy / free the eps.
-    eps_p31u_destroy(eps);
+    for (int i = 0; i < eps_ndevs; i++)
+    {
+        eps_log_close(eps_devs[i].log);
+        eps_shm_pub_close(eps_devs[i].shm);
+        i2cbus_close(eps_devs[i].bus);
+        eps_p31u_destroy(eps_devs[i].p31u);
+    }
+    eps_ndevs = 0;
+    // the workers have exited, no completion is posted any more
+    for (int b = 0; b < eps_npollers; b++)
+    {
+        if (eps_pollers[b].efd >= 0)
+        {
+            reactor_del(eps_pollers[b].efd);
+            close(eps_pollers[b].efd);
+        }
+        eps_pollers[b].efd = -1;
+    }
+    eps_npollers = 0;
 }
@@ -0,0 +1,273 @@
+/**
+ * @file eps_agg.c
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Streaming statistics of the housekeeping channels: orbit-window
+ * minimum, maximum and mean, moving averages, and integrated energy and
+ * charge.
+ *
+ * The window is divided into EPS_AGG_BUCKET_S second buckets. A sample only
+ * touches the current bucket; when a bucket completes, its sum enters a ring
+ * and its extremes enter monotonic deques, and the bucket that leaves the
+ * window is subtracted or popped. Every update is thus O(1) amortized and the
+ * memory per channel is fixed, whatever the poll rate.
+ *
+ * @version 0.1
+ * @date 2021-04-15
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include "eps.h"
+#include <math.h>
+#include <string.h>
+#include <time.h>
+
+#define EPS_AGG_BUCKET_NS (EPS_AGG_BUCKET_S * 1000000000ULL)
+
+static const char *eps_agg_ch_names[EPS_AGG_CH_MAX] = {
+    [EPS_AGG_PV0] = "pv0",
+    [EPS_AGG_PV1] = "pv1",
+    [EPS_AGG_PV2] = "pv2",
+    [EPS_AGG_PC] = "pc",
+    [EPS_AGG_BV] = "bv",
+    [EPS_AGG_SC] = "sc",
+    [EPS_AGG_TEMP0] = "temp0",
+    [EPS_AGG_TEMP1] = "temp1",
+    [EPS_AGG_TEMP2] = "temp2",
+    [EPS_AGG_TEMP3] = "temp3",
+    [EPS_AGG_BATT_TEMP0] = "batt_temp0",
+    [EPS_AGG_BATT_TEMP1] = "batt_temp1",
+    [EPS_AGG_CUROUT0] = "curout0",
+    [EPS_AGG_CUROUT1] = "curout1",
+    [EPS_AGG_CUROUT2] = "curout2",
+    [EPS_AGG_CUROUT3] = "curout3",
+    [EPS_AGG_CUROUT4] = "curout4",
+    [EPS_AGG_CUROUT5] = "curout5",
+    [EPS_AGG_P_IN] = "p_in",
+    [EPS_AGG_P_OUT] = "p_out",
+};
+
+const char *eps_agg_ch_name(eps_agg_ch ch)
+{
+    if (ch < 0 || ch >= EPS_AGG_CH_MAX)
+        return "unknown";
+    return eps_agg_ch_names[ch];
+}
+
+void eps_agg_init(eps_agg_t *agg)
+{
+    memset(agg, 0x0, sizeof(eps_agg_t));
+    pthread_mutex_init(&agg->m, NULL);
+}
+
+// Appends a completed bucket to a monotonic deque, dropping the entries it
+// dominates: larger ones for the minimum (sign 1), smaller ones for the
+// maximum (sign -1).
+static inline void eps_agg_deque_push(eps_agg_ent_t *q, int head, int *len, uint32_t bucket, int32_t val, int sign)
+{
+    while (*len > 0 && sign * (int64_t)q[(head + *len - 1) % EPS_AGG_BUCKETS].val >= sign * (int64_t)val)
+        (*len)--;
+    q[(head + *len) % EPS_AGG_BUCKETS] = (eps_agg_ent_t){.bucket = bucket, .val = val};
+    (*len)++;
+}
+
+static inline void eps_agg_deque_expire(const eps_agg_ent_t *q, int *head, int *len, uint32_t oldest)
+{
+    while (*len > 0 && q[*head].bucket < oldest)
+    {
+        *head = (*head + 1) % EPS_AGG_BUCKETS;
+        (*len)--;
+    }
+}
+
+static void eps_agg_chan_roll(eps_agg_chan_t *c, uint32_t first, uint32_t from, uint32_t b)
+{
+    for (uint32_t x = from; x < b; x++)
+    {
+        int slot = x % EPS_AGG_BUCKETS;
+        c->win_sum -= c->sum[slot];
+        c->win_n -= c->n[slot];
+        c->sum[slot] = x == first ? c->cur_sum : 0;
+        c->n[slot] = x == first ? c->cur_n : 0;
+        c->win_sum += c->sum[slot];
+        c->win_n += c->n[slot];
+    }
+    uint32_t oldest = b > EPS_AGG_BUCKETS ? b - EPS_AGG_BUCKETS : 0;
+    eps_agg_deque_expire(c->minq, &c->min_head, &c->min_len, oldest);
+    eps_agg_deque_expire(c->maxq, &c->max_head, &c->max_len, oldest);
+    if (c->cur_n > 0 && from == first)
+    {
+        eps_agg_deque_push(c->minq, c->min_head, &c->min_len, first, c->cur_min, 1);
+        eps_agg_deque_push(c->maxq, c->max_head, &c->max_len, first, c->cur_max, -1);
+    }
+    c->cur_sum = 0;
+    c->cur_n = 0;
+}
+
+static void eps_agg_integ_roll(eps_agg_integ_t *in, uint32_t first, uint32_t from, uint32_t b)
+{
+    for (uint32_t x = from; x < b; x++)
+    {
+        int slot = x % EPS_AGG_BUCKETS;
+        in->win -= in->ring[slot];
+        in->ring[slot] = x == first ? in->cur : 0;
+        in->win += in->ring[slot];
+    }
+    in->cur = 0;
+}
+
+// Completes the buckets before bucket b. Called with agg->m held.
+static void eps_agg_roll(eps_agg_t *agg, uint32_t b)
+{
+    uint32_t first = agg->bucket;
+    if (b <= first)
+        return;
+    // after a long gap only the last EPS_AGG_BUCKETS buckets can be in the window
+    uint32_t from = b - first > EPS_AGG_BUCKETS ? b - EPS_AGG_BUCKETS : first;
+    for (int i = 0; i < EPS_AGG_CH_MAX; i++)
+        eps_agg_chan_roll(&agg->ch[i], first, from, b);
+    eps_agg_integ_roll(&agg->e_in, first, from, b);
+    eps_agg_integ_roll(&agg->e_out, first, from, b);
+    for (int i = 0; i < 6; i++)
+        eps_agg_integ_roll(&agg->q_rail[i], first, from, b);
+    agg->bucket = b;
+}
+
+static void eps_agg_sample(eps_agg_chan_t *c, int32_t val, uint64_t t)
+{
+    if (c->t_last == 0)
+        c->ewma = val;
+    else
+        c->ewma += (val - c->ewma) * (1 - exp(-1e-9 * (t - c->t_last) / EPS_AGG_EWMA_TAU_S));
+    if (c->cur_n == 0 || val < c->cur_min)
+        c->cur_min = val;
+    if (c->cur_n == 0 || val > c->cur_max)
+        c->cur_max = val;
+    c->cur_sum += val;
+    c->cur_n++;
+    c->last = val;
+    c->t_last = t;
+    c->samples++;
+}
+
+// Integrates val * scale over the interval since the previous sample of c,
+// with the trapezoidal rule. Called before that sample is replaced.
+static void eps_agg_integrate(eps_agg_integ_t *in, const eps_agg_chan_t *c, int32_t val, uint64_t t, double scale)
+{
+    if (c->t_last == 0 || t <= c->t_last || t - c->t_last > EPS_AGG_GAP_S * 1000000000ULL)
+        return;
+    double amount = 0.5 * (c->last + val) * 1e-9 * (t - c->t_last) * scale;
+    in->cur += amount;
+    in->total += amount;
+}
+
+void eps_agg_update(eps_agg_t *agg, const hkparam_t *hk, const eps_hk_out_t *hk_out, uint64_t t_mono_ns)
+{
+    pthread_mutex_lock(&agg->m);
+    uint32_t b = t_mono_ns / EPS_AGG_BUCKET_NS;
+    if (agg->t_start == 0)
+    {
+        agg->t_start = t_mono_ns;
+        agg->bucket = b;
+    }
+    eps_agg_roll(agg, b);
+    if (hk != NULL)
+    {
+        int32_t p_in = (int32_t)((hk->pv[0] + hk->pv[1] + hk->pv[2]) / 3) * hk->pc / 1000;
+        int32_t p_out = (int32_t)hk->bv * hk->sc / 1000;
+        // mW * s = mJ
+        eps_agg_integrate(&agg->e_in, &agg->ch[EPS_AGG_P_IN], p_in, t_mono_ns, 1e-3);
+        eps_agg_integrate(&agg->e_out, &agg->ch[EPS_AGG_P_OUT], p_out, t_mono_ns, 1e-3);
+        for (int i = 0; i < 3; i++)
+            eps_agg_sample(&agg->ch[EPS_AGG_PV0 + i], hk->pv[i], t_mono_ns);
+        eps_agg_sample(&agg->ch[EPS_AGG_PC], hk->pc, t_mono_ns);
+        eps_agg_sample(&agg->ch[EPS_AGG_BV], hk->bv, t_mono_ns);
+        eps_agg_sample(&agg->ch[EPS_AGG_SC], hk->sc, t_mono_ns);
+        for (int i = 0; i < 4; i++)
+            eps_agg_sample(&agg->ch[EPS_AGG_TEMP0 + i], hk->temp[i], t_mono_ns);
+        for (int i = 0; i < 2; i++)
+            eps_agg_sample(&agg->ch[EPS_AGG_BATT_TEMP0 + i], hk->batt_temp[i], t_mono_ns);
+        eps_agg_sample(&agg->ch[EPS_AGG_P_IN], p_in, t_mono_ns);
+        eps_agg_sample(&agg->ch[EPS_AGG_P_OUT], p_out, t_mono_ns);
+    }
+    if (hk_out != NULL)
+    {
+        for (int i = 0; i < 6; i++)
+        {
+            // mA * s = mC
+            eps_agg_integrate(&agg->q_rail[i], &agg->ch[EPS_AGG_CUROUT0 + i], hk_out->curout[i], t_mono_ns, 1e-3);
+            eps_agg_sample(&agg->ch[EPS_AGG_CUROUT0 + i], hk_out->curout[i], t_mono_ns);
+        }
+    }
+    pthread_mutex_unlock(&agg->m);
+}
+
+static uint64_t eps_agg_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int eps_agg_read(eps_agg_t *agg, eps_agg_ch ch, eps_agg_stat_t *st)
+{
+    uint64_t now = eps_agg_now();
+    pthread_mutex_lock(&agg->m);
+    const eps_agg_chan_t *c = &agg->ch[ch];
+    if (c->samples == 0)
+    {
+        pthread_mutex_unlock(&agg->m);
+        memset(st, 0x0, sizeof(eps_agg_stat_t));
+        return 0;
+    }
+    eps_agg_roll(agg, now / EPS_AGG_BUCKET_NS);
+    st->samples = c->samples;
+    st->t_last = c->t_last;
+    st->last = c->last;
+    st->ewma = c->ewma;
+    // a channel not sampled for a whole window reports its last value
+    st->min = st->max = c->last;
+    st->mean = c->last;
+    int have = 0;
+    if (c->min_len > 0)
+    {
+        st->min = c->minq[c->min_head].val;
+        st->max = c->maxq[c->max_head].val;
+        have = 1;
+    }
+    if (c->cur_n > 0)
+    {
+        st->min = have && st->min < c->cur_min ? st->min : c->cur_min;
+        st->max = have && st->max > c->cur_max ? st->max : c->cur_max;
+    }
+    if (c->win_n + c->cur_n > 0)
+        st->mean = (double)(c->win_sum + c->cur_sum) / (c->win_n + c->cur_n);
+    pthread_mutex_unlock(&agg->m);
+    return 1;
+}
+
+void eps_agg_read_energy(eps_agg_t *agg, eps_agg_energy_t *en)
+{
+    uint64_t now = eps_agg_now();
+    memset(en, 0x0, sizeof(eps_agg_energy_t));
+    pthread_mutex_lock(&agg->m);
+    if (agg->t_start == 0)
+    {
+        pthread_mutex_unlock(&agg->m);
+        return;
+    }
+    eps_agg_roll(agg, now / EPS_AGG_BUCKET_NS);
+    uint64_t window_ns = EPS_AGG_BUCKETS * EPS_AGG_BUCKET_NS + now % EPS_AGG_BUCKET_NS;
+    en->window_ns = now - agg->t_start < window_ns ? now - agg->t_start : window_ns;
+    en->e_in_j = agg->e_in.win + agg->e_in.cur;
+    en->e_out_j = agg->e_out.win + agg->e_out.cur;
+    en->e_in_total_j = agg->e_in.total;
+    en->e_out_total_j = agg->e_out.total;
+    for (int i = 0; i < 6; i++)
+    {
+        en->q_rail_c[i] = agg->q_rail[i].win + agg->q_rail[i].cur;
+        en->q_rail_total_c[i] = agg->q_rail[i].total;
+    }
+    pthread_mutex_unlock(&agg->m);
+}
@@ -0,0 +1,181 @@
+/**
+ * @file eps_i2c.c
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Batches of P31u exchanges as chained ioctl(I2C_RDWR) calls, with a
+ * sequential fallback.
+ *
+ * @version 0.1
+ * @date 2021-04-15
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include "eps_i2c.h"
+#include "eps.h"
+#include "eps_proto.h"
+#include <errno.h>
+#include <linux/i2c-dev.h>
+#include <linux/i2c.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+__attribute__((weak)) int eps_i2c_backend_rdwr = 1;
+
+// Cleared for good once the adapter turns out not to support I2C_RDWR.
+static atomic_int eps_i2c_rdwr_ok = 1;
+
+/**
+ * @brief Bus locks, claimed in the order the buses are first locked. Entries
+ * below eps_i2c_nbuses are never changed, so lookups take no lock.
+ *
+ */
+static struct
+{
+    int id;
+    pthread_mutex_t m;
+} eps_i2c_buses[EPS_BUS_MAX];
+static atomic_int eps_i2c_nbuses = 0;
+static pthread_mutex_t eps_i2c_buses_m = PTHREAD_MUTEX_INITIALIZER; // serializes claims
+
+static pthread_mutex_t *eps_i2c_bus_find(int bus_id)
+{
+    int n = atomic_load_explicit(&eps_i2c_nbuses, memory_order_acquire);
+    for (int i = 0; i < n; i++)
+        if (eps_i2c_buses[i].id == bus_id)
+            return &eps_i2c_buses[i].m;
+    return NULL;
+}
+
+int eps_i2c_bus_lock(int bus_id)
+{
+    pthread_mutex_t *m = eps_i2c_bus_find(bus_id);
+    if (m == NULL)
+    {
+        // first use of the bus; later ones do not get here
+        pthread_mutex_lock(&eps_i2c_buses_m);
+        int n = atomic_load_explicit(&eps_i2c_nbuses, memory_order_relaxed);
+        if ((m = eps_i2c_bus_find(bus_id)) == NULL && n < EPS_BUS_MAX)
+        {
+            pthread_mutexattr_t attr;
+            pthread_mutexattr_init(&attr);
+            pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT);
+            eps_i2c_buses[n].id = bus_id;
+            pthread_mutex_init(&eps_i2c_buses[n].m, &attr);
+            pthread_mutexattr_destroy(&attr);
+            m = &eps_i2c_buses[n].m;
+            atomic_store_explicit(&eps_i2c_nbuses, n + 1, memory_order_release);
+        }
+        pthread_mutex_unlock(&eps_i2c_buses_m);
+        if (m == NULL)
+            return -ENOSPC;
+    }
+    pthread_mutex_lock(m);
+    return 1;
+}
+
+void eps_i2c_bus_unlock(int bus_id)
+{
+    pthread_mutex_t *m = eps_i2c_bus_find(bus_id);
+    if (m != NULL)
+        pthread_mutex_unlock(m);
+}
+
+// Whether the reply of an exchange, if it has one, echoes the command
+// without an error.
+static inline int eps_i2c_reply_ok(const eps_i2c_op_t *op)
+{
+    if (op->rbuf == NULL || op->rlen < P31U_REPLY_HDR_SZ)
+        return 1;
+    return op->rbuf[0] == op->wbuf[0] && op->rbuf[1] == 0;
+}
+
+int eps_i2c_batch_seq(i2cbus *bus, eps_i2c_op_t *ops, int n)
+{
+    int ret = 1, err = 0;
+    for (int i = 0; i < n; i++)
+    {
+        ops[i].ret = i2cbus_xfer(bus, (void *)ops[i].wbuf, ops[i].wlen, ops[i].rbuf, ops[i].rbuf == NULL ? 0 : ops[i].rlen, EPS_XFER_DELAY);
+        int op_err = errno;
+        if (ops[i].ret >= 0 && !eps_i2c_reply_ok(&ops[i]))
+        {
+            ops[i].ret = -1;
+            op_err = EIO;
+        }
+        if (ops[i].ret < 0 && ret > 0)
+        {
+            ret = -1;
+            err = op_err;
+        }
+    }
+    errno = err;
+    return ret;
+}
+
+// Runs the batch as chained I2C_RDWR calls with the bus lock held: each call
+// reads the pending reply, if any, and writes the next command. Returns 1 if
+// every call went through, -1 with errno set otherwise.
+static int eps_i2c_batch_rdwr(i2cbus *bus, eps_i2c_op_t *ops, int n)
+{
+    struct i2c_msg msgs[2];
+    int nmsgs = 0, ret = 1, err = 0;
+    if (i2cbus_lock(bus) < 0)
+    {
+        errno = EBADF;
+        return -1;
+    }
+    for (int i = 0; i <= n; i++)
+    {
+        if (i < n)
+            msgs[nmsgs++] = (struct i2c_msg){.addr = bus->addr, .flags = 0, .len = ops[i].wlen, .buf = (uint8_t *)ops[i].wbuf};
+        struct i2c_rdwr_ioctl_data rdwr = {.msgs = msgs, .nmsgs = nmsgs};
+        if (nmsgs > 0 && ioctl(bus->fd, I2C_RDWR, &rdwr) != nmsgs)
+        {
+            ret = -1;
+            err = errno;
+            break;
+        }
+        nmsgs = 0;
+        if (i == n || ops[i].rbuf == NULL || ops[i].rlen == 0)
+            continue;
+        // the P31u needs time between a command and its reply
+        usleep(EPS_XFER_DELAY);
+        msgs[nmsgs++] = (struct i2c_msg){.addr = bus->addr, .flags = I2C_M_RD, .len = ops[i].rlen, .buf = ops[i].rbuf};
+    }
+    i2cbus_unlock(bus);
+    errno = err;
+    return ret;
+}
+
+int eps_i2c_batch(i2cbus *bus, eps_i2c_op_t *ops, int n)
+{
+    if (n <= 0 || n > EPS_I2C_BATCH_MAX)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    if (n == 1 || !eps_i2c_backend_rdwr || !atomic_load_explicit(&eps_i2c_rdwr_ok, memory_order_relaxed))
+        return eps_i2c_batch_seq(bus, ops, n);
+    if (eps_i2c_batch_rdwr(bus, ops, n) < 0)
+    {
+        if (errno == ENOTTY || errno == EOPNOTSUPP || errno == ENOSYS)
+            atomic_store_explicit(&eps_i2c_rdwr_ok, 0, memory_order_relaxed);
+        // the adapter does not say which message failed; redo them one by one
+        return eps_i2c_batch_seq(bus, ops, n);
+    }
+    int ret = 1, err = 0;
+    for (int i = 0; i < n; i++)
+    {
+        ops[i].ret = ops[i].rbuf != NULL && ops[i].rlen > 0 ? ops[i].rlen : ops[i].wlen;
+        // a reply the EPS flagged gets one more try on its own
+        if (!eps_i2c_reply_ok(&ops[i]) && eps_i2c_batch_seq(bus, &ops[i], 1) < 0 && ret > 0)
+        {
+            ret = -1;
+            err = errno;
+        }
+    }
+    errno = err;
+    return ret;
+}
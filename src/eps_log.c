@@ -0,0 +1,130 @@
+/**
+ * @file eps_log.c
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Housekeeping recorder: appends samples to a memory-mapped ring file.
+ *
+ * The file is preallocated and mapped shared once, so appending a record is a
+ * plain memory copy: no allocation, no system call, and the data survives a
+ * crash of the process as soon as it is in the page cache. Dirty pages are
+ * scheduled for write-back every EPS_LOG_SYNC_EVERY records.
+ *
+ * @version 0.1
+ * @date 2021-04-15
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include "eps.h"
+#include "eps_log.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+static inline eps_log_rec_t *eps_log_slot(eps_log_t *log, uint64_t seq)
+{
+    return (eps_log_rec_t *)(log->map + EPS_LOG_HDR_SZ) + (seq - 1) % log->capacity;
+}
+
+int eps_log_open(eps_log_t *log, const char *fname, uint32_t capacity, int boot_count)
+{
+    if (log->map != NULL || capacity == 0)
+        return -1;
+    size_t len = EPS_LOG_HDR_SZ + (size_t)capacity * EPS_LOG_REC_SZ;
+    int fd = open(fname, O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+    {
+        perror("eps_log_open");
+        return -1;
+    }
+    struct stat st;
+    int fresh = fstat(fd, &st) < 0 || (size_t)st.st_size != len;
+    // reserve the blocks now so that appending never fails for lack of space
+    int err = fresh ? posix_fallocate(fd, 0, len) : 0;
+    if (err)
+    {
+        fprintf(stderr, "eps_log_open: %s\n", strerror(err));
+        close(fd);
+        return -1;
+    }
+    uint8_t *map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        perror("eps_log_open");
+        close(fd);
+        return -1;
+    }
+    eps_log_hdr_t *hdr = (eps_log_hdr_t *)map;
+    if (fresh || hdr->magic != EPS_LOG_MAGIC || hdr->version != EPS_LOG_VERSION ||
+        hdr->rec_sz != EPS_LOG_REC_SZ || hdr->capacity != capacity)
+    {
+        memset(map, 0x0, len);
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        hdr->version = EPS_LOG_VERSION;
+        hdr->rec_sz = EPS_LOG_REC_SZ;
+        hdr->capacity = capacity;
+        hdr->boot_count = boot_count;
+        hdr->created_ns = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+        hdr->seq = 0;
+        hdr->magic = EPS_LOG_MAGIC;
+        msync(map, len, MS_ASYNC);
+    }
+    log->fd = fd;
+    log->map = map;
+    log->len = len;
+    log->hdr = hdr;
+    log->capacity = capacity;
+    log->boot_count = boot_count;
+    return 1;
+}
+
+void eps_log_append(eps_log_t *log, const hkparam_t *hk, const eps_hk_out_t *hk_out, uint64_t t_mono_ns)
+{
+    if (log->map == NULL)
+        return;
+    uint64_t seq = log->hdr->seq + 1;
+    eps_log_rec_t *rec = eps_log_slot(log, seq);
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    // invalidate, fill, then validate; a crash in between leaves seq == 0
+    __atomic_store_n(&rec->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    rec->t_mono_ns = t_mono_ns;
+    rec->t_real_ns = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    rec->boot_count = log->boot_count;
+    rec->flags = 0;
+    if (hk != NULL)
+    {
+        memcpy(&rec->hk, hk, sizeof(hkparam_t));
+        rec->flags |= EPS_LOG_HAS_HK;
+    }
+    if (hk_out != NULL)
+    {
+        memcpy(&rec->hk_out, hk_out, sizeof(eps_hk_out_t));
+        rec->flags |= EPS_LOG_HAS_HK_OUT;
+    }
+    __atomic_store_n(&rec->seq, seq, __ATOMIC_RELEASE);
+    __atomic_store_n(&log->hdr->seq, seq, __ATOMIC_RELEASE);
+
+    if (seq % EPS_LOG_SYNC_EVERY == 0)
+        msync(log->map, log->len, MS_ASYNC);
+}
+
+void eps_log_close(eps_log_t *log)
+{
+    if (log->map == NULL)
+        return;
+    msync(log->map, log->len, MS_SYNC);
+    munmap(log->map, log->len);
+    close(log->fd);
+    log->map = NULL;
+    log->hdr = NULL;
+    log->fd = -1;
+}
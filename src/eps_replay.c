@@ -0,0 +1,365 @@
+/**
+ * @file eps_replay.c
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief I2C bus that answers from a trace recorded with EPS_TRACE.
+ *
+ * Implements the drivers/i2cbus API so that it can be linked in place of
+ * i2cbus.o. The poller and the command path then run against the exact
+ * replies, errors and, optionally, latencies of the recorded bus, which
+ * makes performance regressions reproducible on any host. See eps_trace.h
+ * for the controls.
+ *
+ * @version 0.1
+ * @date 2021-04-15
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include "i2cbus/i2cbus.h"
+#include "eps_i2c.h"
+#include "eps_trace.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define EPS_REPLAY_MAX_BUS 16     // highest bus number + 1
+#define EPS_REPLAY_MAX_DEVS 16    // devices in a trace
+#define EPS_REPLAY_MAX_HANDLES 32 // simultaneously open i2cbus handles
+
+// Replies come from the trace, batches run exchange by exchange.
+int eps_i2c_backend_rdwr = 0;
+
+/**
+ * @brief Records of one device, in trace order.
+ *
+ */
+typedef struct
+{
+    int bus;
+    int addr;
+    const eps_trace_rec_t **recs; // open, read, write and transfer records
+    uint8_t *used;                // recs[i] has been replayed
+    size_t n;
+    size_t next; // first record not yet replayed
+} eps_replay_dev;
+
+static pthread_mutex_t eps_replay_lock = PTHREAD_MUTEX_INITIALIZER; // protects everything below
+static uint8_t *eps_replay_trace;
+static eps_replay_dev eps_replay_devs[EPS_REPLAY_MAX_DEVS];
+static int eps_replay_ndevs;
+static struct
+{
+    const i2cbus *handle;
+    eps_replay_dev *dev;
+} eps_replay_handles[EPS_REPLAY_MAX_HANDLES];
+static pthread_mutex_t eps_replay_bus_lock[EPS_REPLAY_MAX_BUS];
+static int eps_replay_ready = 0;
+static double eps_replay_speed = 0;
+static int eps_replay_loop = 0;
+static unsigned long eps_replay_matched, eps_replay_skipped, eps_replay_missed;
+
+static void eps_replay_report()
+{
+    fprintf(stderr, "eps_replay: %lu matched, %lu skipped, %lu missed\n", eps_replay_matched, eps_replay_skipped, eps_replay_missed);
+}
+
+static eps_replay_dev *eps_replay_find(int bus, int addr)
+{
+    for (int i = 0; i < eps_replay_ndevs; i++)
+        if (eps_replay_devs[i].bus == bus && eps_replay_devs[i].addr == addr)
+            return &eps_replay_devs[i];
+    return NULL;
+}
+
+// Called with eps_replay_lock held. Loads the trace and sorts its records
+// by device.
+static int eps_replay_setup()
+{
+    if (eps_replay_ready)
+        return eps_replay_trace != NULL ? 1 : -1;
+    eps_replay_ready = 1;
+    for (int i = 0; i < EPS_REPLAY_MAX_BUS; i++)
+        pthread_mutex_init(&eps_replay_bus_lock[i], NULL);
+    const char *val = getenv("EPS_REPLAY_SPEED");
+    eps_replay_speed = val == NULL ? 0 : strtod(val, NULL);
+    val = getenv("EPS_REPLAY_LOOP");
+    eps_replay_loop = val == NULL ? 0 : atoi(val);
+    const char *path = getenv("EPS_REPLAY");
+    FILE *fp = path == NULL ? NULL : fopen(path, "rb");
+    if (fp == NULL)
+    {
+        fprintf(stderr, "eps_replay: cannot open trace %s\n", path == NULL ? "(EPS_REPLAY not set)" : path);
+        return -1;
+    }
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    rewind(fp);
+    uint8_t *trace = size > 0 ? malloc(size) : NULL;
+    if (trace == NULL || fread(trace, 1, size, fp) != (size_t)size)
+    {
+        fprintf(stderr, "eps_replay: cannot read trace %s\n", path);
+        fclose(fp);
+        free(trace);
+        return -1;
+    }
+    fclose(fp);
+    const eps_trace_hdr_t *hdr = (const eps_trace_hdr_t *)trace;
+    if ((size_t)size < sizeof(eps_trace_hdr_t) || hdr->magic != EPS_TRACE_MAGIC || hdr->version != EPS_TRACE_VERSION || hdr->rec_size != sizeof(eps_trace_rec_t))
+    {
+        fprintf(stderr, "eps_replay: %s is not a version %d trace\n", path, EPS_TRACE_VERSION);
+        free(trace);
+        return -1;
+    }
+    // first pass counts the records of each device, second pass indexes them
+    for (int pass = 0; pass < 2; pass++)
+    {
+        size_t ofs = sizeof(eps_trace_hdr_t);
+        while (ofs + sizeof(eps_trace_rec_t) <= (size_t)size)
+        {
+            const eps_trace_rec_t *rec = (const eps_trace_rec_t *)(trace + ofs);
+            if (ofs + EPS_TRACE_REC_SIZE(rec) > (size_t)size)
+                break; // capture cut short
+            ofs += EPS_TRACE_REC_SIZE(rec);
+            if (rec->op == EPS_TRACE_CLOSE || rec->op > EPS_TRACE_XFER)
+                continue;
+            eps_replay_dev *dev = eps_replay_find(rec->bus, rec->addr);
+            if (dev == NULL && eps_replay_ndevs < EPS_REPLAY_MAX_DEVS)
+            {
+                dev = &eps_replay_devs[eps_replay_ndevs++];
+                dev->bus = rec->bus;
+                dev->addr = rec->addr;
+            }
+            if (dev == NULL)
+                continue;
+            if (pass == 0)
+                dev->n++;
+            else
+                dev->recs[dev->next++] = rec;
+        }
+        for (int i = 0; i < eps_replay_ndevs; i++)
+        {
+            if (pass == 0)
+            {
+                eps_replay_devs[i].recs = malloc(eps_replay_devs[i].n * sizeof(eps_trace_rec_t *));
+                eps_replay_devs[i].used = calloc(eps_replay_devs[i].n, 1);
+                if (eps_replay_devs[i].recs == NULL || eps_replay_devs[i].used == NULL)
+                {
+                    fprintf(stderr, "eps_replay: out of memory indexing %s\n", path);
+                    for (int j = 0; j <= i; j++)
+                    {
+                        free(eps_replay_devs[j].recs);
+                        free(eps_replay_devs[j].used);
+                        eps_replay_devs[j].recs = NULL;
+                        eps_replay_devs[j].used = NULL;
+                    }
+                    eps_replay_ndevs = 0;
+                    free(trace);
+                    return -1;
+                }
+            }
+            eps_replay_devs[i].next = 0;
+        }
+    }
+    eps_replay_trace = trace;
+    atexit(eps_replay_report);
+    return 1;
+}
+
+static int eps_replay_match(const eps_trace_rec_t *rec, int op, const void *wbuf, ssize_t wlen, ssize_t rlen)
+{
+    if (rec->op != op || rec->wlen != (wlen > EPS_TRACE_MAX_DATA ? EPS_TRACE_MAX_DATA : wlen))
+        return 0;
+    // the arguments tell apart commands such as switches of different channels
+    if (rec->wlen > 0 && memcmp(rec + 1, wbuf, rec->wlen) != 0)
+        return 0;
+    // a failed transaction recorded no reply
+    return rec->ret < 0 || rec->rlen == (rlen > EPS_TRACE_MAX_DATA ? EPS_TRACE_MAX_DATA : rlen);
+}
+
+// Called with eps_replay_lock held. Consumes the first unused record of dev
+// that matches the transaction, NULL if there is none. Records may be used
+// out of order, since the poller and the command path interleave differently
+// from run to run; a record left behind by more than half the lookahead is
+// given up as skipped.
+static const eps_trace_rec_t *eps_replay_next(eps_replay_dev *dev, int op, const void *wbuf, ssize_t wlen, ssize_t rlen)
+{
+    for (int pass = 0; pass < 2; pass++)
+    {
+        for (size_t i = dev->next; i < dev->n && i < dev->next + EPS_REPLAY_LOOKAHEAD; i++)
+        {
+            if (dev->used[i] || !eps_replay_match(dev->recs[i], op, wbuf, wlen, rlen))
+                continue;
+            dev->used[i] = 1;
+            eps_replay_matched++;
+            while (dev->next < dev->n && (dev->used[dev->next] || dev->next + EPS_REPLAY_LOOKAHEAD / 2 <= i))
+                eps_replay_skipped += !dev->used[dev->next++];
+            return dev->recs[i];
+        }
+        if (!eps_replay_loop || dev->next + EPS_REPLAY_LOOKAHEAD < dev->n)
+            break;
+        memset(dev->used, 0x0, dev->n);
+        dev->next = 0;
+    }
+    return NULL;
+}
+
+static eps_replay_dev *eps_replay_lookup(const i2cbus *handle)
+{
+    for (int i = 0; i < EPS_REPLAY_MAX_HANDLES; i++)
+        if (eps_replay_handles[i].handle == handle)
+            return eps_replay_handles[i].dev;
+    return NULL;
+}
+
+static void eps_replay_pace(const eps_trace_rec_t *rec)
+{
+    if (eps_replay_speed <= 0)
+        return;
+    uint64_t ns = rec->lat_ns / eps_replay_speed;
+    struct timespec ts = {.tv_sec = ns / 1000000000ULL, .tv_nsec = ns % 1000000000ULL};
+    while (clock_nanosleep(CLOCK_MONOTONIC, 0, &ts, &ts) == EINTR)
+        ;
+}
+
+// Plays back one read, write or transfer.
+static int eps_replay_op(i2cbus *handle, int op, const void *wbuf, ssize_t wlen, void *rbuf, ssize_t rlen)
+{
+    pthread_mutex_lock(&eps_replay_lock);
+    eps_replay_dev *dev = eps_replay_lookup(handle);
+    const eps_trace_rec_t *rec = dev == NULL ? NULL : eps_replay_next(dev, op, wbuf, wlen, rlen);
+    if (dev != NULL && rec == NULL)
+        eps_replay_missed++;
+    pthread_mutex_unlock(&eps_replay_lock);
+    if (rec == NULL)
+    {
+        errno = dev == NULL ? EBADF : (eps_replay_loop ? EIO : (dev->next >= dev->n ? ENODATA : EIO));
+        return -1;
+    }
+    eps_replay_pace(rec);
+    if (rec->ret < 0)
+    {
+        errno = rec->err;
+        return rec->ret;
+    }
+    if (rbuf != NULL && rlen > 0)
+    {
+        memset(rbuf, 0xff, rlen);
+        memcpy(rbuf, (const uint8_t *)(rec + 1) + rec->wlen, rec->rlen < rlen ? rec->rlen : rlen);
+    }
+    return rec->ret;
+}
+
+int i2cbus_open(i2cbus *handle, int id, int addr)
+{
+    if (handle == NULL || id < 0 || id >= EPS_REPLAY_MAX_BUS)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    pthread_mutex_lock(&eps_replay_lock);
+    eps_replay_dev *dev = eps_replay_setup() > 0 ? eps_replay_find(id, addr) : NULL;
+    const eps_trace_rec_t *rec = dev == NULL ? NULL : eps_replay_next(dev, EPS_TRACE_OPEN, NULL, 0, 0);
+    int ret = -1, err = ENODEV;
+    if (rec != NULL && rec->ret < 0)
+        err = rec->err;
+    else if (dev != NULL)
+    {
+        // a device seen in the trace opens even when its open was not recorded
+        err = ENOMEM;
+        for (int i = 0; i < EPS_REPLAY_MAX_HANDLES; i++)
+        {
+            if (eps_replay_handles[i].handle == NULL)
+            {
+                eps_replay_handles[i].handle = handle;
+                eps_replay_handles[i].dev = dev;
+                ret = i + 3; // looks like a file descriptor to the caller
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&eps_replay_lock);
+    if (ret < 0)
+    {
+        errno = err;
+        return -1;
+    }
+    memset(handle, 0x0, sizeof(i2cbus));
+    return ret;
+}
+
+ssize_t i2cbus_write(i2cbus *handle, const void *buf, ssize_t len)
+{
+    if (buf == NULL || len <= 0)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    return eps_replay_op(handle, EPS_TRACE_WRITE, buf, len, NULL, 0);
+}
+
+ssize_t i2cbus_read(i2cbus *handle, void *buf, ssize_t len)
+{
+    if (buf == NULL || len <= 0)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    return eps_replay_op(handle, EPS_TRACE_READ, NULL, 0, buf, len);
+}
+
+static pthread_mutex_t *eps_replay_bus(i2cbus *handle)
+{
+    pthread_mutex_lock(&eps_replay_lock);
+    eps_replay_dev *dev = eps_replay_lookup(handle);
+    pthread_mutex_unlock(&eps_replay_lock);
+    return dev == NULL ? NULL : &eps_replay_bus_lock[dev->bus];
+}
+
+int i2cbus_lock(i2cbus *handle)
+{
+    pthread_mutex_t *m = eps_replay_bus(handle);
+    return m == NULL ? -1 : pthread_mutex_lock(m);
+}
+
+int i2cbus_unlock(i2cbus *handle)
+{
+    pthread_mutex_t *m = eps_replay_bus(handle);
+    return m == NULL ? -1 : pthread_mutex_unlock(m);
+}
+
+int i2cbus_xfer(i2cbus *handle, void *outbuf, ssize_t outlen, void *inbuf, ssize_t inlen, unsigned long timeout_usec)
+{
+    if (i2cbus_lock(handle) < 0)
+    {
+        errno = EBADF;
+        return -1;
+    }
+    int ret = eps_replay_op(handle, EPS_TRACE_XFER, outbuf, outlen, inbuf, inbuf == NULL ? 0 : inlen);
+    int err = errno;
+    i2cbus_unlock(handle);
+    errno = err;
+    return ret;
+}
+
+int i2cbus_close(i2cbus *handle)
+{
+    int ret = -1;
+    pthread_mutex_lock(&eps_replay_lock);
+    for (int i = 0; i < EPS_REPLAY_MAX_HANDLES; i++)
+    {
+        if (eps_replay_handles[i].handle == handle)
+        {
+            eps_replay_handles[i].handle = NULL;
+            eps_replay_handles[i].dev = NULL;
+            ret = 0;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&eps_replay_lock);
+    return ret;
+}
@@ -0,0 +1,130 @@
+/**
+ * @file eps_shm.c
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Publishes housekeeping and configuration into POSIX shared memory
+ * for other processes (see include/eps_shm.h for the client side).
+ *
+ * @version 0.1
+ * @date 2021-04-15
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include "eps.h"
+#include "eps_shm.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+int eps_shm_pub_open(eps_shm_pub_t *pub, const char *dev_name, int boot_count)
+{
+    if (pub->shm != NULL)
+        return -1;
+    snprintf(pub->name, sizeof(pub->name), EPS_SHM_PREFIX "%s", dev_name);
+    int fd = shm_open(pub->name, O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+    {
+        perror("eps_shm_pub_open");
+        return -1;
+    }
+    // a segment already large enough may be in use and is not resized
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (st.st_size < (off_t)sizeof(eps_shm_t) && ftruncate(fd, sizeof(eps_shm_t)) < 0))
+    {
+        perror("eps_shm_pub_open");
+        close(fd);
+        return -1;
+    }
+    eps_shm_t *shm = mmap(NULL, sizeof(eps_shm_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shm == MAP_FAILED)
+    {
+        perror("eps_shm_pub_open");
+        return -1;
+    }
+    // two publishers would interleave their updates of one sequence lock
+    pid_t owner = __atomic_load_n(&shm->magic, __ATOMIC_ACQUIRE) == EPS_SHM_MAGIC ? shm->pid : 0;
+    if (owner > 0 && owner != getpid() && (kill(owner, 0) == 0 || errno == EPERM))
+    {
+        fprintf(stderr, "eps_shm_pub_open: %s is published by process %d\n", pub->name, (int)owner);
+        munmap(shm, sizeof(eps_shm_t));
+        return -EADDRINUSE;
+    }
+    // readers check the magic, so it goes in last
+    __atomic_store_n(&shm->magic, 0, __ATOMIC_RELAXED);
+    memset((uint8_t *)shm + sizeof(shm->magic), 0x0, sizeof(eps_shm_t) - sizeof(shm->magic));
+    shm->version = EPS_SHM_VERSION;
+    shm->size = sizeof(eps_shm_t);
+    shm->pid = getpid();
+    shm->boot_count = boot_count;
+    __atomic_store_n(&shm->magic, EPS_SHM_MAGIC, __ATOMIC_RELEASE);
+    pthread_mutex_init(&pub->m, NULL);
+    pub->shm = shm;
+    return 1;
+}
+
+static inline void eps_shm_begin(eps_shm_pub_t *pub)
+{
+    pthread_mutex_lock(&pub->m);
+    uint32_t s = __atomic_load_n(&pub->shm->seq, __ATOMIC_RELAXED);
+    __atomic_store_n(&pub->shm->seq, s + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void eps_shm_end(eps_shm_pub_t *pub)
+{
+    __atomic_store_n(&pub->shm->seq, __atomic_load_n(&pub->shm->seq, __ATOMIC_RELAXED) + 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&pub->m);
+}
+
+void eps_shm_pub_hk(eps_shm_pub_t *pub, const hkparam_t *hk, const eps_hk_out_t *hk_out, uint64_t t_mono_ns)
+{
+    if (pub->shm == NULL)
+        return;
+    eps_shm_begin(pub);
+    if (hk != NULL)
+    {
+        memcpy(&pub->shm->hk, hk, sizeof(hkparam_t));
+        pub->shm->t_hk_ns = t_mono_ns;
+        pub->shm->flags |= EPS_SHM_HAS_HK;
+    }
+    if (hk_out != NULL)
+    {
+        memcpy(&pub->shm->hk_out, hk_out, sizeof(eps_hk_out_t));
+        pub->shm->t_out_ns = t_mono_ns;
+        pub->shm->flags |= EPS_SHM_HAS_HK_OUT;
+    }
+    eps_shm_end(pub);
+}
+
+void eps_shm_pub_conf(eps_shm_pub_t *pub, const eps_config_t *conf, uint64_t t_mono_ns)
+{
+    if (pub->shm == NULL)
+        return;
+    eps_shm_begin(pub);
+    if (conf != NULL)
+    {
+        memcpy(&pub->shm->conf, conf, sizeof(eps_config_t));
+        pub->shm->flags |= EPS_SHM_HAS_CONF;
+    }
+    else
+        pub->shm->flags &= ~EPS_SHM_HAS_CONF;
+    pub->shm->t_conf_ns = t_mono_ns;
+    eps_shm_end(pub);
+}
+
+void eps_shm_pub_close(eps_shm_pub_t *pub)
+{
+    if (pub->shm == NULL)
+        return;
+    munmap(pub->shm, sizeof(eps_shm_t));
+    shm_unlink(pub->name);
+    pthread_mutex_destroy(&pub->m);
+    pub->shm = NULL;
+}
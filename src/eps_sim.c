@@ -0,0 +1,582 @@
+/**
+ * @file eps_sim.c
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Simulated I2C bus with GomSpace P31u devices attached.
+ *
+ * Implements the drivers/i2cbus API so that it can be linked in place of
+ * i2cbus.o. Every opened device answers the P31u command set with housekeeping
+ * derived from a simple orbit model, so the EPS module can be exercised and
+ * timed on hosts without an I2C adapter.
+ *
+ * @version 0.1
+ * @date 2021-04-15
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include "i2cbus/i2cbus.h"
+#include "eps_i2c.h"
+#include "eps_proto.h"
+#include "eps_sim.h"
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define EPS_SIM_MAX_BUS 16     // highest bus number + 1
+#define EPS_SIM_MAX_DEVS 16    // simulated devices
+#define EPS_SIM_MAX_HANDLES 32 // simultaneously open i2cbus handles
+#define EPS_SIM_ORBIT_S 5580.0 // orbit period, seconds
+#define EPS_SIM_SUNLIT 0.62    // sunlit fraction of the orbit
+#define EPS_SIM_GND_WDT_S 172800 // ground watchdog timeout, seconds
+
+// Handles have no adapter behind them, batches run exchange by exchange.
+int eps_i2c_backend_rdwr = 0;
+
+/**
+ * @brief Nominal load current of each output when switched on [mA].
+ *
+ */
+static const uint16_t eps_sim_load[P31U_NUM_OUTPUTS] = {420, 310, 180, 250, 130, 90, 0, 0};
+
+/**
+ * @brief State of one simulated P31u.
+ *
+ */
+typedef struct
+{
+    int bus;                                  // bus number
+    int addr;                                 // device address
+    int refs;                                 // open handles
+    uint8_t output;                           // output state, bit i = channel i
+    uint16_t latchup[6];                      // latchup counters
+    uint32_t bootcount;                       // boot counter
+    uint8_t bootcause;                        // cause of last reset
+    uint16_t sw_errors;                       // software error counter
+    uint32_t wdt_i2c_count;                   // I2C watchdog reboots
+    uint32_t wdt_gnd_count;                   // ground watchdog reboots
+    double wdt_gnd_kick;                      // time of last ground watchdog kick
+    uint8_t config[P31U_CONFIG_SZ];           // configuration, wire format
+    uint8_t reply[P31U_REPLY_HDR_SZ + 64];    // pending reply
+    int reply_len;                            // bytes in pending reply
+} eps_sim_dev;
+
+static pthread_mutex_t eps_sim_lock = PTHREAD_MUTEX_INITIALIZER; // protects everything below
+static eps_sim_dev eps_sim_devs[EPS_SIM_MAX_DEVS];
+static struct
+{
+    const i2cbus *handle;
+    eps_sim_dev *dev;
+} eps_sim_handles[EPS_SIM_MAX_HANDLES];
+static pthread_mutex_t eps_sim_bus_lock[EPS_SIM_MAX_BUS];
+static int eps_sim_ready = 0;
+static double eps_sim_t0;
+static unsigned int eps_sim_seed = 1;
+
+static volatile unsigned long eps_sim_latency_us = 0;
+static volatile unsigned long eps_sim_bus_hz = 100000;
+static volatile unsigned long eps_sim_error_ppm = 0;
+
+static double eps_sim_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+static unsigned long eps_sim_getenv(const char *name, unsigned long def)
+{
+    const char *val = getenv(name);
+    return val == NULL ? def : strtoul(val, NULL, 0);
+}
+
+// Called with eps_sim_lock held.
+static void eps_sim_setup()
+{
+    if (eps_sim_ready)
+        return;
+    eps_sim_latency_us = eps_sim_getenv("EPS_SIM_LATENCY_US", eps_sim_latency_us);
+    eps_sim_bus_hz = eps_sim_getenv("EPS_SIM_BUS_HZ", eps_sim_bus_hz);
+    eps_sim_error_ppm = eps_sim_getenv("EPS_SIM_ERROR_PPM", eps_sim_error_ppm);
+    eps_sim_seed = eps_sim_getenv("EPS_SIM_SEED", eps_sim_seed);
+    for (int i = 0; i < EPS_SIM_MAX_BUS; i++)
+        pthread_mutex_init(&eps_sim_bus_lock[i], NULL);
+    eps_sim_t0 = eps_sim_now();
+    eps_sim_ready = 1;
+}
+
+static inline void put16(uint8_t *buf, uint16_t val)
+{
+    buf[0] = val >> 8;
+    buf[1] = val;
+}
+
+static inline void put32(uint8_t *buf, uint32_t val)
+{
+    put16(buf, val >> 16);
+    put16(buf + 2, val);
+}
+
+static inline uint16_t get16(const uint8_t *buf)
+{
+    return (buf[0] << 8) | buf[1];
+}
+
+// Small zero-mean noise, +/- amp.
+static int eps_sim_noise(int amp)
+{
+    return amp > 0 ? (int)(rand_r(&eps_sim_seed) % (2 * amp + 1)) - amp : 0;
+}
+
+/**
+ * @brief Instantaneous electrical state derived from the orbit model.
+ *
+ */
+typedef struct
+{
+    uint16_t pv[3];
+    uint16_t pc;
+    uint16_t bv;
+    uint16_t sc;
+    int16_t temp[6];
+    uint16_t curout[6];
+    uint16_t curin[3];
+} eps_sim_state;
+
+static void eps_sim_sample(eps_sim_dev *dev, eps_sim_state *st)
+{
+    double t = eps_sim_now() - eps_sim_t0;
+    double phase = fmod(t, EPS_SIM_ORBIT_S) / EPS_SIM_ORBIT_S;
+    int sunlit = phase < EPS_SIM_SUNLIT;
+    double sun = sunlit ? sin(M_PI * phase / EPS_SIM_SUNLIT) : 0;
+
+    int load = 0;
+    for (int i = 0; i < 6; i++)
+    {
+        st->curout[i] = (dev->output & (1 << i)) ? eps_sim_load[i] + eps_sim_noise(eps_sim_load[i] / 20) : 0;
+        load += st->curout[i];
+    }
+    st->pc = 0;
+    for (int i = 0; i < 3; i++)
+    {
+        st->pv[i] = sunlit ? 4200 + 900 * sun + eps_sim_noise(20) : eps_sim_noise(5) + 5;
+        st->curin[i] = sunlit ? 600 * sun + eps_sim_noise(10) + 10 : 0;
+        st->pc += st->curin[i];
+    }
+    st->sc = load + 60 + eps_sim_noise(5);
+    // battery voltage follows the state of charge over the orbit
+    double soc = sunlit ? phase / EPS_SIM_SUNLIT : 1 - (phase - EPS_SIM_SUNLIT) / (1 - EPS_SIM_SUNLIT);
+    st->bv = 7000 + 1200 * soc + eps_sim_noise(8);
+    for (int i = 0; i < 6; i++)
+        st->temp[i] = (sunlit ? 12 + 18 * sun : 4 - 10 * (phase - EPS_SIM_SUNLIT)) + (i > 3 ? 2 : 0) + eps_sim_noise(1);
+}
+
+static void eps_sim_boot(eps_sim_dev *dev, uint8_t cause)
+{
+    dev->bootcount++;
+    dev->bootcause = cause;
+    dev->output = 0;
+    for (int i = 0; i < P31U_NUM_OUTPUTS; i++)
+        if (dev->config[4 + i])
+            dev->output |= 1 << i;
+    dev->wdt_gnd_kick = eps_sim_now();
+}
+
+static void eps_sim_config_default(eps_sim_dev *dev)
+{
+    uint8_t *c = dev->config;
+    memset(c, 0x0, P31U_CONFIG_SZ);
+    c[0] = 1; // ppt_mode: MPPT
+    c[1] = 1; // battheater_mode: auto
+    c[2] = 0; // battheater_low
+    c[3] = 5; // battheater_high
+    for (int i = 0; i < 6; i++)
+        c[4 + i] = 1; // output_normal_value: rails on
+    for (int i = 0; i < 3; i++)
+        put16(c + 52 + 2 * i, 3700); // vboost
+}
+
+// Builds the reply payload for a housekeeping request. Returns payload length.
+static int eps_sim_hk(eps_sim_dev *dev, int type, uint8_t *p)
+{
+    eps_sim_state st[1];
+    eps_sim_sample(dev, st);
+    double now = eps_sim_now();
+    uint32_t gnd_left = EPS_SIM_GND_WDT_S - (uint32_t)(now - dev->wdt_gnd_kick);
+    switch (type)
+    {
+    case P31U_HK_LEGACY:
+        for (int i = 0; i < 3; i++)
+            put16(p + 2 * i, st->pv[i]);
+        put16(p + 6, st->pc);
+        put16(p + 8, st->bv);
+        put16(p + 10, st->sc);
+        for (int i = 0; i < 4; i++)
+            put16(p + 12 + 2 * i, st->temp[i]);
+        for (int i = 0; i < 2; i++)
+            put16(p + 20 + 2 * i, st->temp[4 + i]);
+        for (int i = 0; i < 6; i++)
+            put16(p + 24 + 2 * i, dev->latchup[i]);
+        p[36] = dev->bootcause;
+        put16(p + 37, dev->bootcount);
+        put16(p + 39, dev->sw_errors);
+        p[41] = dev->config[0];
+        p[42] = dev->output;
+        return P31U_HK_LEGACY_SZ;
+    case P31U_HK_VI:
+        for (int i = 0; i < 3; i++)
+            put16(p + 2 * i, st->pv[i]);
+        put16(p + 6, st->bv);
+        for (int i = 0; i < 3; i++)
+            put16(p + 8 + 2 * i, st->curin[i]);
+        put16(p + 14, st->pc);
+        put16(p + 16, st->sc);
+        put16(p + 18, 0);
+        return P31U_HK_VI_SZ;
+    case P31U_HK_OUT:
+        for (int i = 0; i < 6; i++)
+            put16(p + 2 * i, st->curout[i]);
+        for (int i = 0; i < P31U_NUM_OUTPUTS; i++)
+            p[12 + i] = (dev->output >> i) & 1;
+        for (int i = 0; i < P31U_NUM_OUTPUTS; i++)
+        {
+            put16(p + 20 + 2 * i, 0);
+            put16(p + 36 + 2 * i, 0);
+        }
+        for (int i = 0; i < 6; i++)
+            put16(p + 52 + 2 * i, dev->latchup[i]);
+        return P31U_HK_OUT_SZ;
+    case P31U_HK_WDT:
+        put32(p, 99);
+        put32(p + 4, gnd_left);
+        p[8] = p[9] = 0;
+        put32(p + 10, dev->wdt_i2c_count);
+        put32(p + 14, dev->wdt_gnd_count);
+        put32(p + 18, 0);
+        put32(p + 22, 0);
+        return P31U_HK_WDT_SZ;
+    case P31U_HK_BASIC:
+        put32(p, dev->bootcount);
+        for (int i = 0; i < 6; i++)
+            put16(p + 4 + 2 * i, st->temp[i]);
+        p[16] = dev->bootcause;
+        p[17] = st->bv > 7400 ? 3 : 2; // battmode: normal / undervoltage
+        p[18] = dev->config[0];
+        put16(p + 19, 0);
+        return P31U_HK_BASIC_SZ;
+    default:
+        return -1;
+    }
+}
+
+// Executes one command written to the device and prepares the reply.
+// Called with eps_sim_lock held.
+static void eps_sim_exec(eps_sim_dev *dev, const uint8_t *buf, ssize_t len)
+{
+    uint8_t cmd = buf[0];
+    uint8_t *p = dev->reply + P31U_REPLY_HDR_SZ;
+    int plen = 0, err = 0;
+    dev->reply[0] = cmd;
+    switch (cmd)
+    {
+    case P31U_CMD_PING:
+        p[0] = len > 1 ? buf[1] : 0;
+        plen = P31U_PING_SZ;
+        break;
+    case P31U_CMD_REBOOT:
+        if (len >= 5 && (uint32_t)((get16(buf + 1) << 16) | get16(buf + 3)) == P31U_REBOOT_MAGIC)
+            eps_sim_boot(dev, 1);
+        else
+            err = 1;
+        break;
+    case P31U_CMD_GET_HK:
+        // hkparam_t answers the bare command; sub-command 0 selects the full
+        // eps_hk_t, which is not simulated
+        plen = len == 1 ? eps_sim_hk(dev, P31U_HK_LEGACY, p) : buf[1] == P31U_HK_LEGACY ? -1 : eps_sim_hk(dev, buf[1], p);
+        if (plen < 0)
+            plen = 0, err = 1;
+        break;
+    case P31U_CMD_SET_OUTPUT:
+        if (len >= 2)
+            dev->output = buf[1];
+        else
+            err = 1;
+        break;
+    case P31U_CMD_SET_SINGLE_OUTPUT:
+        if (len >= 3 && buf[1] < P31U_NUM_OUTPUTS)
+            dev->output = buf[2] ? (dev->output | (1 << buf[1])) : (dev->output & ~(1 << buf[1]));
+        else
+            err = 1;
+        break;
+    case P31U_CMD_RESET_COUNTERS:
+        if (len >= 2 && buf[1] == P31U_RESET_COUNTERS_MAGIC)
+        {
+            memset(dev->latchup, 0x0, sizeof(dev->latchup));
+            dev->bootcount = dev->sw_errors = dev->wdt_i2c_count = dev->wdt_gnd_count = 0;
+        }
+        else
+            err = 1;
+        break;
+    case P31U_CMD_RESET_WDT:
+        if (len >= 2 && buf[1] == P31U_RESET_WDT_MAGIC)
+            dev->wdt_gnd_kick = eps_sim_now();
+        else
+            err = 1;
+        break;
+    case P31U_CMD_CONFIG_CMD:
+        if (len >= 2 && buf[1] == 1)
+            eps_sim_config_default(dev);
+        break;
+    case P31U_CMD_CONFIG_GET:
+        memcpy(p, dev->config, P31U_CONFIG_SZ);
+        plen = P31U_CONFIG_SZ;
+        break;
+    case P31U_CMD_CONFIG_SET:
+        if (len >= 1 + P31U_CONFIG_SZ)
+            memcpy(dev->config, buf + 1, P31U_CONFIG_SZ);
+        else
+            err = 1;
+        break;
+    case P31U_CMD_HARD_RESET:
+        eps_sim_boot(dev, 2);
+        break;
+    default:
+        err = 1;
+        dev->sw_errors++;
+        break;
+    }
+    dev->reply[1] = err;
+    dev->reply_len = P31U_REPLY_HDR_SZ + plen;
+}
+
+// Sleeps for the time a transfer of len bytes takes on the bus.
+static void eps_sim_delay(ssize_t len)
+{
+    unsigned long usec = eps_sim_latency_us;
+    if (eps_sim_bus_hz)
+        usec += (len + 1) * 9 * 1000000UL / eps_sim_bus_hz; // address byte + data, 9 bits each
+    if (usec == 0)
+        return;
+    struct timespec ts = {.tv_sec = usec / 1000000, .tv_nsec = (usec % 1000000) * 1000};
+    while (clock_nanosleep(CLOCK_MONOTONIC, 0, &ts, &ts) == EINTR)
+        ;
+}
+
+// Decides whether the next transaction is NACKed. Called with eps_sim_lock held.
+static int eps_sim_nack()
+{
+    if (eps_sim_error_ppm == 0)
+        return 0;
+    return (unsigned long)(rand_r(&eps_sim_seed) % 1000000) < eps_sim_error_ppm;
+}
+
+static eps_sim_dev *eps_sim_lookup(const i2cbus *handle)
+{
+    for (int i = 0; i < EPS_SIM_MAX_HANDLES; i++)
+        if (eps_sim_handles[i].handle == handle)
+            return eps_sim_handles[i].dev;
+    return NULL;
+}
+
+int i2cbus_open(i2cbus *handle, int id, int addr)
+{
+    if (handle == NULL || id < 0 || id >= EPS_SIM_MAX_BUS)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    pthread_mutex_lock(&eps_sim_lock);
+    eps_sim_setup();
+    eps_sim_dev *dev = NULL, *empty = NULL;
+    for (int i = 0; i < EPS_SIM_MAX_DEVS; i++)
+    {
+        if (eps_sim_devs[i].refs > 0 && eps_sim_devs[i].bus == id && eps_sim_devs[i].addr == addr)
+            dev = &eps_sim_devs[i];
+        else if (eps_sim_devs[i].refs == 0 && empty == NULL)
+            empty = &eps_sim_devs[i];
+    }
+    if (dev == NULL && empty != NULL)
+    {
+        dev = empty;
+        memset(dev, 0x0, sizeof(eps_sim_dev));
+        dev->bus = id;
+        dev->addr = addr;
+        eps_sim_config_default(dev);
+        eps_sim_boot(dev, 0);
+    }
+    int slot = -1;
+    for (int i = 0; i < EPS_SIM_MAX_HANDLES && dev != NULL; i++)
+    {
+        if (eps_sim_handles[i].handle == NULL)
+        {
+            eps_sim_handles[i].handle = handle;
+            eps_sim_handles[i].dev = dev;
+            dev->refs++;
+            slot = i;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&eps_sim_lock);
+    if (slot < 0)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+    memset(handle, 0x0, sizeof(i2cbus));
+    return slot + 3; // looks like a file descriptor to the caller
+}
+
+ssize_t i2cbus_write(i2cbus *handle, const void *buf, ssize_t len)
+{
+    if (buf == NULL || len <= 0)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    eps_sim_delay(len);
+    pthread_mutex_lock(&eps_sim_lock);
+    eps_sim_dev *dev = eps_sim_lookup(handle);
+    ssize_t ret = len;
+    if (dev == NULL)
+    {
+        errno = EBADF;
+        ret = -1;
+    }
+    else if (eps_sim_nack())
+    {
+        errno = EREMOTEIO;
+        ret = -1;
+    }
+    else
+        eps_sim_exec(dev, buf, len);
+    pthread_mutex_unlock(&eps_sim_lock);
+    return ret;
+}
+
+ssize_t i2cbus_read(i2cbus *handle, void *buf, ssize_t len)
+{
+    if (buf == NULL || len <= 0)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    eps_sim_delay(len);
+    pthread_mutex_lock(&eps_sim_lock);
+    eps_sim_dev *dev = eps_sim_lookup(handle);
+    ssize_t ret = len;
+    if (dev == NULL)
+    {
+        errno = EBADF;
+        ret = -1;
+    }
+    else if (eps_sim_nack())
+    {
+        errno = EREMOTEIO;
+        ret = -1;
+    }
+    else
+    {
+        // the P31u clocks out 0xff past the end of its reply
+        memset(buf, 0xff, len);
+        memcpy(buf, dev->reply, len < dev->reply_len ? len : dev->reply_len);
+    }
+    pthread_mutex_unlock(&eps_sim_lock);
+    return ret;
+}
+
+static pthread_mutex_t *eps_sim_bus(i2cbus *handle)
+{
+    pthread_mutex_lock(&eps_sim_lock);
+    eps_sim_dev *dev = eps_sim_lookup(handle);
+    pthread_mutex_unlock(&eps_sim_lock);
+    return dev == NULL ? NULL : &eps_sim_bus_lock[dev->bus];
+}
+
+int i2cbus_lock(i2cbus *handle)
+{
+    pthread_mutex_t *m = eps_sim_bus(handle);
+    return m == NULL ? -1 : pthread_mutex_lock(m);
+}
+
+int i2cbus_unlock(i2cbus *handle)
+{
+    pthread_mutex_t *m = eps_sim_bus(handle);
+    return m == NULL ? -1 : pthread_mutex_unlock(m);
+}
+
+int i2cbus_xfer(i2cbus *handle, void *outbuf, ssize_t outlen, void *inbuf, ssize_t inlen, unsigned long timeout_usec)
+{
+    if (i2cbus_lock(handle) < 0)
+    {
+        errno = EBADF;
+        return -1;
+    }
+    ssize_t ret = i2cbus_write(handle, outbuf, outlen);
+    if (ret >= 0 && inlen > 0 && inbuf != NULL)
+    {
+        if (timeout_usec)
+        {
+            struct timespec ts = {.tv_sec = timeout_usec / 1000000, .tv_nsec = (timeout_usec % 1000000) * 1000};
+            while (clock_nanosleep(CLOCK_MONOTONIC, 0, &ts, &ts) == EINTR)
+                ;
+        }
+        ret = i2cbus_read(handle, inbuf, inlen);
+    }
+    i2cbus_unlock(handle);
+    return ret;
+}
+
+int i2cbus_close(i2cbus *handle)
+{
+    int ret = -1;
+    pthread_mutex_lock(&eps_sim_lock);
+    for (int i = 0; i < EPS_SIM_MAX_HANDLES; i++)
+    {
+        if (eps_sim_handles[i].handle == handle)
+        {
+            eps_sim_handles[i].dev->refs--;
+            eps_sim_handles[i].handle = NULL;
+            eps_sim_handles[i].dev = NULL;
+            ret = 0;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&eps_sim_lock);
+    return ret;
+}
+
+void eps_sim_set_latency(unsigned long usec)
+{
+    eps_sim_latency_us = usec;
+}
+
+void eps_sim_set_bus_hz(unsigned long hz)
+{
+    eps_sim_bus_hz = hz;
+}
+
+void eps_sim_set_error_rate(unsigned long ppm)
+{
+    eps_sim_error_ppm = ppm;
+}
+
+void eps_sim_latchup(int ch)
+{
+    if (ch < 0 || ch >= 6)
+        return;
+    pthread_mutex_lock(&eps_sim_lock);
+    for (int i = 0; i < EPS_SIM_MAX_DEVS; i++)
+    {
+        if (eps_sim_devs[i].refs > 0)
+        {
+            eps_sim_devs[i].output &= ~(1 << ch);
+            eps_sim_devs[i].latchup[ch]++;
+        }
+    }
+    pthread_mutex_unlock(&eps_sim_lock);
+}
@@ -0,0 +1,402 @@
+/**
+ * @file eps_srv.c
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief EPS command server: accepts requests from other processes on a Unix
+ * socket (protocol in include/eps_srv.h) and pipelines them into the command
+ * queues.
+ *
+ * The listening socket, every client and an eventfd the command workers post
+ * on completion are served by callbacks on the main reactor.
+ * Requests become asynchronous commands whose results land directly in a
+ * fixed pool of response buffers, so serving a request allocates nothing.
+ *
+ * @version 0.1
+ * @date 2021-04-15
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#define _GNU_SOURCE // accept4()
+#include "eps.h"
+#include "eps_srv.h"
+#include "eps_srv_iface.h"
+#include "reactor.h"
+#include <main.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/**
+ * @brief A client connection.
+ *
+ */
+typedef struct
+{
+    int fd;             // -1 if unused
+    unsigned gen;       // bumped on close, so late completions are not sent to a new client
+    eps_srv_req_t held; // request waiting for room in the queue
+    ssize_t held_len;   // length of held, 0 if none; the client is not read meanwhile
+} eps_srv_client;
+
+/**
+ * @brief A request waiting for its command to complete.
+ *
+ */
+typedef struct
+{
+    int used;
+    int client;          // index into eps_srv_clients
+    unsigned gen;        // generation of the client at submission
+    int ticket;          // command queue ticket
+    eps_config_t conf;   // argument of EPS_SRV_SET_CONF
+    eps_srv_resp_t resp; // response, filled in place by the command worker
+} eps_srv_pending;
+
+static int eps_srv_fd = -1;   // listening socket
+static int eps_srv_evfd = -1; // completion eventfd
+static char eps_srv_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+static eps_srv_client eps_srv_clients[EPS_SRV_CLIENTS];
+static eps_srv_pending eps_srv_pend[EPS_SRV_INFLIGHT];
+static int eps_srv_free[EPS_SRV_INFLIGHT]; // stack of unused eps_srv_pend entries
+static int eps_srv_nfree;
+
+static const eps_op eps_srv_ops[EPS_SRV_OP_MAX] = {
+    [EPS_SRV_PING] = EPS_OP_PING,
+    [EPS_SRV_GET_HK] = EPS_OP_GET_HK,
+    [EPS_SRV_GET_HK_OUT] = EPS_OP_GET_HK_OUT,
+    [EPS_SRV_LUP_SET] = EPS_OP_LUP_SET,
+    [EPS_SRV_TGL_LUP] = EPS_OP_TGL_LUP,
+    [EPS_SRV_GET_CONF] = EPS_OP_GET_CONF,
+    [EPS_SRV_SET_CONF] = EPS_OP_SET_CONF,
+    [EPS_SRV_REBOOT] = EPS_OP_REBOOT,
+};
+
+// Probes a socket path: 1 if a server accepts connections on it, 0 if
+// nothing listens there (no file, or one left behind by an earlier run),
+// -errno if it can not be told.
+static int eps_srv_probe(const struct sockaddr_un *addr)
+{
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -errno;
+    int ret = 1;
+    if (connect(fd, (const struct sockaddr *)addr, sizeof(*addr)) < 0)
+        ret = errno == ECONNREFUSED || errno == ENOENT ? 0 : -errno;
+    close(fd);
+    return ret;
+}
+
+int eps_srv_init()
+{
+    const char *path = getenv(EPS_SRV_SOCK_ENV);
+    if (path == NULL || path[0] == '\0')
+        path = EPS_SRV_PATH;
+    if (strlen(path) >= sizeof(eps_srv_path))
+    {
+        fprintf(stderr, "eps_srv_init: socket path %s too long\n", path);
+        return -1;
+    }
+    strcpy(eps_srv_path, path);
+
+    for (int i = 0; i < EPS_SRV_CLIENTS; i++)
+        eps_srv_clients[i].fd = -1;
+    for (int i = 0; i < EPS_SRV_INFLIGHT; i++)
+    {
+        eps_srv_pend[i].used = 0;
+        eps_srv_free[i] = EPS_SRV_INFLIGHT - 1 - i;
+    }
+    eps_srv_nfree = EPS_SRV_INFLIGHT;
+
+    struct sockaddr_un addr;
+    memset(&addr, 0x0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, eps_srv_path);
+    // a socket left behind by an earlier run would make bind fail; one a
+    // running instance serves is not taken over
+    int probe = eps_srv_probe(&addr);
+    if (probe != 0)
+    {
+        fprintf(stderr, "eps_srv_init: %s %s\n", eps_srv_path, probe > 0 ? "is served by another instance" : strerror(-probe));
+        return -EADDRINUSE;
+    }
+    eps_srv_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (eps_srv_fd < 0)
+    {
+        perror("eps_srv_init: socket");
+        return -1;
+    }
+    unlink(eps_srv_path);
+    if (bind(eps_srv_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        // another instance may have bound it since the probe; leave its file
+        perror("eps_srv_init: bind");
+        close(eps_srv_fd);
+        eps_srv_fd = -1;
+        return -1;
+    }
+    if (listen(eps_srv_fd, EPS_SRV_BACKLOG) < 0)
+    {
+        perror("eps_srv_init: listen");
+        eps_srv_destroy();
+        return -1;
+    }
+    if ((eps_srv_evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+    {
+        perror("eps_srv_init: eventfd");
+        eps_srv_destroy();
+        return -1;
+    }
+    return 1;
+}
+
+static void eps_srv_drop(int c)
+{
+    reactor_del(eps_srv_clients[c].fd);
+    close(eps_srv_clients[c].fd);
+    eps_srv_clients[c].fd = -1;
+    eps_srv_clients[c].gen++;
+    eps_srv_clients[c].held_len = 0;
+}
+
+// Sends a response; a client that can not take it is disconnected.
+static void eps_srv_send(int c, const eps_srv_resp_t *resp)
+{
+    ssize_t len = eps_srv_resp_len(resp->op, resp->ret);
+    if (send(eps_srv_clients[c].fd, resp, len, MSG_DONTWAIT | MSG_NOSIGNAL) != len)
+        eps_srv_drop(c);
+}
+
+static void eps_srv_on_client(int fd, uint32_t events, void *arg);
+
+static void eps_srv_on_accept(int fd, uint32_t events, void *arg)
+{
+    int cfd = accept4(eps_srv_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (cfd < 0)
+        return;
+    for (int c = 0; c < EPS_SRV_CLIENTS; c++)
+    {
+        if (eps_srv_clients[c].fd >= 0)
+            continue;
+        if (reactor_add(cfd, EPOLLIN, eps_srv_on_client, (void *)(intptr_t)c) < 0)
+            break;
+        eps_srv_clients[c].fd = cfd;
+        return;
+    }
+    close(cfd); // no room
+}
+
+/**
+ * @brief Validates a request and queues its command.
+ *
+ * @return int 0 if the command was queued, otherwise the result to send back
+ * right away.
+ */
+static int eps_srv_submit(int c, const eps_srv_req_t *req, ssize_t len, eps_srv_resp_t *resp)
+{
+    if (len < (ssize_t)EPS_SRV_REQ_HDR_SZ || req->op >= EPS_SRV_OP_MAX)
+        return -EINVAL;
+    if (req->op == EPS_SRV_SET_CONF && (len < (ssize_t)sizeof(eps_srv_req_t) || !eps_conf_check(&req->conf)))
+        return -EINVAL;
+    eps_dev_t *dev = eps_dev_at(req->dev);
+    if (dev == NULL)
+        return -ENODEV;
+    // configuration requests the shadow can answer never reach the bus
+    if (req->op == EPS_SRV_GET_CONF && eps_conf_shadow_get(dev, &resp->data.conf))
+        return 1;
+    if (req->op == EPS_SRV_SET_CONF)
+    {
+        eps_config_t conf;
+        if (eps_conf_shadow_get(dev, &conf) && !memcmp(&conf, &req->conf, sizeof(eps_config_t)))
+            return 1;
+    }
+    if (eps_srv_nfree == 0)
+        return -EAGAIN;
+
+    int i = eps_srv_free[eps_srv_nfree - 1];
+    eps_srv_pending *p = &eps_srv_pend[i];
+    p->resp = *resp;
+    eps_cmd_t cmd = {.op = eps_srv_ops[req->op], .arg = {req->arg[0], req->arg[1]}};
+    switch (req->op)
+    {
+    case EPS_SRV_GET_HK:
+        cmd.data = &p->resp.data.hk;
+        break;
+    case EPS_SRV_GET_HK_OUT:
+        cmd.data = &p->resp.data.hk_out;
+        break;
+    case EPS_SRV_GET_CONF:
+        cmd.data = &p->resp.data.conf;
+        break;
+    case EPS_SRV_SET_CONF:
+        p->conf = req->conf;
+        cmd.data = &p->conf;
+        break;
+    default:
+        break;
+    }
+    int ticket = eps_dev_cmd_submit_fd(dev, &cmd, eps_srv_evfd);
+    if (ticket < 0)
+        return ticket;
+    eps_srv_nfree--;
+    p->used = 1;
+    p->client = c;
+    p->gen = eps_srv_clients[c].gen;
+    p->ticket = ticket;
+    return 0;
+}
+
+static void eps_srv_watch(int c, uint32_t events)
+{
+    reactor_mod(eps_srv_clients[c].fd, events);
+}
+
+/**
+ * @brief Serves one request.
+ *
+ * A request that finds the queue full while some of ours are in flight is
+ * held, and the client is not read until a completion makes room; this
+ * pushes back on fast clients through their socket buffers instead of
+ * failing their requests. With nothing of ours in flight no completion would
+ * come, so the request fails with -EAGAIN instead.
+ *
+ * @return int 1 if served, 0 if held.
+ */
+static int eps_srv_request(int c, const eps_srv_req_t *req, ssize_t len)
+{
+    eps_srv_resp_t resp = {.id = req->id, .op = req->op, .dev = req->dev};
+    int ret = eps_srv_submit(c, req, len, &resp);
+    if (ret == -EAGAIN && eps_srv_nfree < EPS_SRV_INFLIGHT)
+    {
+        eps_srv_client *cl = &eps_srv_clients[c];
+        if (cl->held_len == 0)
+        {
+            memcpy(&cl->held, req, len);
+            cl->held_len = len;
+            eps_srv_watch(c, 0);
+        }
+        return 0;
+    }
+    if (ret != 0)
+    {
+        resp.ret = ret;
+        eps_srv_send(c, &resp);
+    }
+    return 1;
+}
+
+// Reads a burst of requests from a client.
+static void eps_srv_read(int c)
+{
+    for (int n = 0; n < EPS_SRV_RECV_BURST && eps_srv_clients[c].fd >= 0; n++)
+    {
+        eps_srv_req_t req;
+        memset(&req, 0x0, EPS_SRV_REQ_HDR_SZ);
+        ssize_t len = recv(eps_srv_clients[c].fd, &req, sizeof(req), MSG_DONTWAIT);
+        if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+            return;
+        if (len <= 0) // hung up; its queued commands complete into the pool unanswered
+        {
+            eps_srv_drop(c);
+            return;
+        }
+        if (!eps_srv_request(c, &req, len))
+            return;
+    }
+}
+
+// Retries held requests, starting after the client served first last time.
+static void eps_srv_resume()
+{
+    static int first = 0;
+    for (int k = 0; k < EPS_SRV_CLIENTS; k++)
+    {
+        int c = (first + k) % EPS_SRV_CLIENTS;
+        eps_srv_client *cl = &eps_srv_clients[c];
+        if (cl->fd < 0 || cl->held_len == 0)
+            continue;
+        eps_srv_req_t req = cl->held;
+        ssize_t len = cl->held_len;
+        cl->held_len = 0;
+        if (!eps_srv_request(c, &req, len))
+            break; // held again; later clients wait too
+        if (cl->fd >= 0)
+            eps_srv_watch(c, EPOLLIN);
+        first = (c + 1) % EPS_SRV_CLIENTS;
+    }
+}
+
+static void eps_srv_on_client(int fd, uint32_t events, void *arg)
+{
+    int c = (intptr_t)arg;
+    if (eps_srv_clients[c].held_len == 0)
+        eps_srv_read(c);
+    else if (events & (EPOLLHUP | EPOLLERR)) // reported even while not watched
+        eps_srv_drop(c);
+}
+
+// Answers every request whose command has completed.
+static void eps_srv_on_complete(int fd, uint32_t events, void *arg)
+{
+    uint64_t count;
+    read(eps_srv_evfd, &count, sizeof(count));
+    for (int i = 0; i < EPS_SRV_INFLIGHT; i++)
+    {
+        eps_srv_pending *p = &eps_srv_pend[i];
+        if (!p->used)
+            continue;
+        int ret = 0;
+        int status = eps_cmd_poll(p->ticket, &ret);
+        if (status == 0)
+            continue;
+        p->resp.ret = status < 0 ? status : ret;
+        if (eps_srv_clients[p->client].fd >= 0 && eps_srv_clients[p->client].gen == p->gen)
+            eps_srv_send(p->client, &p->resp);
+        p->used = 0;
+        eps_srv_free[eps_srv_nfree++] = i;
+    }
+    eps_srv_resume();
+}
+
+int eps_srv_register()
+{
+    if (reactor_add(eps_srv_fd, EPOLLIN, eps_srv_on_accept, NULL) < 0 ||
+        reactor_add(eps_srv_evfd, EPOLLIN, eps_srv_on_complete, NULL) < 0)
+    {
+        fprintf(stderr, "eps_srv_register: failed\n");
+        return -1;
+    }
+    return 1;
+}
+
+void eps_srv_destroy()
+{
+    // Runs after the command workers have exited: every queued command has
+    // completed or been failed, so the pool and the eventfd can go.
+    for (int i = 0; i < EPS_SRV_INFLIGHT; i++)
+    {
+        if (eps_srv_pend[i].used)
+            eps_cmd_cancel(eps_srv_pend[i].ticket);
+        eps_srv_pend[i].used = 0;
+    }
+    for (int c = 0; c < EPS_SRV_CLIENTS; c++)
+        if (eps_srv_clients[c].fd >= 0)
+            eps_srv_drop(c);
+    if (eps_srv_fd >= 0)
+    {
+        reactor_del(eps_srv_fd);
+        close(eps_srv_fd);
+        unlink(eps_srv_path);
+    }
+    if (eps_srv_evfd >= 0)
+    {
+        reactor_del(eps_srv_evfd);
+        close(eps_srv_evfd);
+    }
+    eps_srv_fd = eps_srv_evfd = -1;
+}
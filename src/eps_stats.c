@@ -0,0 +1,243 @@
+/**
+ * @file eps_stats.c
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Per-opcode call, error and latency statistics for EPS commands.
+ *
+ * Every thread that issues EPS commands records into its own block of
+ * counters, so recording never takes a lock or contends on a cache line.
+ * Blocks are pushed onto a lock-free list on first use and merged when the
+ * statistics are dumped.
+ *
+ * Latencies are kept in log-linear (HDR style) histograms with 16 sub-buckets
+ * per power of two, i.e. a relative error below 6.25%.
+ *
+ * @version 0.1
+ * @date 2021-04-15
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include "eps.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define EPS_STATS_SUB_BITS 4                                                   // log2 of sub-buckets per power of two
+#define EPS_STATS_MAX_EXP 36                                                   // largest exponent, latencies clamp at ~2^40 ns
+#define EPS_STATS_NBUCKETS ((EPS_STATS_MAX_EXP + 2) << EPS_STATS_SUB_BITS)     // histogram size
+
+/**
+ * @brief Counters of one thread for one opcode. Written only by the owning
+ * thread, read by eps_stats_dump().
+ *
+ */
+typedef struct
+{
+    atomic_uint_fast64_t calls;
+    atomic_uint_fast64_t errors;
+    atomic_uint_fast64_t local;
+    atomic_uint_fast64_t sum_ns;
+    atomic_uint_fast64_t max_ns;
+    atomic_uint hist[EPS_STATS_NBUCKETS];
+} eps_stats_op;
+
+/**
+ * @brief Counters of one thread.
+ *
+ */
+typedef struct eps_stats_block
+{
+    struct eps_stats_block *next;
+    eps_stats_op op[EPS_OP_MAX];
+} eps_stats_block;
+
+static _Atomic(eps_stats_block *) eps_stats_head = NULL;
+static __thread eps_stats_block *eps_stats_local = NULL;
+
+static const char *eps_op_names[EPS_OP_MAX] = {
+    [EPS_OP_PING] = "ping",
+    [EPS_OP_REBOOT] = "reboot",
+    [EPS_OP_GET_HK] = "get_hk",
+    [EPS_OP_GET_HK_OUT] = "get_hk_out",
+    [EPS_OP_TGL_LUP] = "tgl_lup",
+    [EPS_OP_LUP_SET] = "lup_set",
+    [EPS_OP_GET_CONF] = "get_conf",
+    [EPS_OP_SET_CONF] = "set_conf",
+    [EPS_OP_HARDRESET] = "hardreset",
+    [EPS_OP_RESET_WDT] = "reset_wdt",
+    [EPS_OP_LUP_MASK] = "lup_set_mask",
+    [EPS_OP_GET_HK_RAW] = "get_hk_raw",
+    [EPS_OP_POLL] = "poll",
+};
+
+const char *eps_op_name(eps_op op)
+{
+    if (op < 0 || op >= EPS_OP_MAX || eps_op_names[op] == NULL)
+        return "unknown";
+    return eps_op_names[op];
+}
+
+static const char *eps_prio_names[EPS_PRIO_MAX] = {
+    [EPS_PRIO_CRITICAL] = "critical",
+    [EPS_PRIO_CONTROL] = "control",
+    [EPS_PRIO_BULK] = "bulk",
+};
+
+const char *eps_prio_name(eps_prio prio)
+{
+    if (prio < 0 || prio >= EPS_PRIO_MAX)
+        return "unknown";
+    return eps_prio_names[prio];
+}
+
+static inline int eps_stats_bucket(uint64_t ns)
+{
+    if (ns >> (EPS_STATS_MAX_EXP + EPS_STATS_SUB_BITS + 1))
+        ns = (1ULL << (EPS_STATS_MAX_EXP + EPS_STATS_SUB_BITS + 1)) - 1;
+    int msb = 63 - __builtin_clzll(ns | 1);
+    int exp = msb > EPS_STATS_SUB_BITS ? msb - EPS_STATS_SUB_BITS : 0;
+    return (exp << EPS_STATS_SUB_BITS) + (int)(ns >> exp);
+}
+
+// Lowest latency that falls in a bucket.
+static inline uint64_t eps_stats_bucket_ns(int idx)
+{
+    if (idx < (2 << EPS_STATS_SUB_BITS))
+        return idx;
+    int exp = (idx >> EPS_STATS_SUB_BITS) - 1;
+    return (uint64_t)(idx - (exp << EPS_STATS_SUB_BITS)) << exp;
+}
+
+// Single-writer increment; cheaper than an atomic read-modify-write.
+static inline void eps_stats_add(atomic_uint_fast64_t *ctr, uint64_t val)
+{
+    atomic_store_explicit(ctr, atomic_load_explicit(ctr, memory_order_relaxed) + val, memory_order_relaxed);
+}
+
+static void eps_stats_add_call(eps_op op, int ret, uint64_t ns, int local)
+{
+    if (op < 0 || op >= EPS_OP_MAX)
+        return;
+    if (eps_stats_local == NULL)
+    {
+        eps_stats_block *blk = calloc(1, sizeof(eps_stats_block));
+        if (blk == NULL)
+            return;
+        blk->next = atomic_load(&eps_stats_head);
+        while (!atomic_compare_exchange_weak(&eps_stats_head, &blk->next, blk))
+            ;
+        eps_stats_local = blk;
+    }
+    eps_stats_op *st = &eps_stats_local->op[op];
+    eps_stats_add(&st->calls, 1);
+    if (ret < 0)
+        eps_stats_add(&st->errors, 1);
+    if (local)
+        eps_stats_add(&st->local, 1);
+    eps_stats_add(&st->sum_ns, ns);
+    if (ns > atomic_load_explicit(&st->max_ns, memory_order_relaxed))
+        atomic_store_explicit(&st->max_ns, ns, memory_order_relaxed);
+    atomic_uint *b = &st->hist[eps_stats_bucket(ns)];
+    atomic_store_explicit(b, atomic_load_explicit(b, memory_order_relaxed) + 1, memory_order_relaxed);
+}
+
+void eps_stats_record(eps_op op, int ret, uint64_t ns)
+{
+    eps_stats_add_call(op, ret, ns, 0);
+}
+
+void eps_stats_record_local(eps_op op, int ret, uint64_t ns)
+{
+    eps_stats_add_call(op, ret, ns, 1);
+}
+
+// Latency at quantile q of a merged histogram.
+static uint64_t eps_stats_quantile(const uint64_t *hist, uint64_t total, double q)
+{
+    uint64_t rank = (uint64_t)(q * total + 0.5), seen = 0;
+    if (rank == 0)
+        rank = 1;
+    for (int i = 0; i < EPS_STATS_NBUCKETS; i++)
+    {
+        seen += hist[i];
+        if (seen >= rank)
+            return eps_stats_bucket_ns(i);
+    }
+    return eps_stats_bucket_ns(EPS_STATS_NBUCKETS - 1);
+}
+
+int eps_stats_get(eps_op op, eps_stats_t *out)
+{
+    if (op < 0 || op >= EPS_OP_MAX || out == NULL)
+        return -1;
+    uint64_t *hist = calloc(EPS_STATS_NBUCKETS, sizeof(uint64_t));
+    if (hist == NULL)
+        return -1;
+    uint64_t sum = 0;
+    memset(out, 0x0, sizeof(eps_stats_t));
+    for (eps_stats_block *blk = atomic_load(&eps_stats_head); blk != NULL; blk = blk->next)
+    {
+        eps_stats_op *st = &blk->op[op];
+        out->calls += atomic_load_explicit(&st->calls, memory_order_relaxed);
+        out->errors += atomic_load_explicit(&st->errors, memory_order_relaxed);
+        out->local += atomic_load_explicit(&st->local, memory_order_relaxed);
+        sum += atomic_load_explicit(&st->sum_ns, memory_order_relaxed);
+        uint64_t max = atomic_load_explicit(&st->max_ns, memory_order_relaxed);
+        if (max > out->max_ns)
+            out->max_ns = max;
+        for (int i = 0; i < EPS_STATS_NBUCKETS; i++)
+            hist[i] += atomic_load_explicit(&st->hist[i], memory_order_relaxed);
+    }
+    // histogram and totals are read at slightly different times, use its own total
+    uint64_t total = 0;
+    for (int i = 0; i < EPS_STATS_NBUCKETS; i++)
+        total += hist[i];
+    if (total > 0)
+    {
+        out->mean_ns = sum / (out->calls ? out->calls : 1);
+        out->p50_ns = eps_stats_quantile(hist, total, 0.5);
+        out->p99_ns = eps_stats_quantile(hist, total, 0.99);
+        out->p999_ns = eps_stats_quantile(hist, total, 0.999);
+    }
+    free(hist);
+    return 1;
+}
+
+int eps_stats_dump(const char *fname)
+{
+    FILE *fp = stdout;
+    if (fname != NULL && (fp = fopen(fname, "a")) == NULL)
+    {
+        perror("eps_stats_dump");
+        return -1;
+    }
+    fprintf(fp, "%-14s %10s %8s %8s %10s %10s %10s %10s %10s\n",
+            "command", "calls", "errors", "local", "mean[us]", "p50[us]", "p99[us]", "p999[us]", "max[us]");
+    for (int op = 0; op < EPS_OP_MAX; op++)
+    {
+        eps_stats_t st;
+        if (eps_stats_get(op, &st) < 0 || st.calls == 0)
+            continue;
+        fprintf(fp, "%-14s %10llu %8llu %8llu %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+                eps_op_name(op), (unsigned long long)st.calls, (unsigned long long)st.errors, (unsigned long long)st.local,
+                st.mean_ns * 1e-3, st.p50_ns * 1e-3, st.p99_ns * 1e-3, st.p999_ns * 1e-3, st.max_ns * 1e-3);
+    }
+    fprintf(fp, "%-14s %10s %10s %8s %8s %8s %10s %8s\n",
+            "device", "ok", "ok_retry", "failed", "rejected", "expired", "retries", "resets");
+    for (int i = 0; i < eps_dev_count(); i++)
+    {
+        eps_retry_stats_t rt;
+        if (eps_dev_retry_stats_get(eps_dev_at(i), &rt) < 0)
+            continue;
+        fprintf(fp, "%-14s %10llu %10llu %8llu %8llu %8llu %10llu %8llu\n", eps_dev_name(eps_dev_at(i)),
+                (unsigned long long)rt.ok, (unsigned long long)rt.ok_retried, (unsigned long long)rt.failed,
+                (unsigned long long)rt.rejected, (unsigned long long)rt.expired, (unsigned long long)rt.retries,
+                (unsigned long long)rt.bus_resets);
+    }
+    fprintf(fp, "\n");
+    if (fp != stdout)
+        fclose(fp);
+    return 1;
+}
@@ -0,0 +1,197 @@
+/**
+ * @file eps_sub.c
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Housekeeping change subscriptions.
+ *
+ * Every sample published by the poller is compared with the previous one of
+ * the same device and with the reference values of that device's subscribers. Subscribers whose thresholds are
+ * crossed get the event bits ORed into their pending mask and their condition
+ * broadcast, so they can sleep instead of polling.
+ *
+ * @version 0.1
+ * @date 2021-04-15
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include "eps.h"
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define EPS_NUM_TEMPS 6 // temp[4] followed by batt_temp[2]
+
+/**
+ * @brief A registered subscriber.
+ *
+ */
+typedef struct
+{
+    int used;
+    int dev; // index of the device subscribed to
+    eps_hk_sub_cfg_t cfg;
+    pthread_cond_t *cond;
+    pthread_mutex_t *m;
+    atomic_uint pending; // EPS_EV_* not yet taken
+    int have_ref;        // reference values below are set
+    uint16_t ref_bv;     // bv at the last EPS_EV_BV
+    uint16_t ref_sc;     // sc at the last EPS_EV_SC
+    uint8_t temp_out;    // bit i set while temperature i is out of bounds
+} eps_sub;
+
+static pthread_mutex_t eps_sub_m[1] = {PTHREAD_MUTEX_INITIALIZER}; // protects everything below
+static eps_sub eps_subs[EPS_SUB_MAX];
+static hkparam_t eps_sub_hk_prev[EPS_DEV_MAX];
+static eps_hk_out_t eps_sub_out_prev[EPS_DEV_MAX];
+static int eps_sub_have_hk[EPS_DEV_MAX], eps_sub_have_out[EPS_DEV_MAX];
+
+int eps_dev_hk_subscribe(eps_dev_t *dev, const eps_hk_sub_cfg_t *cfg, pthread_cond_t *cond, pthread_mutex_t *m)
+{
+    if (cfg == NULL || cond == NULL || m == NULL)
+        return -EINVAL;
+    if (dev == NULL)
+        return -ENODEV;
+    int id = -ENOSPC;
+    pthread_mutex_lock(eps_sub_m);
+    for (int i = 0; i < EPS_SUB_MAX; i++)
+    {
+        if (!eps_subs[i].used)
+        {
+            eps_sub *s = &eps_subs[i];
+            memset(s, 0x0, sizeof(eps_sub));
+            s->dev = eps_dev_index(dev);
+            s->cfg = *cfg;
+            s->cond = cond;
+            s->m = m;
+            s->used = 1;
+            id = i;
+            break;
+        }
+    }
+    pthread_mutex_unlock(eps_sub_m);
+    return id;
+}
+
+int eps_hk_subscribe(const eps_hk_sub_cfg_t *cfg, pthread_cond_t *cond, pthread_mutex_t *m)
+{
+    return eps_dev_hk_subscribe(eps_dev_at(0), cfg, cond, m);
+}
+
+int eps_hk_unsubscribe(int id)
+{
+    if (id < 0 || id >= EPS_SUB_MAX)
+        return -EINVAL;
+    pthread_mutex_lock(eps_sub_m);
+    int ret = eps_subs[id].used ? 1 : -EINVAL;
+    eps_subs[id].used = 0;
+    pthread_mutex_unlock(eps_sub_m);
+    return ret;
+}
+
+uint32_t eps_hk_sub_take(int id)
+{
+    if (id < 0 || id >= EPS_SUB_MAX)
+        return 0;
+    return atomic_exchange(&eps_subs[id].pending, 0);
+}
+
+static inline uint32_t eps_mask_if(int cond)
+{
+    return -(uint32_t)(cond != 0);
+}
+
+// Temperatures outside [low, high] as a bit mask.
+static inline uint8_t eps_temp_out(const hkparam_t *hk, int16_t low, int16_t high)
+{
+    int16_t t[EPS_NUM_TEMPS] = {hk->temp[0], hk->temp[1], hk->temp[2], hk->temp[3], hk->batt_temp[0], hk->batt_temp[1]};
+    uint8_t out = 0;
+    for (int i = 0; i < EPS_NUM_TEMPS; i++)
+        out |= ((t[i] < low) | (t[i] > high)) << i;
+    return out;
+}
+
+void eps_sub_notify(int dev, const hkparam_t *hk, const eps_hk_out_t *hk_out)
+{
+    if (dev < 0 || dev >= EPS_DEV_MAX)
+        return;
+    pthread_mutex_lock(eps_sub_m);
+    // changes common to every subscriber, compared without branches
+    uint32_t lup = 0, chan = 0;
+    if (hk != NULL && eps_sub_have_hk[dev])
+    {
+        for (int i = 0; i < 6; i++)
+            lup |= hk->latchup[i] ^ eps_sub_hk_prev[dev].latchup[i];
+        chan |= hk->channel_status ^ eps_sub_hk_prev[dev].channel_status;
+    }
+    if (hk_out != NULL && eps_sub_have_out[dev])
+    {
+        for (int i = 0; i < 6; i++)
+            lup |= hk_out->latchup[i] ^ eps_sub_out_prev[dev].latchup[i];
+        for (int i = 0; i < 8; i++)
+            chan |= hk_out->output[i] ^ eps_sub_out_prev[dev].output[i];
+    }
+    uint32_t common = (eps_mask_if(lup) & EPS_EV_LATCHUP) | (eps_mask_if(chan) & EPS_EV_CHANNEL);
+
+    // subscribers to wake, woken once eps_sub_m is released
+    struct
+    {
+        pthread_cond_t *cond;
+        pthread_mutex_t *m;
+    } wake[EPS_SUB_MAX];
+    int nwake = 0;
+    for (int i = 0; i < EPS_SUB_MAX; i++)
+    {
+        eps_sub *s = &eps_subs[i];
+        if (!s->used || s->dev != dev)
+            continue;
+        uint32_t ev = common;
+        if (hk != NULL)
+        {
+            uint8_t temp_out = eps_temp_out(hk, s->cfg.temp_low, s->cfg.temp_high);
+            if (!s->have_ref)
+            {
+                s->ref_bv = hk->bv;
+                s->ref_sc = hk->sc;
+                s->temp_out = temp_out;
+                s->have_ref = 1;
+            }
+            uint32_t bv_hit = eps_mask_if(abs(hk->bv - s->ref_bv) > s->cfg.bv_delta);
+            uint32_t sc_hit = eps_mask_if(abs(hk->sc - s->ref_sc) > s->cfg.sc_delta);
+            ev |= (bv_hit & EPS_EV_BV) | (sc_hit & EPS_EV_SC) | (eps_mask_if(temp_out ^ s->temp_out) & EPS_EV_TEMP);
+            // move references only when the event fires
+            s->ref_bv ^= (s->ref_bv ^ hk->bv) & bv_hit;
+            s->ref_sc ^= (s->ref_sc ^ hk->sc) & sc_hit;
+            s->temp_out = temp_out;
+        }
+        ev &= s->cfg.events;
+        if (ev == 0)
+            continue;
+        atomic_fetch_or(&s->pending, ev);
+        wake[nwake].cond = s->cond;
+        wake[nwake].m = s->m;
+        nwake++;
+    }
+
+    if (hk != NULL)
+    {
+        eps_sub_hk_prev[dev] = *hk;
+        eps_sub_have_hk[dev] = 1;
+    }
+    if (hk_out != NULL)
+    {
+        eps_sub_out_prev[dev] = *hk_out;
+        eps_sub_have_out[dev] = 1;
+    }
+    pthread_mutex_unlock(eps_sub_m);
+
+    // never under eps_sub_m, so that no lock order ties the subscribers'
+    // mutexes to it and a subscriber may (un)subscribe while holding its own
+    for (int i = 0; i < nwake; i++)
+    {
+        pthread_mutex_lock(wake[i].m);
+        pthread_cond_broadcast(wake[i].cond);
+        pthread_mutex_unlock(wake[i].m);
+    }
+}
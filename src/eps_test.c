@@ -1,5 +1,7 @@
 #include "eps_extern.h"
+#include "eps_test_iface.h"
 #include "main.h"
+#include "reactor.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -27,48 +29,48 @@ Hard Reset
 hkparam_t hk[1];
 eps_hk_out_t hkout[1];
 
-void print_hk(hkparam_t hk)
+void print_hk(const hkparam_t *hk)
 {
     printf("Photovoltaic voltage (mV):");
     for (int i = 0; i < 3; i++)
-        printf(" %u", (hk.pv[i]));
-    printf("\nTotal photo current [mA]: %u", (hk.pc));
-    printf("\nBattery voltage [mV]: %u", (hk.bv));
-    printf("\nTotal system current [mA]: %u", (hk.sc));
+        printf(" %u", (hk->pv[i]));
+    printf("\nTotal photo current [mA]: %u", (hk->pc));
+    printf("\nBattery voltage [mV]: %u", (hk->bv));
+    printf("\nTotal system current [mA]: %u", (hk->sc));
     printf("\nTemp of boost converters and onboard batt (C):");
     for (int i = 0; i < 4; i++)
-        printf(" %d", (hk.temp[i]));
+        printf(" %d", (hk->temp[i]));
     printf("\nExternal board batt (C):");
     for (int i = 0; i < 2; i++)
-        printf(" %d", (hk.batt_temp[i]));
+        printf(" %d", (hk->batt_temp[i]));
     printf("\nNumber of latchups:");
     for (int i = 0; i < 6; i++)
-        printf(" %u", (hk.latchup[i]));
-    printf("\nCause of last reset: 0x%02x", hk.reset);
-    printf("\nNumber of reboots: %u", (hk.bootcount));
-    printf("\nSoftware errors: %u", (hk.sw_errors));
-    printf("\nPPT mode: %u", hk.ppt_mode);
-    printf("\nChannel status: %u", hk.channel_status);
+        printf(" %u", (hk->latchup[i]));
+    printf("\nCause of last reset: 0x%02x", hk->reset);
+    printf("\nNumber of reboots: %u", (hk->bootcount));
+    printf("\nSoftware errors: %u", (hk->sw_errors));
+    printf("\nPPT mode: %u", hk->ppt_mode);
+    printf("\nChannel status: %u", hk->channel_status);
     printf("\n\n");
 }
 
-void print_hk_out(eps_hk_out_t hk_out)
+void print_hk_out(const eps_hk_out_t *hk_out)
 {
     printf("LUP currents: ");
     for (int i = 0; i < 6; i++)
-        printf("%u ", (hk_out.curout[i]));
+        printf("%u ", (hk_out->curout[i]));
     printf("\nLUP status: ");
     for (int i = 0; i < 8; i++)
-        printf("%01x ", (hk_out.output[i]));
+        printf("%01x ", (hk_out->output[i]));
     printf("\nLUP on delay [s]: ");
     for (int i = 0; i < 8; i++)
-        printf("%u ", (hk_out.output_on_delta[i]));
+        printf("%u ", (hk_out->output_on_delta[i]));
     printf("\nLUP off delay [s]: ");
     for (int i = 0; i < 8; i++)
-        printf("%u ", (hk_out.output_off_delta[i]));
+        printf("%u ", (hk_out->output_off_delta[i]));
     printf("\nNumber of LUPs: ");
     for (int i = 0; i < 6; i++)
-        printf("%u ", (hk_out.latchup[i]));
+        printf("%u ", (hk_out->latchup[i]));
     printf("\n\n");
 }
 
@@ -143,17 +145,34 @@ void getval_conf_t(eps_config_t *conf)
 
 void *eps_test(void *tid)
 {
-    hkparam_t hk;
-    eps_hk_out_t hk_out;
+    eps_hk_raw_t hk_raw, hk_out_raw;
     eps_config_t conf[1];
     char c = 0x0;
     int lup = 0;
+    int ret = 0;
 #ifdef NO_LUP_TGL
     int pw_stat[6] = {0, 0, 0, 0, 0, 0};
 #endif
+    // EPS_TEST_SCRIPT=file (or - for stdin) runs a script instead of the menu
+    const char *script = getenv("EPS_TEST_SCRIPT");
+    if (script != NULL)
+    {
+        FILE *fp = strcmp(script, "-") ? fopen(script, "r") : stdin;
+        if (fp == NULL)
+            perror("eps_test");
+        else
+        {
+            eps_test_batch(fp);
+            if (fp != stdin)
+                fclose(fp);
+        }
+        done = 1;
+        reactor_stop();
+        return NULL;
+    }
     while (!done)
     {
-        printf("[p]ing, [k]ill eps, get [h]ousekeeping, [c]onfig, [r]eboot, toggle [l]atchup, [q]uit: ");
+        printf("[p]ing, [k]ill eps, get [h]ousekeeping, [c]onfig, [r]eboot, toggle [l]atchup, [s]tatistics, [q]uit: ");
         c = getchar();
         fflush(stdin);
         printf("\n");
@@ -165,12 +184,14 @@ void *eps_test(void *tid)
             break;
         case 'h':
         case 'H':
-            memset(&hk, 0x0, sizeof(hkparam_t));
-            eps_get_hk(&hk);
-            memset(&hk_out, 0x0, sizeof(eps_hk_out_t));
-            eps_get_hk_out(&hk_out);
-            print_hk(hk);
-            print_hk_out(hk_out);
+            if ((ret = eps_get_hk_raw(&hk_raw)) > 0)
+                print_hk(eps_hk_raw_hk(&hk_raw));
+            else
+                printf("Get housekeeping failed: %d\n", ret);
+            if ((ret = eps_get_hk_out_raw(&hk_out_raw)) > 0)
+                print_hk_out(eps_hk_raw_out(&hk_out_raw));
+            else
+                printf("Get output housekeeping failed: %d\n", ret);
             break;
         case 'c':
         case 'C':
@@ -181,16 +202,19 @@ void *eps_test(void *tid)
             int confsel = 0;
             if (scanf(" %d", &confsel) < 0)
                 break;
-            if (confsel == 1)
+            if ((confsel == 1 || confsel == 2) && (ret = eps_get_conf(conf)) < 0)
+            {
+                printf("Get config failed: %d\n", ret);
+            }
+            else if (confsel == 1)
             {
-                eps_get_conf(conf);
                 printval_conf_t(conf);
             }
             else if (confsel == 2)
             {
-                eps_get_conf(conf);
                 getval_conf_t(conf);
-                eps_set_conf(conf);
+                if ((ret = eps_set_conf(conf)) < 0)
+                    printf("Set config failed: %d\n", ret);
             }
             break;
         case 'l':
@@ -231,10 +255,15 @@ void *eps_test(void *tid)
             sleep(1);
             eps_hardreset();
             break;
+        case 's':
+        case 'S':
+            eps_stats_dump(NULL);
+            break;
         case 'q':
         case 'Q':
             printf("main: quitting...");
             done = 1;
+            reactor_stop();
             printf("\tdone = %d\n", done);
             break;
         default:
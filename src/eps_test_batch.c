@@ -0,0 +1,588 @@
+/**
+ * @file eps_test_batch.c
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Scripted mode of the EPS tester.
+ *
+ * Reads a command script, one command per line, and runs it back to back
+ * without prompts. Every executed command prints one JSON object per line on
+ * stdout with its return value and latency, so runs can be post-processed or
+ * used as throughput and soak tests. '#' starts a comment.
+ *
+ *      ping
+ *      hk                      housekeeping (GET_HK)
+ *      hk-out                  output housekeeping
+ *      fields MS SET...        housekeeping field sets (hk, out, vi, wdt, basic)
+ *                              from the cache, read if older than MS (0: any age)
+ *      lup-set N on|off        switch latchup N (1 -- 6)
+ *      lup-tgl N               toggle latchup N (1 -- 6)
+ *      conf-get
+ *      conf-set KEY=VAL ...    read, modify and write the configuration
+ *      reboot
+ *      hardreset
+ *      sleep MS
+ *      stats                   one line per command with the statistics, then
+ *                              one per device with the command outcome counters
+ *                              and watchdog kick timing, and one per priority
+ *                              class with its dispatch latency
+ *      agg                     one line per housekeeping channel with its
+ *                              orbit-window statistics, then one with the energy
+ *      device NAME             send the following commands to device NAME
+ *      repeat K ... end        run the enclosed commands K times (K = 0: until SIGINT)
+ *
+ * conf-set keys: ppt_mode, battheater_mode, battheater_low, battheater_high,
+ * normal[i], safe[i], on_delay[i], off_delay[i] (i = 0 -- 7), vboost[i] (i = 0 -- 2).
+ *
+ * @version 0.1
+ * @date 2021-04-15
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include "eps_extern.h"
+#include "eps_test_iface.h"
+#include "main.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define EPS_BATCH_MAX_CMDS 1024 // commands in a script
+#define EPS_BATCH_MAX_DEPTH 8   // nesting of repeat blocks
+#define EPS_BATCH_MAX_ARGS 48   // arguments of one command
+#define EPS_BATCH_LINE 512      // longest script line
+
+typedef enum
+{
+    BATCH_PING,
+    BATCH_HK,
+    BATCH_HK_OUT,
+    BATCH_FIELDS,
+    BATCH_LUP_SET,
+    BATCH_LUP_TGL,
+    BATCH_CONF_GET,
+    BATCH_CONF_SET,
+    BATCH_REBOOT,
+    BATCH_HARDRESET,
+    BATCH_SLEEP,
+    BATCH_STATS,
+    BATCH_AGG,
+    BATCH_DEVICE,
+    BATCH_REPEAT,
+    BATCH_END
+} eps_batch_op;
+
+static const char *eps_batch_names[] = {
+    [BATCH_PING] = "ping",
+    [BATCH_HK] = "hk",
+    [BATCH_HK_OUT] = "hk-out",
+    [BATCH_FIELDS] = "fields",
+    [BATCH_LUP_SET] = "lup-set",
+    [BATCH_LUP_TGL] = "lup-tgl",
+    [BATCH_CONF_GET] = "conf-get",
+    [BATCH_CONF_SET] = "conf-set",
+    [BATCH_REBOOT] = "reboot",
+    [BATCH_HARDRESET] = "hardreset",
+    [BATCH_SLEEP] = "sleep",
+    [BATCH_STATS] = "stats",
+    [BATCH_AGG] = "agg",
+    [BATCH_DEVICE] = "device",
+    [BATCH_REPEAT] = "repeat",
+    [BATCH_END] = "end",
+};
+
+/**
+ * @brief One parsed script command.
+ *
+ */
+typedef struct
+{
+    eps_batch_op op;
+    int line;
+    int arg[2];  // latchup and state, sleep time, maximum age and field sets, repeat count, or index of the matching repeat / end
+    char *kv;    // conf-set assignments separated by spaces, or device name
+} eps_batch_cmd;
+
+static inline double eps_batch_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Applies one KEY=VAL to a configuration. Returns 1 on success, -1 on an unknown key.
+static int eps_batch_conf_kv(eps_config_t *conf, const char *kv)
+{
+    char key[32];
+    int idx = 0, val = 0, n = 0;
+    if (sscanf(kv, "%31[a-z_][%d]=%d%n", key, &idx, &val, &n) == 3 && kv[n] == '\0')
+    {
+        if (!strcmp(key, "normal") && idx >= 0 && idx < 8)
+            conf->output_normal_value[idx] = val;
+        else if (!strcmp(key, "safe") && idx >= 0 && idx < 8)
+            conf->output_safe_value[idx] = val;
+        else if (!strcmp(key, "on_delay") && idx >= 0 && idx < 8)
+            conf->output_initial_on_delay[idx] = val;
+        else if (!strcmp(key, "off_delay") && idx >= 0 && idx < 8)
+            conf->output_initial_off_delay[idx] = val;
+        else if (!strcmp(key, "vboost") && idx >= 0 && idx < 3)
+            conf->vboost[idx] = val;
+        else
+            return -1;
+        return 1;
+    }
+    if (sscanf(kv, "%31[a-z_]=%d%n", key, &val, &n) == 2 && kv[n] == '\0')
+    {
+        if (!strcmp(key, "ppt_mode"))
+            conf->ppt_mode = val;
+        else if (!strcmp(key, "battheater_mode"))
+            conf->battheater_mode = val;
+        else if (!strcmp(key, "battheater_low"))
+            conf->battheater_low = val;
+        else if (!strcmp(key, "battheater_high"))
+            conf->battheater_high = val;
+        else
+            return -1;
+        return 1;
+    }
+    return -1;
+}
+
+static const struct
+{
+    const char *name;
+    int set;
+} eps_batch_field_sets[] = {
+    {"hk", EPS_HK_LEGACY},
+    {"out", EPS_HK_OUT},
+    {"vi", EPS_HK_VI},
+    {"wdt", EPS_HK_WDT},
+    {"basic", EPS_HK_BASIC},
+};
+
+// Returns the EPS_HK_* set of a name, 0 if unknown.
+static int eps_batch_field_set(const char *name)
+{
+    for (int i = 0; i < (int)(sizeof(eps_batch_field_sets) / sizeof(eps_batch_field_sets[0])); i++)
+        if (!strcmp(name, eps_batch_field_sets[i].name))
+            return eps_batch_field_sets[i].set;
+    return 0;
+}
+
+// Parses one line into cmd. Returns 1 for a command, 0 for an empty line, -1 on error.
+static int eps_batch_parse_line(char *line, int lineno, eps_batch_cmd *cmd)
+{
+    char *hash = strchr(line, '#');
+    if (hash != NULL)
+        *hash = '\0';
+    char *argv[EPS_BATCH_MAX_ARGS], *save = NULL;
+    int argc = 0;
+    for (char *tok = strtok_r(line, " \t\r\n", &save); tok != NULL && argc < EPS_BATCH_MAX_ARGS; tok = strtok_r(NULL, " \t\r\n", &save))
+        argv[argc++] = tok;
+    if (argc == 0)
+        return 0;
+
+    memset(cmd, 0x0, sizeof(eps_batch_cmd));
+    cmd->line = lineno;
+    cmd->op = -1;
+    for (int i = 0; i < (int)(sizeof(eps_batch_names) / sizeof(eps_batch_names[0])); i++)
+        if (!strcmp(argv[0], eps_batch_names[i]))
+            cmd->op = i;
+
+    switch ((int)cmd->op)
+    {
+    case BATCH_LUP_SET:
+        if (argc != 3 || (strcmp(argv[2], "on") && strcmp(argv[2], "off")))
+            break;
+        cmd->arg[1] = !strcmp(argv[2], "on");
+        // fall through
+    case BATCH_LUP_TGL:
+        if (argc != 3 - (cmd->op == BATCH_LUP_TGL))
+            break;
+        cmd->arg[0] = atoi(argv[1]) - 1;
+        if (cmd->arg[0] < 0 || cmd->arg[0] > 5)
+            break;
+        return 1;
+    case BATCH_SLEEP:
+    case BATCH_REPEAT:
+        if (argc != 2 || (cmd->arg[0] = atoi(argv[1])) < 0)
+            break;
+        return 1;
+    case BATCH_FIELDS:
+        if (argc < 3 || (cmd->arg[0] = atoi(argv[1])) < 0)
+            break;
+        for (int i = 2; i < argc; i++)
+        {
+            int set = eps_batch_field_set(argv[i]);
+            if (set == 0)
+            {
+                fprintf(stderr, "eps_test_batch: line %d: unknown field set %s\n", lineno, argv[i]);
+                return -1;
+            }
+            cmd->arg[1] |= set;
+        }
+        return 1;
+    case BATCH_CONF_SET:
+    {
+        if (argc < 2)
+            break;
+        eps_config_t scratch;
+        size_t len = 0;
+        for (int i = 1; i < argc; i++)
+        {
+            if (eps_batch_conf_kv(&scratch, argv[i]) < 0)
+            {
+                fprintf(stderr, "eps_test_batch: line %d: unknown assignment %s\n", lineno, argv[i]);
+                return -1;
+            }
+            len += strlen(argv[i]) + 1;
+        }
+        cmd->kv = calloc(len, 1);
+        if (cmd->kv == NULL)
+            return -1;
+        for (int i = 1; i < argc; i++)
+        {
+            strcat(cmd->kv, argv[i]);
+            if (i < argc - 1)
+                strcat(cmd->kv, " ");
+        }
+        return 1;
+    }
+    case BATCH_DEVICE:
+        if (argc != 2 || (cmd->kv = strdup(argv[1])) == NULL)
+            break;
+        return 1;
+    case -1:
+        fprintf(stderr, "eps_test_batch: line %d: unknown command %s\n", lineno, argv[0]);
+        return -1;
+    default:
+        if (argc != 1)
+            break;
+        return 1;
+    }
+    fprintf(stderr, "eps_test_batch: line %d: bad arguments for %s\n", lineno, argv[0]);
+    return -1;
+}
+
+// Reads the whole script and matches repeat / end. Returns the number of commands, or -1.
+static int eps_batch_parse(FILE *fp, eps_batch_cmd *cmds)
+{
+    char line[EPS_BATCH_LINE];
+    int ncmds = 0, lineno = 0, depth = 0, open[EPS_BATCH_MAX_DEPTH];
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+        lineno++;
+        if (ncmds == EPS_BATCH_MAX_CMDS)
+        {
+            fprintf(stderr, "eps_test_batch: line %d: more than %d commands\n", lineno, EPS_BATCH_MAX_CMDS);
+            return -1;
+        }
+        int ret = eps_batch_parse_line(line, lineno, &cmds[ncmds]);
+        if (ret < 0)
+            return -1;
+        if (ret == 0)
+            continue;
+        if (cmds[ncmds].op == BATCH_REPEAT)
+        {
+            if (depth == EPS_BATCH_MAX_DEPTH)
+            {
+                fprintf(stderr, "eps_test_batch: line %d: repeat nested too deep\n", lineno);
+                return -1;
+            }
+            open[depth++] = ncmds;
+        }
+        else if (cmds[ncmds].op == BATCH_END)
+        {
+            if (depth == 0)
+            {
+                fprintf(stderr, "eps_test_batch: line %d: end without repeat\n", lineno);
+                return -1;
+            }
+            int start = open[--depth];
+            cmds[start].arg[1] = ncmds;
+            cmds[ncmds].arg[0] = start;
+        }
+        ncmds++;
+    }
+    if (depth != 0)
+    {
+        fprintf(stderr, "eps_test_batch: repeat on line %d is not closed\n", cmds[open[depth - 1]].line);
+        return -1;
+    }
+    return ncmds;
+}
+
+static void eps_batch_print_hk(const hkparam_t *hk)
+{
+    printf(",\"pv\":[%u,%u,%u],\"pc\":%u,\"bv\":%u,\"sc\":%u,\"temp\":[%d,%d,%d,%d],\"batt_temp\":[%d,%d]"
+           ",\"latchup\":[%u,%u,%u,%u,%u,%u],\"reset\":%u,\"bootcount\":%u,\"sw_errors\":%u,\"ppt_mode\":%u,\"channel_status\":%u",
+           hk->pv[0], hk->pv[1], hk->pv[2], hk->pc, hk->bv, hk->sc, hk->temp[0], hk->temp[1], hk->temp[2], hk->temp[3],
+           hk->batt_temp[0], hk->batt_temp[1], hk->latchup[0], hk->latchup[1], hk->latchup[2], hk->latchup[3],
+           hk->latchup[4], hk->latchup[5], hk->reset, hk->bootcount, hk->sw_errors, hk->ppt_mode, hk->channel_status);
+}
+
+static void eps_batch_print_array(const char *name, const void *arr, int n, int size)
+{
+    printf(",\"%s\":[", name);
+    for (int i = 0; i < n; i++)
+    {
+        // the housekeeping structures are packed, fetch without assuming alignment
+        uint8_t u8;
+        uint16_t u16;
+        if (size == 1)
+            memcpy(&u8, (const uint8_t *)arr + i, 1);
+        else
+            memcpy(&u16, (const uint8_t *)arr + 2 * i, 2);
+        printf(i ? ",%u" : "%u", size == 1 ? u8 : u16);
+    }
+    printf("]");
+}
+
+static void eps_batch_print_hk_out(const eps_hk_out_t *hk_out)
+{
+    eps_batch_print_array("curout", hk_out->curout, 6, 2);
+    eps_batch_print_array("output", hk_out->output, 8, 1);
+    eps_batch_print_array("output_on_delta", hk_out->output_on_delta, 8, 2);
+    eps_batch_print_array("output_off_delta", hk_out->output_off_delta, 8, 2);
+    eps_batch_print_array("latchup", hk_out->latchup, 6, 2);
+}
+
+// Prints each set as an object of its own, with its age in ms.
+static void eps_batch_print_fields(const eps_hk_view_t *v, int sets)
+{
+    double now = eps_batch_now();
+    if (sets & EPS_HK_LEGACY)
+    {
+        printf(",\"hk\":{\"age_ms\":%.1f", (now - v->t_hk * 1e-9) * 1e3);
+        eps_batch_print_hk(&v->hk);
+        printf("}");
+    }
+    if (sets & EPS_HK_OUT)
+    {
+        printf(",\"out\":{\"age_ms\":%.1f", (now - v->t_out * 1e-9) * 1e3);
+        eps_batch_print_hk_out(&v->hk_out);
+        printf("}");
+    }
+    if (sets & EPS_HK_VI)
+    {
+        printf(",\"vi\":{\"age_ms\":%.1f", (now - v->t_vi * 1e-9) * 1e3);
+        eps_batch_print_array("vboost", v->vi.vboost, 3, 2);
+        eps_batch_print_array("curin", v->vi.curin, 3, 2);
+        printf(",\"vbatt\":%u,\"cursun\":%u,\"cursys\":%u}", v->vi.vbatt, v->vi.cursun, v->vi.cursys);
+    }
+    if (sets & EPS_HK_WDT)
+        printf(",\"wdt\":{\"age_ms\":%.1f,\"i2c_time_left\":%u,\"gnd_time_left\":%u,\"i2c_count\":%u,\"gnd_count\":%u}",
+               (now - v->t_wdt * 1e-9) * 1e3, v->wdt.i2c_time_left, v->wdt.gnd_time_left, v->wdt.i2c_count, v->wdt.gnd_count);
+    if (sets & EPS_HK_BASIC)
+        printf(",\"basic\":{\"age_ms\":%.1f,\"bootcount\":%u,\"temp\":[%d,%d,%d,%d,%d,%d],\"bootcause\":%u,\"battmode\":%u,\"ppt_mode\":%u}",
+               (now - v->t_basic * 1e-9) * 1e3, v->basic.bootcount, v->basic.temp[0], v->basic.temp[1], v->basic.temp[2],
+               v->basic.temp[3], v->basic.temp[4], v->basic.temp[5], v->basic.bootcause, v->basic.battmode, v->basic.ppt_mode);
+}
+
+static void eps_batch_print_conf(const eps_config_t *conf)
+{
+    printf(",\"ppt_mode\":%u,\"battheater_mode\":%u,\"battheater_low\":%d,\"battheater_high\":%d",
+           conf->ppt_mode, conf->battheater_mode, conf->battheater_low, conf->battheater_high);
+    eps_batch_print_array("normal", conf->output_normal_value, 8, 1);
+    eps_batch_print_array("safe", conf->output_safe_value, 8, 1);
+    eps_batch_print_array("on_delay", conf->output_initial_on_delay, 8, 2);
+    eps_batch_print_array("off_delay", conf->output_initial_off_delay, 8, 2);
+    eps_batch_print_array("vboost", conf->vboost, 3, 2);
+}
+
+static void eps_batch_print_stats()
+{
+    for (int op = 0; op < EPS_OP_MAX; op++)
+    {
+        eps_stats_t st;
+        if (eps_stats_get(op, &st) < 0 || st.calls == 0)
+            continue;
+        printf("{\"stats\":\"%s\",\"calls\":%llu,\"errors\":%llu,\"local\":%llu,\"mean_us\":%.1f,\"p50_us\":%.1f,\"p99_us\":%.1f,\"p999_us\":%.1f,\"max_us\":%.1f}\n",
+               eps_op_name(op), (unsigned long long)st.calls, (unsigned long long)st.errors, (unsigned long long)st.local, st.mean_ns * 1e-3,
+               st.p50_ns * 1e-3, st.p99_ns * 1e-3, st.p999_ns * 1e-3, st.max_ns * 1e-3);
+    }
+    for (int i = 0; i < eps_dev_count(); i++)
+    {
+        eps_retry_stats_t rt;
+        if (eps_dev_retry_stats_get(eps_dev_at(i), &rt) < 0)
+            continue;
+        printf("{\"retry\":\"%s\",\"ok\":%llu,\"ok_retried\":%llu,\"failed\":%llu,\"rejected\":%llu,\"expired\":%llu,\"retries\":%llu,\"bus_resets\":%llu}\n",
+               eps_dev_name(eps_dev_at(i)), (unsigned long long)rt.ok, (unsigned long long)rt.ok_retried,
+               (unsigned long long)rt.failed, (unsigned long long)rt.rejected, (unsigned long long)rt.expired,
+               (unsigned long long)rt.retries, (unsigned long long)rt.bus_resets);
+        eps_wdt_stats_t ws;
+        if (eps_dev_wdt_stats_get(eps_dev_at(i), &ws) > 0 && ws.kicks + ws.failures > 0)
+        {
+            printf("{\"wdt\":\"%s\",\"rt\":%s,\"kicks\":%llu,\"failures\":%llu,\"missed\":%llu,\"wake_max_us\":%.1f,\"jitter_max_us\":%.1f,\"margin_min_s\":%.3f",
+                   eps_dev_name(eps_dev_at(i)), ws.rt ? "true" : "false", (unsigned long long)ws.kicks, (unsigned long long)ws.failures,
+                   (unsigned long long)ws.missed, ws.wake_max_ns * 1e-3, ws.jitter_max_ns * 1e-3, ws.margin_min_ns * 1e-9);
+            printf(",\"jitter_hist_us\":{");
+            for (int b = 0, first = 1; b < EPS_WDT_HIST_BINS; b++)
+                if (ws.jitter_hist[b])
+                    printf(first-- > 0 ? "\"<%llu\":%llu" : ",\"<%llu\":%llu", 1ULL << b, (unsigned long long)ws.jitter_hist[b]);
+            printf("}}\n");
+        }
+        for (int prio = 0; prio < EPS_PRIO_MAX; prio++)
+        {
+            eps_dispatch_stats_t ds;
+            if (eps_dev_dispatch_stats_get(eps_dev_at(i), prio, &ds) < 0 || ds.dispatched == 0)
+                continue;
+            printf("{\"dispatch\":\"%s\",\"prio\":\"%s\",\"dispatched\":%llu,\"preempted\":%llu,\"mean_us\":%.1f,\"max_us\":%.1f}\n",
+                   eps_dev_name(eps_dev_at(i)), eps_prio_name(prio), (unsigned long long)ds.dispatched,
+                   (unsigned long long)ds.preempted, ds.mean_ns * 1e-3, ds.max_ns * 1e-3);
+        }
+    }
+}
+
+static void eps_batch_print_agg(eps_dev_t *dev)
+{
+    for (int ch = 0; ch < EPS_AGG_CH_MAX; ch++)
+    {
+        eps_agg_stat_t st;
+        if (eps_dev_agg_get(dev, ch, &st) <= 0)
+            continue;
+        printf("{\"agg\":\"%s\",\"dev\":\"%s\",\"samples\":%llu,\"last\":%d,\"min\":%d,\"max\":%d,\"mean\":%.2f,\"ewma\":%.2f}\n",
+               eps_agg_ch_name(ch), eps_dev_name(dev), (unsigned long long)st.samples, st.last, st.min, st.max, st.mean, st.ewma);
+    }
+    eps_agg_energy_t en;
+    if (eps_dev_agg_energy_get(dev, &en) < 0)
+        return;
+    printf("{\"energy\":\"%s\",\"window_s\":%.1f,\"e_in_j\":%.3f,\"e_out_j\":%.3f,\"q_rail_c\":[%.4f,%.4f,%.4f,%.4f,%.4f,%.4f],\"e_in_total_j\":%.3f,\"e_out_total_j\":%.3f}\n",
+           eps_dev_name(dev), en.window_ns * 1e-9, en.e_in_j, en.e_out_j, en.q_rail_c[0], en.q_rail_c[1], en.q_rail_c[2],
+           en.q_rail_c[3], en.q_rail_c[4], en.q_rail_c[5], en.e_in_total_j, en.e_out_total_j);
+}
+
+int eps_test_batch(FILE *fp)
+{
+    eps_batch_cmd *cmds = calloc(EPS_BATCH_MAX_CMDS, sizeof(eps_batch_cmd));
+    if (cmds == NULL)
+        return -1;
+    int ncmds = eps_batch_parse(fp, cmds);
+    if (ncmds < 0)
+    {
+        free(cmds);
+        return -1;
+    }
+
+    int iter[EPS_BATCH_MAX_CMDS] = {0}; // completed passes of each repeat block
+    unsigned long long seq = 0, errors = 0;
+    eps_dev_t *dev = eps_dev_at(0);
+    double t_start = eps_batch_now();
+    for (int pc = 0; pc < ncmds && !done; pc++)
+    {
+        eps_batch_cmd *cmd = &cmds[pc];
+        hkparam_t hk;
+        eps_hk_out_t hk_out;
+        eps_hk_view_t view;
+        eps_config_t conf;
+        int ret = 1;
+
+        if (cmd->op == BATCH_REPEAT)
+        {
+            if (cmd->arg[0] > 0 && iter[pc] >= cmd->arg[0])
+            {
+                iter[pc] = 0;
+                pc = cmd->arg[1]; // skip past the matching end
+            }
+            continue;
+        }
+        if (cmd->op == BATCH_END)
+        {
+            iter[cmd->arg[0]]++;
+            pc = cmd->arg[0] - 1; // back to the repeat, which decides
+            continue;
+        }
+        if (cmd->op == BATCH_STATS)
+        {
+            eps_batch_print_stats();
+            continue;
+        }
+        if (cmd->op == BATCH_AGG)
+        {
+            eps_batch_print_agg(dev);
+            continue;
+        }
+
+        double t0 = eps_batch_now();
+        switch (cmd->op)
+        {
+        case BATCH_PING:
+            ret = eps_dev_ping(dev);
+            break;
+        case BATCH_HK:
+            ret = eps_dev_get_hk(dev, &hk);
+            break;
+        case BATCH_HK_OUT:
+            ret = eps_dev_get_hk_out(dev, &hk_out);
+            break;
+        case BATCH_FIELDS:
+            ret = eps_dev_hk_get_fields(dev, cmd->arg[1], &view, cmd->arg[0]);
+            break;
+        case BATCH_LUP_SET:
+            ret = eps_dev_lup_set(dev, cmd->arg[0], cmd->arg[1]);
+            break;
+        case BATCH_LUP_TGL:
+            ret = eps_dev_tgl_lup(dev, cmd->arg[0]);
+            break;
+        case BATCH_CONF_GET:
+            ret = eps_dev_get_conf(dev, &conf);
+            break;
+        case BATCH_CONF_SET:
+        {
+            if ((ret = eps_dev_get_conf(dev, &conf)) < 0)
+                break;
+            char kv[EPS_BATCH_LINE], *save = NULL;
+            strncpy(kv, cmd->kv, sizeof(kv) - 1);
+            kv[sizeof(kv) - 1] = '\0';
+            for (char *tok = strtok_r(kv, " ", &save); tok != NULL; tok = strtok_r(NULL, " ", &save))
+                eps_batch_conf_kv(&conf, tok);
+            ret = eps_dev_set_conf(dev, &conf);
+            break;
+        }
+        case BATCH_REBOOT:
+            ret = eps_dev_reboot(dev);
+            break;
+        case BATCH_HARDRESET:
+            ret = eps_dev_hardreset(dev);
+            break;
+        case BATCH_DEVICE:
+            dev = eps_dev_find(cmd->kv);
+            ret = dev != NULL ? 1 : -ENODEV;
+            break;
+        case BATCH_SLEEP:
+        {
+            struct timespec ts = {.tv_sec = cmd->arg[0] / 1000, .tv_nsec = (cmd->arg[0] % 1000) * 1000000L};
+            while (nanosleep(&ts, &ts) < 0 && errno == EINTR && !done)
+                ;
+            break;
+        }
+        default:
+            break;
+        }
+        double t1 = eps_batch_now();
+
+        seq++;
+        errors += ret < 0;
+        printf("{\"seq\":%llu,\"line\":%d,\"dev\":\"%s\",\"cmd\":\"%s\",\"ret\":%d,\"t_s\":%.6f,\"lat_us\":%.1f",
+               seq, cmd->line, dev != NULL ? eps_dev_name(dev) : "", eps_batch_names[cmd->op], ret, t0 - t_start, (t1 - t0) * 1e6);
+        if (ret >= 0 && cmd->op == BATCH_HK)
+            eps_batch_print_hk(&hk);
+        else if (ret >= 0 && cmd->op == BATCH_HK_OUT)
+            eps_batch_print_hk_out(&hk_out);
+        else if (ret >= 0 && cmd->op == BATCH_FIELDS)
+            eps_batch_print_fields(&view, cmd->arg[1]);
+        else if (ret >= 0 && cmd->op == BATCH_CONF_GET)
+            eps_batch_print_conf(&conf);
+        printf("}\n");
+    }
+    double elapsed = eps_batch_now() - t_start;
+    printf("{\"summary\":true,\"cmds\":%llu,\"errors\":%llu,\"elapsed_s\":%.6f,\"rate_hz\":%.1f,\"interrupted\":%s}\n",
+           seq, errors, elapsed, elapsed > 0 ? seq / elapsed : 0, done ? "true" : "false");
+    fflush(stdout);
+
+    for (int i = 0; i < ncmds; i++)
+        free(cmds[i].kv);
+    free(cmds);
+    return errors ? 0 : 1;
+}
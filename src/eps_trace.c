@@ -0,0 +1,222 @@
+/**
+ * @file eps_trace.c
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Capture of the I2C transactions of the EPS module.
+ *
+ * The program is linked with -Wl,--wrap for the i2cbus functions, so every
+ * call from p31u.o and eps.o lands here and is forwarded to the bus driver
+ * (or the simulator). When EPS_TRACE names a file, each call is appended to
+ * it as one eps_trace_rec_t with its payload, written with a single write()
+ * so that records of the bus workers never interleave. Batches (eps_i2c.h)
+ * then run as separate transfers, so that each of them is recorded.
+ *
+ * @version 0.1
+ * @date 2021-04-15
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include "i2cbus/i2cbus.h"
+#include "eps_trace.h"
+#include "eps_i2c.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define EPS_TRACE_HANDLES 32 // simultaneously open i2cbus handles
+
+int __real_i2cbus_open(i2cbus *dev, int id, int addr);
+ssize_t __real_i2cbus_read(i2cbus *dev, void *buf, ssize_t len);
+ssize_t __real_i2cbus_write(i2cbus *dev, const void *buf, ssize_t len);
+int __real_i2cbus_xfer(i2cbus *dev, void *outbuf, ssize_t outlen, void *inbuf, ssize_t inlen, unsigned long timeout_usec);
+int __real_i2cbus_close(i2cbus *dev);
+int __real_eps_i2c_batch(i2cbus *bus, eps_i2c_op_t *ops, int n);
+
+static pthread_once_t eps_trace_once = PTHREAD_ONCE_INIT;
+static int eps_trace_fd = -1;
+static uint64_t eps_trace_t0;
+
+static pthread_mutex_t eps_trace_lock = PTHREAD_MUTEX_INITIALIZER; // protects the handle table
+static struct
+{
+    const i2cbus *handle;
+    uint8_t bus;
+    uint8_t addr;
+} eps_trace_handles[EPS_TRACE_HANDLES];
+
+static inline uint64_t eps_trace_now(clockid_t clk)
+{
+    struct timespec ts;
+    clock_gettime(clk, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void eps_trace_setup()
+{
+    const char *path = getenv("EPS_TRACE");
+    if (path == NULL || path[0] == '\0')
+        return;
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        perror("eps_trace");
+        return;
+    }
+    eps_trace_hdr_t hdr = {.magic = EPS_TRACE_MAGIC, .version = EPS_TRACE_VERSION, .rec_size = sizeof(eps_trace_rec_t)};
+    hdr.t_real_ns = eps_trace_now(CLOCK_REALTIME);
+    hdr.t_mono_ns = eps_trace_t0 = eps_trace_now(CLOCK_MONOTONIC);
+    if (write(fd, &hdr, sizeof(hdr)) != sizeof(hdr))
+    {
+        perror("eps_trace");
+        close(fd);
+        return;
+    }
+    eps_trace_fd = fd;
+}
+
+static inline int eps_trace_on()
+{
+    pthread_once(&eps_trace_once, eps_trace_setup);
+    return eps_trace_fd >= 0;
+}
+
+static void eps_trace_dev(const i2cbus *handle, eps_trace_rec_t *rec)
+{
+    pthread_mutex_lock(&eps_trace_lock);
+    for (int i = 0; i < EPS_TRACE_HANDLES; i++)
+    {
+        if (eps_trace_handles[i].handle == handle)
+        {
+            rec->bus = eps_trace_handles[i].bus;
+            rec->addr = eps_trace_handles[i].addr;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&eps_trace_lock);
+}
+
+static void eps_trace_emit(eps_trace_rec_t *rec, uint64_t t_start, int ret, int err, const void *wbuf, ssize_t wlen, const void *rbuf, ssize_t rlen)
+{
+    uint8_t buf[sizeof(eps_trace_rec_t) + 2 * EPS_TRACE_MAX_DATA + 8] = {0};
+    uint64_t t_end = eps_trace_now(CLOCK_MONOTONIC);
+    if (wbuf == NULL || wlen < 0)
+        wlen = 0;
+    if (rbuf == NULL || rlen < 0 || ret < 0)
+        rlen = 0;
+    wlen = wlen > EPS_TRACE_MAX_DATA ? EPS_TRACE_MAX_DATA : wlen;
+    rlen = rlen > EPS_TRACE_MAX_DATA ? EPS_TRACE_MAX_DATA : rlen;
+    rec->t_ns = t_start - eps_trace_t0;
+    rec->lat_ns = t_end - t_start > UINT32_MAX ? UINT32_MAX : t_end - t_start;
+    rec->ret = ret;
+    rec->err = ret < 0 ? err : 0;
+    rec->wlen = wlen;
+    rec->rlen = rlen;
+    rec->cmd = wlen > 0 ? ((const uint8_t *)wbuf)[0] : 0;
+    memcpy(buf, rec, sizeof(eps_trace_rec_t));
+    memcpy(buf + sizeof(eps_trace_rec_t), wbuf, wlen);
+    memcpy(buf + sizeof(eps_trace_rec_t) + wlen, rbuf, rlen);
+    write(eps_trace_fd, buf, EPS_TRACE_REC_SIZE(rec));
+}
+
+int __wrap_i2cbus_open(i2cbus *dev, int id, int addr)
+{
+    if (!eps_trace_on())
+        return __real_i2cbus_open(dev, id, addr);
+    uint64_t t_start = eps_trace_now(CLOCK_MONOTONIC);
+    int ret = __real_i2cbus_open(dev, id, addr);
+    int err = errno;
+    eps_trace_rec_t rec = {.op = EPS_TRACE_OPEN, .bus = id, .addr = addr};
+    if (ret >= 0)
+    {
+        pthread_mutex_lock(&eps_trace_lock);
+        for (int i = 0; i < EPS_TRACE_HANDLES; i++)
+        {
+            if (eps_trace_handles[i].handle == NULL || eps_trace_handles[i].handle == dev)
+            {
+                eps_trace_handles[i].handle = dev;
+                eps_trace_handles[i].bus = id;
+                eps_trace_handles[i].addr = addr;
+                break;
+            }
+        }
+        pthread_mutex_unlock(&eps_trace_lock);
+    }
+    eps_trace_emit(&rec, t_start, ret, err, NULL, 0, NULL, 0);
+    errno = err;
+    return ret;
+}
+
+int __wrap_i2cbus_close(i2cbus *dev)
+{
+    if (!eps_trace_on())
+        return __real_i2cbus_close(dev);
+    eps_trace_rec_t rec = {.op = EPS_TRACE_CLOSE};
+    eps_trace_dev(dev, &rec);
+    uint64_t t_start = eps_trace_now(CLOCK_MONOTONIC);
+    int ret = __real_i2cbus_close(dev);
+    int err = errno;
+    pthread_mutex_lock(&eps_trace_lock);
+    for (int i = 0; i < EPS_TRACE_HANDLES; i++)
+        if (eps_trace_handles[i].handle == dev)
+            eps_trace_handles[i].handle = NULL;
+    pthread_mutex_unlock(&eps_trace_lock);
+    eps_trace_emit(&rec, t_start, ret, err, NULL, 0, NULL, 0);
+    errno = err;
+    return ret;
+}
+
+ssize_t __wrap_i2cbus_write(i2cbus *dev, const void *buf, ssize_t len)
+{
+    if (!eps_trace_on())
+        return __real_i2cbus_write(dev, buf, len);
+    eps_trace_rec_t rec = {.op = EPS_TRACE_WRITE};
+    eps_trace_dev(dev, &rec);
+    uint64_t t_start = eps_trace_now(CLOCK_MONOTONIC);
+    ssize_t ret = __real_i2cbus_write(dev, buf, len);
+    int err = errno;
+    eps_trace_emit(&rec, t_start, ret, err, buf, len, NULL, 0);
+    errno = err;
+    return ret;
+}
+
+ssize_t __wrap_i2cbus_read(i2cbus *dev, void *buf, ssize_t len)
+{
+    if (!eps_trace_on())
+        return __real_i2cbus_read(dev, buf, len);
+    eps_trace_rec_t rec = {.op = EPS_TRACE_READ};
+    eps_trace_dev(dev, &rec);
+    uint64_t t_start = eps_trace_now(CLOCK_MONOTONIC);
+    ssize_t ret = __real_i2cbus_read(dev, buf, len);
+    int err = errno;
+    eps_trace_emit(&rec, t_start, ret, err, NULL, 0, buf, len);
+    errno = err;
+    return ret;
+}
+
+int __wrap_i2cbus_xfer(i2cbus *dev, void *outbuf, ssize_t outlen, void *inbuf, ssize_t inlen, unsigned long timeout_usec)
+{
+    if (!eps_trace_on())
+        return __real_i2cbus_xfer(dev, outbuf, outlen, inbuf, inlen, timeout_usec);
+    eps_trace_rec_t rec = {.op = EPS_TRACE_XFER, .delay_us = timeout_usec};
+    eps_trace_dev(dev, &rec);
+    uint64_t t_start = eps_trace_now(CLOCK_MONOTONIC);
+    int ret = __real_i2cbus_xfer(dev, outbuf, outlen, inbuf, inlen, timeout_usec);
+    int err = errno;
+    eps_trace_emit(&rec, t_start, ret, err, outbuf, outlen, inbuf, inlen);
+    errno = err;
+    return ret;
+}
+
+int __wrap_eps_i2c_batch(i2cbus *bus, eps_i2c_op_t *ops, int n)
+{
+    if (!eps_trace_on())
+        return __real_eps_i2c_batch(bus, ops, n);
+    // one I2C_RDWR would bypass the wrappers above; record every exchange
+    return eps_i2c_batch_seq(bus, ops, n);
+}
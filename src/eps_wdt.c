@@ -0,0 +1,253 @@
+/**
+ * @file eps_wdt.c
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Ground watchdog kicker of the EPS.
+ *
+ * One thread kicks the P31u ground watchdog of every device each
+ * EPS_WDT_PERIOD_MS, sleeping to absolute CLOCK_MONOTONIC deadlines so that
+ * late wakeups do not push the following kicks back. With EPS_WDT_RT_PRIO
+ * set, the thread runs SCHED_FIFO at that priority and the process memory is
+ * locked; EPS_WDT_CPU pins it to one CPU.
+ *
+ * Kicks do not go through the command queue, whose worker runs at normal
+ * priority behind any queued commands. The thread opens its own handles and
+ * takes the bus lock of eps_i2c_bus_lock() for each kick, which the worker
+ * holds for each command. That lock has priority inheritance, so a kick
+ * waits for at most the command already on the bus, run at the priority of
+ * the kicker; the wait shows in the jitter statistics.
+ *
+ * @version 0.1
+ * @date 2021-04-15
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#define _GNU_SOURCE
+#include "eps.h"
+#include "eps_i2c.h"
+#include "eps_proto.h"
+#include <main.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+/**
+ * @brief Kicker state of one device.
+ *
+ */
+typedef struct
+{
+    pthread_mutex_t m; // protects st; priority inheritance, the kicker may be real-time
+    eps_wdt_stats_t st;
+    i2cbus bus[1];
+    int bus_id;
+    int open;
+    uint64_t t_last; // last successful kick, 0 before the first
+} eps_wdt_dev;
+
+static eps_wdt_dev eps_wdt_devs[EPS_DEV_MAX];
+static pthread_once_t eps_wdt_once = PTHREAD_ONCE_INIT;
+
+static inline uint64_t eps_wdt_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void eps_wdt_init_locks()
+{
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT);
+    for (int i = 0; i < EPS_DEV_MAX; i++)
+        pthread_mutex_init(&eps_wdt_devs[i].m, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+// Bin of a value: 0 below 1, i for [2^(i-1), 2^i), the last bin above.
+static inline int eps_wdt_bin(uint64_t v)
+{
+    int b = v == 0 ? 0 : 64 - __builtin_clzll(v);
+    return b < EPS_WDT_HIST_BINS ? b : EPS_WDT_HIST_BINS - 1;
+}
+
+// Pins the calling thread and makes it real-time as the environment asks.
+// Returns 1 if it runs SCHED_FIFO with memory locked, 0 otherwise.
+static int eps_wdt_setup_thread()
+{
+    const char *cpu = getenv(EPS_WDT_CPU_ENV);
+    if (cpu != NULL && *cpu != '\0')
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(atoi(cpu), &set);
+        int ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (ret != 0)
+            fprintf(stderr, "eps_wdt: pinning to CPU %s: %s\n", cpu, strerror(ret));
+    }
+    const char *prio = getenv(EPS_WDT_RT_PRIO_ENV);
+    int p = prio != NULL ? atoi(prio) : 0;
+    if (p <= 0)
+        return 0;
+    // page faults in the kick path would undo the scheduling guarantees
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0)
+    {
+        fprintf(stderr, "eps_wdt: mlockall: %s, staying at normal priority\n", strerror(errno));
+        return 0;
+    }
+    struct sched_param sp = {.sched_priority = p};
+    int ret = pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp);
+    if (ret != 0)
+    {
+        fprintf(stderr, "eps_wdt: SCHED_FIFO %d: %s, staying at normal priority\n", p, strerror(ret));
+        munlockall();
+        return 0;
+    }
+    return 1;
+}
+
+// Sends one kick. Returns 1 on success, negative on failure.
+static int eps_wdt_kick(i2cbus *bus)
+{
+    uint8_t cmd[] = {P31U_CMD_RESET_WDT, P31U_RESET_WDT_MAGIC};
+    uint8_t reply[P31U_REPLY_HDR_SZ];
+    int ret = i2cbus_xfer(bus, cmd, sizeof(cmd), reply, sizeof(reply), EPS_XFER_DELAY);
+    if (ret < 0)
+        return ret;
+    return reply[0] == cmd[0] && reply[1] == 0 ? 1 : -EIO;
+}
+
+// Kicks one device, retrying with backoff, and records the timing.
+static void eps_wdt_serve(eps_wdt_dev *w, uint64_t deadline)
+{
+    int ret = -1;
+    unsigned backoff_us = EPS_RETRY_BACKOFF_US;
+    for (int n = 0; n <= EPS_WDT_RETRIES && !done; n++)
+    {
+        if (!w->open)
+            break;
+        if ((ret = eps_i2c_bus_lock(w->bus_id)) > 0)
+        {
+            ret = eps_wdt_kick(w->bus);
+            eps_i2c_bus_unlock(w->bus_id);
+        }
+        if (ret > 0)
+            break;
+        // give up on this period rather than delay the next kick
+        if (eps_wdt_now() + backoff_us * 1000ULL >= deadline + EPS_WDT_PERIOD_MS * 1000000ULL)
+            break;
+        struct timespec ts = {.tv_sec = 0, .tv_nsec = backoff_us * 1000L};
+        nanosleep(&ts, NULL);
+        backoff_us = backoff_us * 2 > EPS_RETRY_BACKOFF_MAX_US ? EPS_RETRY_BACKOFF_MAX_US : backoff_us * 2;
+    }
+    uint64_t now = eps_wdt_now();
+    pthread_mutex_lock(&w->m);
+    if (ret < 0)
+        w->st.failures++;
+    else
+    {
+        w->st.kicks++;
+        if (w->t_last != 0)
+        {
+            uint64_t interval = now - w->t_last;
+            uint64_t period = EPS_WDT_PERIOD_MS * 1000000ULL;
+            uint64_t jitter = interval > period ? interval - period : period - interval;
+            uint64_t timeout = EPS_WDT_TIMEOUT_S * 1000000000ULL;
+            uint64_t margin = interval < timeout ? timeout - interval : 0;
+            if (jitter > w->st.jitter_max_ns)
+                w->st.jitter_max_ns = jitter;
+            if (w->st.margin_min_ns == 0 || margin < w->st.margin_min_ns)
+                w->st.margin_min_ns = margin;
+            w->st.jitter_hist[eps_wdt_bin(jitter / 1000)]++;
+            w->st.margin_hist[eps_wdt_bin(margin / 1000000)]++;
+        }
+        w->t_last = now;
+    }
+    pthread_mutex_unlock(&w->m);
+}
+
+void *eps_wdt_thread(void *tid)
+{
+    pthread_once(&eps_wdt_once, eps_wdt_init_locks);
+    int rt = eps_wdt_setup_thread();
+    int ndevs = eps_dev_count();
+    for (int i = 0; i < ndevs; i++)
+    {
+        eps_wdt_dev *w = &eps_wdt_devs[i];
+        int bus_id, addr;
+        eps_dev_addr(eps_dev_at(i), &bus_id, &addr);
+        w->bus_id = bus_id;
+        w->open = i2cbus_open(w->bus, bus_id, addr) >= 0;
+        if (!w->open)
+            fprintf(stderr, "eps_wdt: opening %s (bus %d, 0x%02x) failed\n", eps_dev_name(eps_dev_at(i)), bus_id, addr);
+        pthread_mutex_lock(&w->m);
+        w->st.rt = rt;
+        pthread_mutex_unlock(&w->m);
+    }
+    uint64_t period = EPS_WDT_PERIOD_MS * 1000000ULL;
+    uint64_t deadline = eps_wdt_now();
+    while (!done)
+    {
+        struct timespec ts = {.tv_sec = deadline / 1000000000ULL, .tv_nsec = deadline % 1000000000ULL};
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+            ;
+        if (done)
+            break;
+        uint64_t wake = eps_wdt_now() - deadline;
+        for (int i = 0; i < ndevs; i++)
+            eps_wdt_serve(&eps_wdt_devs[i], deadline);
+        // stay on the original grid; periods that have passed are skipped
+        uint64_t now = eps_wdt_now(), missed = 0;
+        deadline += period;
+        if (deadline <= now)
+        {
+            missed = (now - deadline) / period + 1;
+            deadline += missed * period;
+        }
+        for (int i = 0; i < ndevs; i++)
+        {
+            pthread_mutex_lock(&eps_wdt_devs[i].m);
+            if (wake > eps_wdt_devs[i].st.wake_max_ns)
+                eps_wdt_devs[i].st.wake_max_ns = wake;
+            eps_wdt_devs[i].st.missed += missed;
+            pthread_mutex_unlock(&eps_wdt_devs[i].m);
+        }
+    }
+    for (int i = 0; i < ndevs; i++)
+    {
+        if (eps_wdt_devs[i].open)
+            i2cbus_close(eps_wdt_devs[i].bus);
+        eps_wdt_devs[i].open = 0;
+    }
+    return NULL;
+}
+
+int eps_dev_wdt_stats_get(eps_dev_t *dev, eps_wdt_stats_t *st)
+{
+    if (st == NULL)
+    {
+        return -EINVAL;
+    }
+    if (dev == NULL)
+    {
+        return -ENODEV;
+    }
+    pthread_once(&eps_wdt_once, eps_wdt_init_locks);
+    eps_wdt_dev *w = &eps_wdt_devs[eps_dev_index(dev)];
+    pthread_mutex_lock(&w->m);
+    *st = w->st;
+    pthread_mutex_unlock(&w->m);
+    return 1;
+}
+
+int eps_wdt_stats_get(eps_wdt_stats_t *st)
+{
+    return eps_dev_wdt_stats_get(eps_dev_at(0), st);
+}
@@ -12,17 +12,196 @@
 #include <main.h>
 #include <modules.h>
 #undef MAIN_PRIVATE
+#include "reactor.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
 #include <pthread.h>
 #include <signal.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <time.h>
 
 int sys_boot_count = -1;
 volatile sig_atomic_t done = 0;
 __thread int sys_status;
 
+// Reads a signal queued on the signalfd and shuts down.
+static void on_signal(int fd, uint32_t events, void *arg)
+{
+    struct signalfd_siginfo si;
+    if (read(fd, &si, sizeof(si)) != sizeof(si))
+        return;
+    catch_sigint(si.ssi_signo);
+    reactor_stop();
+}
+
+// Progress of a module through init and start.
+typedef enum
+{
+    MOD_PENDING,  // waiting for its dependencies
+    MOD_RUNNING,  // init running on an init thread
+    MOD_INITED,   // init succeeded, not started yet
+    MOD_STARTED,  // reactor callbacks registered and threads created
+    MOD_FAILED    // init failed
+} module_state;
+
+static struct
+{
+    module_state state;
+    int ret;             // init return value
+    int status;          // sys_status left by the init, which runs on another thread
+    uint64_t t_start;    // CLOCK_MONOTONIC ns
+    uint64_t t_end;
+} mod[NUM_MODULES];
+
+static pthread_mutex_t init_m = PTHREAD_MUTEX_INITIALIZER; // protects mod[]
+static pthread_cond_t init_cond = PTHREAD_COND_INITIALIZER; // signalled when a module starts
+static int init_evfd = -1;    // written by init threads when an init returns
+static int init_timer = -1;   // checks running inits against their timeouts
+static uint64_t init_t0;      // start of module init
+static int num_started = 0;
+
+static pthread_t thread[sizeof(module_exec) / sizeof(module_thread)]; // thread containers
+static int args[sizeof(module_exec) / sizeof(module_thread)];         // thread arguments (thread id in this case, but can be expanded by passing structs etc)
+static int started[sizeof(module_exec) / sizeof(module_thread)];      // set for threads that were created
+
+static inline uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Init thread: runs the inits whose dependencies have started, one at a time.
+static void *init_worker(void *arg)
+{
+    pthread_mutex_lock(&init_m);
+    while (!done)
+    {
+        int next = -1, left = 0;
+        for (int i = 0; i < NUM_MODULES && next < 0; i++)
+        {
+            if (mod[i].state != MOD_PENDING)
+                continue;
+            left = 1;
+            int ready = 1;
+            for (int j = 0; j < NUM_MODULES && ready; j++)
+                if ((modules[i].deps & MODULE_DEP(j)) && mod[j].state != MOD_STARTED)
+                    ready = 0;
+            if (ready)
+                next = i;
+        }
+        if (!left)
+            break;
+        if (next < 0)
+        {
+            pthread_cond_wait(&init_cond, &init_m);
+            continue;
+        }
+        mod[next].state = MOD_RUNNING;
+        mod[next].t_start = now_ns();
+        pthread_mutex_unlock(&init_m);
+        sys_status = 0;
+        int ret = modules[next].init();
+        int status = sys_status;
+        pthread_mutex_lock(&init_m);
+        mod[next].t_end = now_ns();
+        mod[next].ret = ret;
+        mod[next].status = status;
+        mod[next].state = ret < 0 ? MOD_FAILED : MOD_INITED;
+        uint64_t one = 1;
+        if (write(init_evfd, &one, sizeof(one)) != sizeof(one))
+            perror("init_worker: eventfd");
+    }
+    pthread_mutex_unlock(&init_m);
+    return NULL;
+}
+
+// Creates the threads of a module.
+static void start_threads(module_id m)
+{
+    for (int i = 0; i < num_systems; i++)
+    {
+        if (module_exec[i].module != m)
+            continue;
+        args[i] = i; // sending a pointer to i to every thread may end up with duplicate thread ids because of access times
+        int rc = pthread_create(&thread[i], NULL, module_exec[i].fn, (void *)(&args[i]));
+        if (rc)
+        {
+            printf("[Main] Error: Unable to create thread %d: Errno %d\n", i, rc);
+            exit(-1);
+        }
+        started[i] = 1;
+    }
+}
+
+// Starts every module whose init has returned; fatal if one failed.
+static void on_init_done(int fd, uint32_t events, void *arg)
+{
+    uint64_t n;
+    if (read(fd, &n, sizeof(n)) != sizeof(n))
+        return;
+    for (int i = 0; i < NUM_MODULES; i++)
+    {
+        pthread_mutex_lock(&init_m);
+        module_state state = mod[i].state;
+        double ms = (mod[i].t_end - mod[i].t_start) * 1e-6;
+        sys_status = mod[i].status;
+        pthread_mutex_unlock(&init_m);
+        if (state == MOD_FAILED)
+        {
+            fprintf(stderr, "Init of %s failed after %.1f ms\n", modules[i].name, ms);
+            sherror("Error in initialization!");
+            exit(-1);
+        }
+        if (state != MOD_INITED)
+            continue;
+        // register periodic work and file descriptors with the reactor
+        if (modules[i].reg != NULL && modules[i].reg() < 0)
+        {
+            sherror("Error in reactor registration!");
+            exit(-1);
+        }
+        start_threads(i);
+        printf("Init %s: %.1f ms, started at %.1f ms\n", modules[i].name, ms, (now_ns() - init_t0) * 1e-6);
+        pthread_mutex_lock(&init_m);
+        mod[i].state = MOD_STARTED;
+        pthread_cond_broadcast(&init_cond);
+        pthread_mutex_unlock(&init_m);
+        if (++num_started == NUM_MODULES)
+            printf("Done init modules in %.1f ms\n", (now_ns() - init_t0) * 1e-6);
+    }
+}
+
+// Fails the boot if an init overruns its timeout. A stuck init can not be
+// cancelled safely, it may hold the bus or half-built module state. As for
+// a failed init, the process exits at once: the init threads are left
+// running, no module is destroyed, and exit() flushes stdio and runs the
+// atexit handlers. init_m is released first so that nothing run by exit()
+// can block on it.
+static void on_init_check(int fd, uint32_t events, void *arg)
+{
+    uint64_t now = now_ns();
+    int late = -1;
+    pthread_mutex_lock(&init_m);
+    for (int i = 0; i < NUM_MODULES && late < 0; i++)
+    {
+        if (mod[i].state == MOD_RUNNING && now - mod[i].t_start > modules[i].timeout_ms * 1000000ULL)
+            late = i;
+    }
+    pthread_mutex_unlock(&init_m);
+    if (late >= 0)
+    {
+        fprintf(stderr, "Init of %s timed out after %u ms\n", modules[late].name, modules[late].timeout_ms);
+        sherror("Error in initialization!");
+        exit(-1);
+    }
+    if (num_started < NUM_MODULES)
+        reactor_timer_at(init_timer, now + INIT_CHECK_MS * 1000000ULL);
+}
+
 /**
  * @brief Main function executed when shflight.out binary is executed
  * 
@@ -37,63 +216,76 @@ int main(void)
         fprintf(stderr, "Boot count returned negative, fatal error. Exiting.\n");
         exit(-1);
     }
-    // SIGINT handler register
-    struct sigaction saction;
-    saction.sa_handler = &catch_sigint;
-    sigaction(SIGINT, &saction, NULL);
-    // initialize modules
-    for (int i = 0; i < num_init; i++)
+    // SIGINT is blocked in every thread and read from a signalfd by the
+    // reactor, so shutdown is handled on the main thread, at once
+    sigset_t sigs;
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+    int sfd = signalfd(-1, &sigs, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (sfd < 0 || reactor_init() < 0 || reactor_add(sfd, EPOLLIN, on_signal, NULL) < 0)
     {
-        int val = module_init[i]();
-        if (val < 0)
-        {
-            sherror("Error in initialization!");
-            exit(-1);
-        }
+        fprintf(stderr, "Event loop setup failed, fatal error. Exiting.\n");
+        exit(-1);
     }
-    printf("Done init modules\n");
-    // set up threads
-    int rc[num_systems];                                         // fork-join return codes
-    pthread_t thread[num_systems];                               // thread containers
-    pthread_attr_t attr;                                         // thread attribute
-    int args[num_systems];                                       // thread arguments (thread id in this case, but can be expanded by passing structs etc)
-    void *status;                                                // thread return value
-    pthread_attr_init(&attr);                                    // initialize attribute
-    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE); // create threads to be joinable
-
-    for (int i = 0; i < num_systems; i++)
+    // initialize modules on the init threads; each module is started from
+    // the reactor as soon as its init returns
+    init_evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (init_evfd < 0 || reactor_add(init_evfd, EPOLLIN, on_init_done, NULL) < 0 ||
+        (init_timer = reactor_timer(on_init_check, NULL)) < 0)
     {
-        args[i] = i; // sending a pointer to i to every thread may end up with duplicate thread ids because of access times
-        rc[i] = pthread_create(&thread[i], &attr, module_exec[i], (void *)(&args[i]));
-        if (rc[i])
+        fprintf(stderr, "Init setup failed, fatal error. Exiting.\n");
+        exit(-1);
+    }
+    init_t0 = now_ns();
+    reactor_timer_at(init_timer, init_t0 + INIT_CHECK_MS * 1000000ULL);
+    int num_workers = NUM_MODULES < INIT_THREADS ? NUM_MODULES : INIT_THREADS;
+    pthread_t workers[num_workers];
+    for (int i = 0; i < num_workers; i++)
+    {
+        int rc = pthread_create(&workers[i], NULL, init_worker, NULL);
+        if (rc)
         {
-            printf("[Main] Error: Unable to create thread %d: Errno %d\n", i, errno);
+            printf("[Main] Error: Unable to create init thread %d: Errno %d\n", i, rc);
             exit(-1);
         }
     }
 
-    pthread_attr_destroy(&attr); // destroy the attribute
+    // serve events until SIGINT or a module stops the reactor
+    reactor_run();
+    catch_sigint(SIGINT); // make sure every thread sees the shutdown, whatever stopped the reactor
+
+    // inits still running finish; pending ones are skipped
+    for (int i = 0; i < num_workers; i++)
+        pthread_join(workers[i], NULL);
 
+    void *status; // thread return value
     for (int i = 0; i < num_systems; i++)
     {
-        rc[i] = pthread_join(thread[i], &status);
-        if (rc[i])
+        if (!started[i])
+            continue;
+        int rc = pthread_join(thread[i], &status);
+        if (rc)
         {
-            printf("[Main] Error: Unable to join thread %d: Errno %d\n", i, errno);
+            printf("[Main] Error: Unable to join thread %d: Errno %d\n", i, rc);
             exit(-1);
         }
     }
 
-    // destroy modules
-    for (int i = 0; i < num_destroy; i++)
+    // destroy modules, dependents first
+    for (int i = NUM_MODULES - 1; i >= 0; i--)
     {
-        module_destroy[i]();
+        if (mod[i].state == MOD_INITED || mod[i].state == MOD_STARTED)
+            modules[i].destroy();
     }
+    reactor_destroy();
+    close(init_evfd);
+    close(sfd);
     return 0;
 }
 /**
- * @brief SIGINT handler, sets the global variable `done` as 1, so that thread loops can break.
- * Wakes up sitl_comm and datavis threads to ensure they exit.
+ * @brief SIGINT handler, run by the reactor when SIGINT arrives on its signalfd. Sets the global
+ * variable `done` as 1, so that thread loops can break, and wakes up the threads in wakeups[].
  * 
  * @param sig Receives the signal as input.
  */
@@ -102,6 +294,10 @@ void catch_sigint(int sig)
     done = 1;
     for (int i = 0; i < num_wakeups; i++)
         pthread_cond_broadcast(wakeups[i]);
+    // init threads waiting for a dependency stop as well
+    pthread_mutex_lock(&init_m);
+    pthread_cond_broadcast(&init_cond);
+    pthread_mutex_unlock(&init_m);
 }
 /**
  * @brief Prints errors specific to shflight in a fashion similar to perror
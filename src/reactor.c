@@ -0,0 +1,182 @@
+/**
+ * @file reactor.c
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief epoll event loop with timerfd timers, run on the main thread.
+ * @version 0.1
+ * @date 2021-04-15
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include "reactor.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+/**
+ * @brief A registered file descriptor.
+ *
+ */
+typedef struct
+{
+    int fd; // -1 if unused
+    int timer;
+    reactor_cb cb;
+    void *arg;
+} reactor_entry;
+
+static int reactor_epfd = -1;
+static int reactor_stopfd = -1; // eventfd posted by reactor_stop()
+static reactor_entry reactor_entries[REACTOR_MAX_FDS];
+
+#define REACTOR_TAG_STOP REACTOR_MAX_FDS // epoll tag of reactor_stopfd
+
+int reactor_init(void)
+{
+    for (int i = 0; i < REACTOR_MAX_FDS; i++)
+        reactor_entries[i].fd = -1;
+    reactor_epfd = epoll_create1(EPOLL_CLOEXEC);
+    reactor_stopfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    struct epoll_event ev = {.events = EPOLLIN};
+    ev.data.u32 = REACTOR_TAG_STOP;
+    if (reactor_epfd < 0 || reactor_stopfd < 0 || epoll_ctl(reactor_epfd, EPOLL_CTL_ADD, reactor_stopfd, &ev) < 0)
+    {
+        perror("reactor_init");
+        reactor_destroy();
+        return -1;
+    }
+    return 1;
+}
+
+static reactor_entry *reactor_find(int fd)
+{
+    for (int i = 0; i < REACTOR_MAX_FDS; i++)
+        if (reactor_entries[i].fd == fd)
+            return &reactor_entries[i];
+    return NULL;
+}
+
+static int reactor_insert(int fd, uint32_t events, int timer, reactor_cb cb, void *arg)
+{
+    if (fd < 0 || cb == NULL || reactor_find(fd) != NULL)
+        return -1;
+    reactor_entry *e = reactor_find(-1);
+    if (e == NULL)
+    {
+        fprintf(stderr, "reactor: more than %d file descriptors\n", REACTOR_MAX_FDS);
+        return -1;
+    }
+    struct epoll_event ev = {.events = events};
+    ev.data.u32 = e - reactor_entries;
+    if (epoll_ctl(reactor_epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+        return -1;
+    e->fd = fd;
+    e->timer = timer;
+    e->cb = cb;
+    e->arg = arg;
+    return 1;
+}
+
+int reactor_add(int fd, uint32_t events, reactor_cb cb, void *arg)
+{
+    return reactor_insert(fd, events, 0, cb, arg);
+}
+
+int reactor_mod(int fd, uint32_t events)
+{
+    reactor_entry *e = reactor_find(fd);
+    if (fd < 0 || e == NULL)
+        return -1;
+    struct epoll_event ev = {.events = events};
+    ev.data.u32 = e - reactor_entries;
+    return epoll_ctl(reactor_epfd, EPOLL_CTL_MOD, fd, &ev) < 0 ? -1 : 1;
+}
+
+int reactor_del(int fd)
+{
+    reactor_entry *e = reactor_find(fd);
+    if (fd < 0 || e == NULL)
+        return -1;
+    epoll_ctl(reactor_epfd, EPOLL_CTL_DEL, fd, NULL);
+    e->fd = -1;
+    return 1;
+}
+
+int reactor_timer(reactor_cb cb, void *arg)
+{
+    int tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (tfd < 0)
+        return -1;
+    if (reactor_insert(tfd, EPOLLIN, 1, cb, arg) < 0)
+    {
+        close(tfd);
+        return -1;
+    }
+    return tfd;
+}
+
+int reactor_timer_at(int timer, uint64_t t_mono_ns)
+{
+    // a zero it_value would disarm the timer
+    if (t_mono_ns == 0)
+        t_mono_ns = 1;
+    struct itimerspec its = {.it_value = {.tv_sec = t_mono_ns / 1000000000ULL, .tv_nsec = t_mono_ns % 1000000000ULL}};
+    return timerfd_settime(timer, TFD_TIMER_ABSTIME, &its, NULL) < 0 ? -1 : 1;
+}
+
+void reactor_run(void)
+{
+    struct epoll_event events[REACTOR_MAX_FDS + 1];
+    for (;;)
+    {
+        int n = epoll_wait(reactor_epfd, events, REACTOR_MAX_FDS + 1, -1);
+        if (n < 0 && errno != EINTR)
+        {
+            perror("reactor_run");
+            return;
+        }
+        for (int i = 0; i < n; i++)
+        {
+            uint32_t tag = events[i].data.u32;
+            if (tag == REACTOR_TAG_STOP)
+                return;
+            reactor_entry *e = &reactor_entries[tag];
+            // an earlier callback of this round may have removed it
+            if (e->fd < 0)
+                continue;
+            if (e->timer)
+            {
+                uint64_t expirations;
+                if (read(e->fd, &expirations, sizeof(expirations)) < 0)
+                    continue; // re-armed by an earlier callback of this round
+            }
+            e->cb(e->fd, events[i].events, e->arg);
+        }
+    }
+}
+
+void reactor_stop(void)
+{
+    uint64_t one = 1;
+    if (reactor_stopfd >= 0)
+        write(reactor_stopfd, &one, sizeof(one));
+}
+
+void reactor_destroy(void)
+{
+    for (int i = 0; i < REACTOR_MAX_FDS; i++)
+    {
+        if (reactor_entries[i].fd >= 0 && reactor_entries[i].timer)
+            close(reactor_entries[i].fd);
+        reactor_entries[i].fd = -1;
+    }
+    if (reactor_epfd >= 0)
+        close(reactor_epfd);
+    if (reactor_stopfd >= 0)
+        close(reactor_stopfd);
+    reactor_epfd = reactor_stopfd = -1;
+}
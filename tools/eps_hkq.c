@@ -0,0 +1,370 @@
+/**
+ * @file eps_hkq.c
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Offline decoder and query tool for EPS housekeeping log files.
+ *
+ * Maps one or more eps_hk_<boot>.bin files, selects records by time and boot
+ * count, and prints per-field statistics and/or exports the selection as CSV.
+ *
+ * Records are decoded in blocks: each block is transposed into one column per
+ * field, and the statistics kernels then run over contiguous columns where the
+ * compiler can vectorize them. Percentiles are exact, from a 65536-bin
+ * histogram per field, so memory use does not grow with the size of the log.
+ *
+ * @version 0.1
+ * @date 2021-04-15
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include "eps_log.h"
+#include <fcntl.h>
+#include <getopt.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define HKQ_BLOCK 1024 // records decoded per block
+
+/**
+ * @brief A 16-bit housekeeping field and where it lives in a record.
+ *
+ */
+typedef struct
+{
+    const char *name;
+    size_t offset;
+    int is_signed;
+    uint32_t flag; // EPS_LOG_HAS_* the field depends on
+} hkq_field;
+
+#define HK(name, member, sgn) {name, offsetof(eps_log_rec_t, hk.member), sgn, EPS_LOG_HAS_HK}
+#define OUT(name, member) {name, offsetof(eps_log_rec_t, hk_out.member), 0, EPS_LOG_HAS_HK_OUT}
+
+static const hkq_field hkq_fields[] = {
+    HK("pv0", pv[0], 0),
+    HK("pv1", pv[1], 0),
+    HK("pv2", pv[2], 0),
+    HK("pc", pc, 0),
+    HK("bv", bv, 0),
+    HK("sc", sc, 0),
+    HK("temp0", temp[0], 1),
+    HK("temp1", temp[1], 1),
+    HK("temp2", temp[2], 1),
+    HK("temp3", temp[3], 1),
+    HK("batt_temp0", batt_temp[0], 1),
+    HK("batt_temp1", batt_temp[1], 1),
+    OUT("curout0", curout[0]),
+    OUT("curout1", curout[1]),
+    OUT("curout2", curout[2]),
+    OUT("curout3", curout[3]),
+    OUT("curout4", curout[4]),
+    OUT("curout5", curout[5]),
+};
+
+#define HKQ_NFIELDS (sizeof(hkq_fields) / sizeof(hkq_field))
+
+/**
+ * @brief Running statistics of one field.
+ *
+ */
+typedef struct
+{
+    uint64_t count;
+    int32_t min;
+    int32_t max;
+    int64_t sum;
+    uint32_t *hist; // 65536 bins, value + 32768 for signed fields
+} hkq_stat;
+
+/**
+ * @brief Record selection.
+ *
+ */
+typedef struct
+{
+    uint64_t since_ns;
+    uint64_t until_ns;
+    int boot_min;
+    int boot_max;
+} hkq_filter;
+
+static hkq_stat hkq_stats[HKQ_NFIELDS];
+
+// Columns of the current block, one per field.
+static int32_t hkq_col[HKQ_NFIELDS][HKQ_BLOCK] __attribute__((aligned(64)));
+
+static inline int32_t hkq_get(const eps_log_rec_t *rec, const hkq_field *f)
+{
+    uint16_t v;
+    memcpy(&v, (const uint8_t *)rec + f->offset, sizeof(v));
+    return f->is_signed ? (int32_t)(int16_t)v : (int32_t)v;
+}
+
+// Folds n values of one column into its statistics.
+static void hkq_accumulate(hkq_stat *st, const int32_t *col, int n, int is_signed)
+{
+    int32_t mn = st->min, mx = st->max;
+    int64_t sum = 0;
+    for (int i = 0; i < n; i++) // vectorizes: min/max/sum reductions
+    {
+        mn = col[i] < mn ? col[i] : mn;
+        mx = col[i] > mx ? col[i] : mx;
+        sum += col[i];
+    }
+    st->min = mn;
+    st->max = mx;
+    st->sum += sum;
+    st->count += n;
+    int32_t bias = is_signed ? 32768 : 0;
+    for (int i = 0; i < n; i++)
+        st->hist[(col[i] + bias) & 0xffff]++;
+}
+
+static int32_t hkq_quantile(const hkq_stat *st, double q, int is_signed)
+{
+    uint64_t rank = (uint64_t)(q * (st->count - 1)) + 1, seen = 0;
+    for (int i = 0; i < 65536; i++)
+    {
+        seen += st->hist[i];
+        if (seen >= rank)
+            return i - (is_signed ? 32768 : 0);
+    }
+    return st->max;
+}
+
+static void hkq_csv_header(FILE *fp)
+{
+    fprintf(fp, "seq,t_mono_ns,t_real_ns,boot_count");
+    for (size_t f = 0; f < HKQ_NFIELDS; f++)
+        fprintf(fp, ",%s", hkq_fields[f].name);
+    fprintf(fp, "\n");
+}
+
+// Decodes a block of selected records into columns and folds them in.
+static void hkq_block(const eps_log_rec_t **recs, int n, FILE *csv)
+{
+    for (size_t f = 0; f < HKQ_NFIELDS; f++)
+    {
+        const hkq_field *fd = &hkq_fields[f];
+        int m = 0;
+        for (int i = 0; i < n; i++)
+            if (recs[i]->flags & fd->flag)
+                hkq_col[f][m++] = hkq_get(recs[i], fd);
+        hkq_accumulate(&hkq_stats[f], hkq_col[f], m, fd->is_signed);
+    }
+    if (csv == NULL)
+        return;
+    for (int i = 0; i < n; i++)
+    {
+        const eps_log_rec_t *rec = recs[i];
+        fprintf(csv, "%llu,%llu,%llu,%d", (unsigned long long)rec->seq, (unsigned long long)rec->t_mono_ns,
+                (unsigned long long)rec->t_real_ns, rec->boot_count);
+        for (size_t f = 0; f < HKQ_NFIELDS; f++)
+        {
+            if (rec->flags & hkq_fields[f].flag)
+                fprintf(csv, ",%d", hkq_get(rec, &hkq_fields[f]));
+            else
+                fprintf(csv, ",");
+        }
+        fprintf(csv, "\n");
+    }
+}
+
+/**
+ * @brief Scans one log file.
+ *
+ * @return long Number of records selected, -1 on error.
+ */
+static long hkq_file(const char *fname, const hkq_filter *flt, FILE *csv)
+{
+    int fd = open(fname, O_RDONLY);
+    if (fd < 0)
+    {
+        perror(fname);
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < EPS_LOG_HDR_SZ)
+    {
+        fprintf(stderr, "%s: not a housekeeping log\n", fname);
+        close(fd);
+        return -1;
+    }
+    uint8_t *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        perror(fname);
+        return -1;
+    }
+    const eps_log_hdr_t *hdr = (const eps_log_hdr_t *)map;
+    if (hdr->magic != EPS_LOG_MAGIC || hdr->version != EPS_LOG_VERSION || hdr->rec_sz != EPS_LOG_REC_SZ ||
+        (size_t)st.st_size < EPS_LOG_HDR_SZ + (size_t)hdr->capacity * EPS_LOG_REC_SZ)
+    {
+        fprintf(stderr, "%s: not a housekeeping log\n", fname);
+        munmap(map, st.st_size);
+        return -1;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    const eps_log_rec_t *ring = (const eps_log_rec_t *)(map + EPS_LOG_HDR_SZ);
+    uint64_t last = hdr->seq;
+    uint64_t first = last > hdr->capacity ? last - hdr->capacity + 1 : 1;
+
+    const eps_log_rec_t *block[HKQ_BLOCK];
+    int n = 0;
+    long selected = 0;
+    for (uint64_t seq = first; seq <= last; seq++)
+    {
+        const eps_log_rec_t *rec = &ring[(seq - 1) % hdr->capacity];
+        if (rec->seq != seq) // torn or overwritten while we were reading
+            continue;
+        if (rec->t_real_ns < flt->since_ns || rec->t_real_ns > flt->until_ns ||
+            rec->boot_count < flt->boot_min || rec->boot_count > flt->boot_max)
+            continue;
+        block[n++] = rec;
+        if (n == HKQ_BLOCK)
+        {
+            hkq_block(block, n, csv);
+            selected += n;
+            n = 0;
+        }
+    }
+    hkq_block(block, n, csv);
+    selected += n;
+    munmap(map, st.st_size);
+    return selected;
+}
+
+static void hkq_print_stats(FILE *fp)
+{
+    fprintf(fp, "%-12s %10s %8s %8s %10s %8s %8s %8s %8s\n",
+            "field", "count", "min", "max", "mean", "p50", "p90", "p99", "p99.9");
+    for (size_t f = 0; f < HKQ_NFIELDS; f++)
+    {
+        const hkq_stat *st = &hkq_stats[f];
+        int sgn = hkq_fields[f].is_signed;
+        if (st->count == 0)
+        {
+            fprintf(fp, "%-12s %10d\n", hkq_fields[f].name, 0);
+            continue;
+        }
+        fprintf(fp, "%-12s %10llu %8d %8d %10.2f %8d %8d %8d %8d\n", hkq_fields[f].name,
+                (unsigned long long)st->count, st->min, st->max, (double)st->sum / st->count,
+                hkq_quantile(st, 0.5, sgn), hkq_quantile(st, 0.9, sgn),
+                hkq_quantile(st, 0.99, sgn), hkq_quantile(st, 0.999, sgn));
+    }
+}
+
+static void hkq_usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [options] eps_hk_<boot>.bin...\n"
+            "  -s, --since SEC      only records at or after UNIX time SEC\n"
+            "  -u, --until SEC      only records at or before UNIX time SEC\n"
+            "  -b, --boot A[:B]     only records with boot count A (through B)\n"
+            "  -c, --csv FILE       write selected records as CSV to FILE ('-' for stdout)\n"
+            "  -n, --no-stats       do not print field statistics\n"
+            "  -h, --help           show this message\n",
+            prog);
+}
+
+int main(int argc, char *argv[])
+{
+    hkq_filter flt = {.since_ns = 0, .until_ns = UINT64_MAX, .boot_min = INT32_MIN, .boot_max = INT32_MAX};
+    const char *csvname = NULL;
+    int stats = 1;
+    static const struct option opts[] = {
+        {"since", required_argument, NULL, 's'},
+        {"until", required_argument, NULL, 'u'},
+        {"boot", required_argument, NULL, 'b'},
+        {"csv", required_argument, NULL, 'c'},
+        {"no-stats", no_argument, NULL, 'n'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}};
+    int c;
+    while ((c = getopt_long(argc, argv, "s:u:b:c:nh", opts, NULL)) != -1)
+    {
+        switch (c)
+        {
+        case 's':
+            flt.since_ns = (uint64_t)(strtod(optarg, NULL) * 1e9);
+            break;
+        case 'u':
+            flt.until_ns = (uint64_t)(strtod(optarg, NULL) * 1e9);
+            break;
+        case 'b':
+        {
+            char *end;
+            flt.boot_min = flt.boot_max = strtol(optarg, &end, 0);
+            if (*end == ':')
+                flt.boot_max = strtol(end + 1, NULL, 0);
+            break;
+        }
+        case 'c':
+            csvname = optarg;
+            break;
+        case 'n':
+            stats = 0;
+            break;
+        default:
+            hkq_usage(argv[0]);
+            return c == 'h' ? 0 : 1;
+        }
+    }
+    if (optind >= argc)
+    {
+        hkq_usage(argv[0]);
+        return 1;
+    }
+
+    FILE *csv = NULL;
+    if (csvname != NULL)
+    {
+        csv = strcmp(csvname, "-") ? fopen(csvname, "w") : stdout;
+        if (csv == NULL)
+        {
+            perror(csvname);
+            return 1;
+        }
+        hkq_csv_header(csv);
+    }
+    for (size_t f = 0; f < HKQ_NFIELDS; f++)
+    {
+        hkq_stats[f].min = INT32_MAX;
+        hkq_stats[f].max = INT32_MIN;
+        hkq_stats[f].hist = calloc(65536, sizeof(uint32_t));
+        if (hkq_stats[f].hist == NULL)
+        {
+            perror("calloc");
+            return 1;
+        }
+    }
+
+    int ret = 0;
+    long total = 0;
+    for (int i = optind; i < argc; i++)
+    {
+        long n = hkq_file(argv[i], &flt, csv);
+        if (n < 0)
+            ret = 1;
+        else
+            total += n;
+    }
+    if (csv != NULL && csv != stdout)
+        fclose(csv);
+    if (stats)
+    {
+        FILE *out = csv == stdout ? stderr : stdout;
+        fprintf(out, "%ld records selected\n", total);
+        hkq_print_stats(out);
+    }
+    for (size_t f = 0; f < HKQ_NFIELDS; f++)
+        free(hkq_stats[f].hist);
+    return ret;
+}
@@ -0,0 +1,125 @@
+/**
+ * @file eps_tracecat.c
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Prints an I2C trace recorded with EPS_TRACE.
+ *
+ * Lists every record, one per line, or with -s a summary of the count,
+ * errors and latency of each operation and command byte.
+ *
+ * @version 0.1
+ * @date 2021-04-15
+ *
+ * @copyright Copyright (c) 2021
+ *
+ */
+
+#include "eps_trace.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char *tracecat_ops[] = {"open", "close", "write", "read", "xfer"};
+
+/**
+ * @brief Statistics of one operation and command byte.
+ *
+ */
+typedef struct
+{
+    unsigned long n;
+    unsigned long errors;
+    uint64_t lat_sum;
+    uint32_t lat_max;
+} tracecat_sum;
+
+static tracecat_sum tracecat_sums[EPS_TRACE_XFER + 1][256];
+
+static void tracecat_print(const eps_trace_rec_t *rec)
+{
+    const uint8_t *data = (const uint8_t *)(rec + 1);
+    printf("%12.6f %-5s %d:0x%02x %8.1f us %4d", rec->t_ns * 1e-9, tracecat_ops[rec->op], rec->bus, rec->addr, rec->lat_ns * 1e-3, rec->ret);
+    if (rec->ret < 0)
+        printf(" (%s)", strerror(rec->err));
+    if (rec->wlen)
+        printf(" w");
+    for (int i = 0; i < rec->wlen; i++)
+        printf(" %02x", data[i]);
+    if (rec->rlen)
+        printf(" r");
+    for (int i = 0; i < rec->rlen; i++)
+        printf(" %02x", data[rec->wlen + i]);
+    printf("\n");
+}
+
+static void tracecat_summary()
+{
+    printf("%-5s %4s %8s %6s %10s %10s\n", "op", "cmd", "count", "errors", "mean_us", "max_us");
+    for (int op = 0; op <= EPS_TRACE_XFER; op++)
+    {
+        for (int cmd = 0; cmd < 256; cmd++)
+        {
+            const tracecat_sum *s = &tracecat_sums[op][cmd];
+            if (s->n == 0)
+                continue;
+            printf("%-5s %4d %8lu %6lu %10.1f %10.1f\n", tracecat_ops[op], cmd, s->n, s->errors, s->lat_sum * 1e-3 / s->n, s->lat_max * 1e-3);
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int summary = argc > 1 && strcmp(argv[1], "-s") == 0;
+    if (argc != 2 + summary)
+    {
+        fprintf(stderr, "Usage: %s [-s] trace\n", argv[0]);
+        return 1;
+    }
+    int fd = open(argv[1 + summary], O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0)
+    {
+        perror(argv[1 + summary]);
+        return 1;
+    }
+    size_t size = st.st_size;
+    const uint8_t *trace = size > 0 ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    const eps_trace_hdr_t *hdr = (const eps_trace_hdr_t *)trace;
+    if (trace == MAP_FAILED || size < sizeof(eps_trace_hdr_t) || hdr->magic != EPS_TRACE_MAGIC || hdr->version != EPS_TRACE_VERSION || hdr->rec_size != sizeof(eps_trace_rec_t))
+    {
+        fprintf(stderr, "%s: not a version %d trace\n", argv[1 + summary], EPS_TRACE_VERSION);
+        return 1;
+    }
+    if (!summary)
+        printf("# started %.3f (CLOCK_REALTIME)\n", hdr->t_real_ns * 1e-9);
+    size_t ofs = sizeof(eps_trace_hdr_t);
+    while (ofs + sizeof(eps_trace_rec_t) <= size)
+    {
+        const eps_trace_rec_t *rec = (const eps_trace_rec_t *)(trace + ofs);
+        if (ofs + EPS_TRACE_REC_SIZE(rec) > size || rec->op > EPS_TRACE_XFER)
+        {
+            fprintf(stderr, "%s: truncated at byte %zu\n", argv[1 + summary], ofs);
+            break;
+        }
+        ofs += EPS_TRACE_REC_SIZE(rec);
+        if (!summary)
+        {
+            tracecat_print(rec);
+            continue;
+        }
+        tracecat_sum *s = &tracecat_sums[rec->op][rec->cmd];
+        s->n++;
+        s->errors += rec->ret < 0;
+        s->lat_sum += rec->lat_ns;
+        if (rec->lat_ns > s->lat_max)
+            s->lat_max = rec->lat_ns;
+    }
+    if (summary)
+        tracecat_summary();
+    munmap((void *)trace, size);
+    return 0;
+}